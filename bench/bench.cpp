@@ -0,0 +1,686 @@
+#include <quickjs.hpp>
+#include <benchmark/benchmark.h>
+
+namespace
+{
+	struct bench_env
+	{
+		quickjs::runtime rt;
+		quickjs::context ctx;
+		quickjs::value g;
+		
+		bench_env():
+			ctx(rt.new_context()),
+			g(ctx.get_global_object())
+		{
+		}
+	};
+	
+	int64_t sink = 0;
+	
+	void add(int32_t a, int32_t b)
+	{
+		sink += a + b;
+	}
+	
+	// Calls the given global function 'count' times from within JS
+	void run_js_loop(benchmark::State& state, bench_env& env, const char* func, const char* call_args)
+	{
+		const int32_t count = 1000;
+		std::string js = std::string("(function (n) { var r = 0; for (var i = 0; i < n; i++) r = ") + func + "(" + call_args + "); return r; })";
+		auto loop = env.ctx.eval(js.c_str());
+		for (auto _ : state)
+			benchmark::DoNotOptimize(loop(count));
+		state.SetItemsProcessed(state.iterations() * count);
+	}
+}
+
+class bench_class
+{
+	int32_t val_{0};
+	
+public:
+	static quickjs::class_def<bench_class> class_definition;
+	
+	bench_class() = default;
+	
+	bench_class(const quickjs::args& a)
+	{
+	}
+	
+	quickjs::value inc(const quickjs::args& a)
+	{
+		val_++;
+		return quickjs::value();
+	}
+	
+	// Getters return 'this' so that only the dispatch is measured
+	quickjs::value get_val(const quickjs::value& thisObj)
+	{
+		return thisObj;
+	}
+	
+	void set_val(const quickjs::value& thisObj, const quickjs::value& val)
+	{
+		val_ = val.as_int32();
+	}
+	
+	quickjs::value get_val_ref(quickjs::value_ref thisObj)
+	{
+		return thisObj;
+	}
+	
+	void set_val_ref(quickjs::value_ref thisObj, quickjs::value_ref val)
+	{
+		val_ = val.as_int32();
+	}
+	
+	int32_t add(int32_t a, int32_t b)
+	{
+		return val_ += a + b;
+	}
+	
+	int32_t field_{0};
+};
+
+quickjs::class_def<bench_class> bench_class::class_definition = quickjs::runtime::create_class_def<bench_class>("bench_class", 0,
+	quickjs::object<bench_class>::function<&bench_class::inc>("inc"),
+	quickjs::object<bench_class>::getset<&bench_class::get_val, &bench_class::set_val>("val"),
+	quickjs::object<bench_class>::getset<&bench_class::get_val_ref, &bench_class::set_val_ref>("val_ref"),
+	quickjs::object<bench_class>::method<int32_t(bench_class::*)(int32_t, int32_t), &bench_class::add>("add"),
+	quickjs::object<bench_class>::field<int32_t, &bench_class::field_>("field"));
+
+//
+// eval
+//
+
+static void BM_EvalSmall(benchmark::State& state)
+{
+	bench_env env;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(env.ctx.eval("1 + 2"));
+}
+BENCHMARK(BM_EvalSmall);
+
+static void BM_EvalLarge(benchmark::State& state)
+{
+	bench_env env;
+	std::string js;
+	for (int i = 0; i < 500; i++)
+		js += "function f" + std::to_string(i) + "(a, b) { var o = { a: a, b: b }; return o.a * o.b + " + std::to_string(i) + "; }\n";
+	js += "f499(2, 3);";
+	for (auto _ : state)
+		benchmark::DoNotOptimize(env.ctx.eval(js.c_str()));
+	state.SetBytesProcessed(state.iterations() * js.size());
+}
+BENCHMARK(BM_EvalLarge);
+
+//
+// C++ -> JS calls
+//
+
+static void BM_Call0(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function () { return 1; })");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(func());
+}
+BENCHMARK(BM_Call0);
+
+static void BM_Call1(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function (a) { return a; })");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(func(1));
+}
+BENCHMARK(BM_Call1);
+
+static void BM_Call4(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function (a, b, c, d) { return a; })");
+	std::string str("str");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(func(1, 2.5, str, true));
+}
+BENCHMARK(BM_Call4);
+
+static void BM_CallVector(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function () { return arguments.length; })");
+	std::vector<quickjs::value> a;
+	for (int64_t i = 0; i < state.range(0); i++)
+		a.push_back(env.ctx.eval(std::to_string(i).c_str()));
+	for (auto _ : state)
+		benchmark::DoNotOptimize(func(a.begin(), a.end()));
+}
+BENCHMARK(BM_CallVector)->Arg(1)->Arg(8)->Arg(64);
+
+static void BM_CallGlobal(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.eval("function handle(a) { return a; }");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(env.ctx.call_global("handle", 1));
+}
+BENCHMARK(BM_CallGlobal);
+
+static void BM_CallFunctionHandle(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.eval("function handle(a) { return a; }");
+	quickjs::function_handle handle(env.ctx, "handle");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(handle(1));
+}
+BENCHMARK(BM_CallFunctionHandle);
+
+static void BM_CallBatch(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function (a, b) { return a + b; })");
+	std::vector<std::tuple<int32_t, int32_t>> records;
+	for (int32_t i = 0; i < 1000; i++)
+		records.push_back(std::make_tuple(i, 1));
+	std::vector<quickjs::batch_result> results;
+	results.reserve(records.size());
+	for (auto _ : state)
+	{
+		results.clear();
+		func.call_batch(quickjs::value(), records.begin(), records.end(), std::back_inserter(results));
+	}
+	state.SetItemsProcessed(state.iterations() * records.size());
+}
+BENCHMARK(BM_CallBatch);
+
+static void BM_CallThrowCatch(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function (a) { throw new Error('failed'); })");
+	for (auto _ : state)
+	{
+		try
+		{
+			func.call(quickjs::value(), 1);
+		}
+		catch (const quickjs::value_error& e)
+		{
+			benchmark::DoNotOptimize(e.what());
+		}
+	}
+}
+BENCHMARK(BM_CallThrowCatch);
+
+static void BM_TryCallThrow(benchmark::State& state)
+{
+	bench_env env;
+	auto func = env.ctx.eval("(function (a) { throw new Error('failed'); })");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(func.try_call(quickjs::value(), 1).ok());
+}
+BENCHMARK(BM_TryCallThrow);
+
+//
+// JS -> C++ calls
+//
+
+static void BM_ClosureFunctionPointer(benchmark::State& state)
+{
+	bench_env env;
+	env.g.set_property("native", add);
+	run_js_loop(state, env, "native", "i, 1");
+}
+BENCHMARK(BM_ClosureFunctionPointer);
+
+static void BM_ClosureFunctor(benchmark::State& state)
+{
+	bench_env env;
+	int32_t offset = 1;
+	env.g.set_property("native",
+		[offset](int32_t a, int32_t b)
+		{
+			sink += a + b + offset;
+		});
+	run_js_loop(state, env, "native", "i, 1");
+}
+BENCHMARK(BM_ClosureFunctor);
+
+static void BM_ClosureStdFunction(benchmark::State& state)
+{
+	bench_env env;
+	std::function<void(int32_t, int32_t)> f(add);
+	env.g.set_property("native",
+		[f](int32_t a, int32_t b)
+		{
+			f(a, b);
+		});
+	run_js_loop(state, env, "native", "i, 1");
+}
+BENCHMARK(BM_ClosureStdFunction);
+
+static void BM_ClosureArgs(benchmark::State& state)
+{
+	bench_env env;
+	env.g.set_property("native",
+		[](const quickjs::args& a) -> quickjs::value
+		{
+			return a[0];
+		});
+	run_js_loop(state, env, "native", "i, 1");
+}
+BENCHMARK(BM_ClosureArgs);
+
+static void BM_ClosureValueRef(benchmark::State& state)
+{
+	bench_env env;
+	env.g.set_property("native",
+		[](quickjs::value_ref a, quickjs::value_ref b)
+		{
+			sink += a.as_int32() + b.as_int32();
+		});
+	run_js_loop(state, env, "native", "i, 1");
+}
+BENCHMARK(BM_ClosureValueRef);
+
+static void BM_ClosureString(benchmark::State& state)
+{
+	bench_env env;
+	env.g.set_property("native",
+		[](const std::string& str) -> std::string
+		{
+			return str;
+		});
+	env.ctx.eval("var payload = 'x'.repeat(4096);");
+	run_js_loop(state, env, "native", "payload");
+}
+BENCHMARK(BM_ClosureString);
+
+//
+// classes
+//
+
+static void BM_MemberFunction(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function inc() { return obj.inc(); }");
+	run_js_loop(state, env, "inc", "");
+}
+BENCHMARK(BM_MemberFunction);
+
+static void BM_TypedMethod(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function add(a, b) { return obj.add(a, b); }");
+	run_js_loop(state, env, "add", "i, 1");
+}
+BENCHMARK(BM_TypedMethod);
+
+static void BM_TypedFieldGet(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function get() { return obj.field; }");
+	run_js_loop(state, env, "get", "");
+}
+BENCHMARK(BM_TypedFieldGet);
+
+static void BM_TypedFieldSet(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function set(v) { obj.field = v; }");
+	run_js_loop(state, env, "set", "i");
+}
+BENCHMARK(BM_TypedFieldSet);
+
+static void BM_Getter(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function get() { return obj.val; }");
+	run_js_loop(state, env, "get", "");
+}
+BENCHMARK(BM_Getter);
+
+static void BM_Setter(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function set(v) { obj.val = v; }");
+	run_js_loop(state, env, "set", "i");
+}
+BENCHMARK(BM_Setter);
+
+static void BM_GetterValueRef(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	env.ctx.eval("var obj = new bench_class(); function get() { return obj.val_ref; }");
+	run_js_loop(state, env, "get", "");
+}
+BENCHMARK(BM_GetterValueRef);
+
+static void BM_MakeObject(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	std::vector<quickjs::value> a;
+	for (auto _ : state)
+	{
+		bench_class* inst = nullptr;
+		benchmark::DoNotOptimize(env.ctx.make_object<bench_class>(a, inst));
+	}
+}
+BENCHMARK(BM_MakeObject);
+
+static void BM_NewObject(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.register_class<bench_class>();
+	for (auto _ : state)
+		benchmark::DoNotOptimize(env.ctx.new_object<bench_class>());
+}
+BENCHMARK(BM_NewObject);
+
+//
+// values
+//
+
+static void BM_ValueCopy(benchmark::State& state)
+{
+	bench_env env;
+	auto val = env.ctx.eval("({})");
+	for (auto _ : state)
+	{
+		quickjs::value copy(val);
+		benchmark::DoNotOptimize(copy);
+	}
+}
+BENCHMARK(BM_ValueCopy);
+
+static void BM_ValueMove(benchmark::State& state)
+{
+	bench_env env;
+	auto val = env.ctx.eval("({})");
+	for (auto _ : state)
+	{
+		quickjs::value moved(std::move(val));
+		val = std::move(moved);
+		benchmark::DoNotOptimize(val);
+	}
+}
+BENCHMARK(BM_ValueMove);
+
+static void BM_GetPropertyName(benchmark::State& state)
+{
+	bench_env env;
+	auto obj = env.ctx.eval("({ field: 1 })");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(obj.get_property("field"));
+}
+BENCHMARK(BM_GetPropertyName);
+
+static void BM_GetPropertyAtom(benchmark::State& state)
+{
+	bench_env env;
+	auto obj = env.ctx.eval("({ field: 1 })");
+	quickjs::atom field(env.ctx, "field");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(obj.get_property(field));
+}
+BENCHMARK(BM_GetPropertyAtom);
+
+static void BM_VectorToJS(benchmark::State& state)
+{
+	bench_env env;
+	std::vector<double> vec(state.range(0), 1.5);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(quickjs::value(env.ctx, vec));
+	state.SetItemsProcessed(state.iterations() * vec.size());
+}
+BENCHMARK(BM_VectorToJS)->Arg(16)->Arg(1024);
+
+static void BM_VectorFromJS(benchmark::State& state)
+{
+	bench_env env;
+	auto arr = env.ctx.eval(("new Array(" + std::to_string(state.range(0)) + ").fill(1.5)").c_str());
+	for (auto _ : state)
+		benchmark::DoNotOptimize(arr.as<std::vector<double>>());
+	state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_VectorFromJS)->Arg(16)->Arg(1024);
+
+struct bench_row
+{
+	int32_t id{1};
+	double score{2.5};
+	std::string name{"row"};
+	
+	static quickjs::struct_def<bench_row> struct_definition;
+};
+
+quickjs::struct_def<bench_row> bench_row::struct_definition = quickjs::runtime::create_struct_def<bench_row>(
+	quickjs::field("id", &bench_row::id),
+	quickjs::field("score", &bench_row::score),
+	quickjs::field("name", &bench_row::name));
+
+static void BM_StructToJSManual(benchmark::State& state)
+{
+	bench_env env;
+	bench_row row;
+	auto make = env.ctx.eval("(function () { return {}; })");
+	for (auto _ : state)
+	{
+		auto obj = make();
+		obj.set_property("id", quickjs::value(env.ctx, row.id));
+		obj.set_property("score", quickjs::value(env.ctx, row.score));
+		obj.set_property("name", quickjs::value(env.ctx, row.name));
+		benchmark::DoNotOptimize(obj);
+	}
+}
+BENCHMARK(BM_StructToJSManual);
+
+static void BM_StructToJS(benchmark::State& state)
+{
+	bench_env env;
+	bench_row row;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(quickjs::value(env.ctx, row));
+}
+BENCHMARK(BM_StructToJS);
+
+static void BM_StructFromJS(benchmark::State& state)
+{
+	bench_env env;
+	auto obj = env.ctx.eval("({ id: 7, score: 1.5, name: 'seven' })");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(obj.as<bench_row>());
+}
+BENCHMARK(BM_StructFromJS);
+
+static const char bench_json[] = "{\"id\": 7, \"tags\": [\"a\", \"b\"], \"score\": 1.5}";
+
+static void BM_JsonParseEval(benchmark::State& state)
+{
+	bench_env env;
+	auto parse = env.ctx.eval("(function (s) { return JSON.parse(s); })");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(parse(bench_json));
+}
+BENCHMARK(BM_JsonParseEval);
+
+static void BM_JsonParse(benchmark::State& state)
+{
+	bench_env env;
+	for (auto _ : state)
+		benchmark::DoNotOptimize(env.ctx.parse_json(bench_json, sizeof(bench_json) - 1));
+}
+BENCHMARK(BM_JsonParse);
+
+static void BM_JsonStringifyCall(benchmark::State& state)
+{
+	bench_env env;
+	auto obj = env.ctx.parse_json(bench_json);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(env.ctx.get_global_object().get_property("JSON").call_member("stringify", obj).as_string());
+}
+BENCHMARK(BM_JsonStringifyCall);
+
+static void BM_JsonStringify(benchmark::State& state)
+{
+	bench_env env;
+	auto obj = env.ctx.parse_json(bench_json);
+	std::string out;
+	for (auto _ : state)
+	{
+		out.clear();
+		obj.to_json(out);
+		benchmark::DoNotOptimize(out);
+	}
+}
+BENCHMARK(BM_JsonStringify);
+
+static void BM_TransferJson(benchmark::State& state)
+{
+	bench_env from;
+	bench_env to;
+	auto obj = from.ctx.parse_json(bench_json);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(to.ctx.parse_json(obj.to_json()));
+}
+BENCHMARK(BM_TransferJson);
+
+static void BM_TransferSerialized(benchmark::State& state)
+{
+	bench_env from;
+	bench_env to;
+	auto obj = from.ctx.parse_json(bench_json);
+	for (auto _ : state)
+		benchmark::DoNotOptimize(to.ctx.deserialize(obj.serialize()));
+}
+BENCHMARK(BM_TransferSerialized);
+
+static void BM_ChannelSendReceive(benchmark::State& state)
+{
+	quickjs::channel<int64_t> ch(1024);
+	int64_t val = 0;
+	for (auto _ : state)
+	{
+		ch.try_send(val);
+		ch.try_receive(val);
+	}
+	benchmark::DoNotOptimize(val);
+}
+BENCHMARK(BM_ChannelSendReceive);
+
+static void BM_PromiseJobs(benchmark::State& state)
+{
+	bench_env env;
+	auto start = env.ctx.eval("(function () { var n = 0; for (var i = 0; i < 100; i++) Promise.resolve(i).then(function (x) { n += x; }); return n; })");
+	for (auto _ : state)
+	{
+		start();
+		benchmark::DoNotOptimize(env.rt.run_pending_jobs());
+	}
+}
+BENCHMARK(BM_PromiseJobs);
+
+static void BM_PromiseToFuture(benchmark::State& state)
+{
+	bench_env env;
+	auto make = env.ctx.eval("(async function (x) { return x + 1; })");
+	for (auto _ : state)
+	{
+		auto f = make(41).to_future<int32_t>();
+		env.rt.run_pending_jobs();
+		benchmark::DoNotOptimize(f.get());
+	}
+}
+BENCHMARK(BM_PromiseToFuture);
+
+static void BM_RunGC(benchmark::State& state)
+{
+	bench_env env;
+	env.ctx.eval("var objs = []; for (var i = 0; i < 10000; i++) objs.push({ id: i, next: null });");
+	for (auto _ : state)
+		env.rt.run_gc();
+	state.counters["max_pause_ns"] = (double)env.rt.gc_statistics().max.count();
+}
+BENCHMARK(BM_RunGC);
+
+static const char bench_module[] =
+	"export function sum(a) { var s = 0; for (var i = 0; i < a.length; i++) s += a[i]; return s; }\n"
+	"export function mean(a) { return a.length ? sum(a) / a.length : 0; }\n"
+	"export class Counter { constructor() { this.n = 0; } inc() { return ++this.n; } }\n"
+	"export const table = [1, 2, 3, 4, 5, 6, 7, 8].map(function (x) { return { x: x, sq: x * x }; });\n";
+
+static void module_import(benchmark::State& state, bool cached)
+{
+	bench_env env;
+	env.rt.set_module_loader(
+		[](const std::string& /*name*/, std::string& source)
+		{
+			source = bench_module;
+			return true;
+		});
+	for (auto _ : state)
+	{
+		if (!cached)
+			env.rt.clear_module_cache();
+		quickjs::context ctx = env.rt.new_context();
+		ctx.eval("import { mean } from 'bench.js';", quickjs::context::eval_flags::module);
+	}
+}
+
+static void BM_ModuleImportParse(benchmark::State& state)
+{
+	module_import(state, false);
+}
+BENCHMARK(BM_ModuleImportParse);
+
+static void BM_ModuleImportCached(benchmark::State& state)
+{
+	module_import(state, true);
+}
+BENCHMARK(BM_ModuleImportCached);
+
+static std::string bench_prelude()
+{
+	std::string ret = "var table = [];\nfor (var i = 0; i < 1000; i++) table.push({ id: i, name: 'row' + i, sq: i * i });\n";
+	for (int i = 0; i < 100; i++)
+		ret += "function helper" + std::to_string(i) + "(a, b) { return a * " + std::to_string(i) + " + b; }\n";
+	return ret;
+}
+
+static void BM_ContextPrelude(benchmark::State& state)
+{
+	bench_env env;
+	std::string prelude = bench_prelude();
+	for (auto _ : state)
+	{
+		quickjs::context ctx = env.rt.new_context();
+		ctx.eval(prelude.c_str(), prelude.size());
+	}
+}
+BENCHMARK(BM_ContextPrelude);
+
+static void BM_ContextSnapshot(benchmark::State& state)
+{
+	bench_env env;
+	std::string prelude = bench_prelude();
+	quickjs::context_snapshot snap(env.rt);
+	snap.get_context().eval(prelude.c_str(), prelude.size());
+	std::string functions = prelude.substr(prelude.find("function helper0"));
+	snap.add_script(functions);
+	snap.share("table");
+	for (auto _ : state)
+		benchmark::DoNotOptimize(snap.new_context());
+}
+BENCHMARK(BM_ContextSnapshot);
+
+BENCHMARK_MAIN();
@@ -0,0 +1,367 @@
+#include <quickjs.hpp>
+#include <sys/resource.h>
+#include <cstdio>
+#include <cinttypes>
+
+// End-to-end load scenarios. Each prints one line of results, tagged with the
+// given label (e.g. the QuickJS version linked against), so runs against the
+// different patched releases can be compared. The workloads are deterministic.
+//
+//   ./bench/stress [--label NAME] [--scale N] [--threads N] [scenario...]
+
+namespace
+{
+	typedef std::chrono::steady_clock clock_type;
+	
+	struct options
+	{
+		std::string label{"quickjs"};
+		size_t scale{1};
+		size_t threads{4};
+	};
+	
+	// A deterministic pseudo random sequence, the same for every run
+	struct lcg
+	{
+		uint32_t state;
+		
+		explicit lcg(uint32_t seed):
+			state(seed)
+		{
+		}
+		
+		uint32_t next(uint32_t bound)
+		{
+			state = state * 1664525u + 1013904223u;
+			return (state >> 8) % bound;
+		}
+	};
+	
+	struct report
+	{
+		size_t ops{0};
+		clock_type::duration elapsed{};
+		std::vector<int64_t> latencies; // in ns
+		size_t allocations{0};
+		size_t peak_bytes{0};
+		quickjs::gc_stats gc;
+		
+		void add_latency(clock_type::duration d)
+		{
+			latencies.push_back(std::chrono::duration_cast<std::chrono::nanoseconds>(d).count());
+		}
+		
+		void add_memory(const quickjs::runtime& rt)
+		{
+			auto mem = rt.memory_usage();
+			allocations += mem.total_allocations;
+			peak_bytes += mem.peak_bytes;
+			auto const& gc_stats = rt.gc_statistics();
+			gc.runs += gc_stats.runs;
+			gc.total += gc_stats.total;
+			gc.max = std::max(gc.max, gc_stats.max);
+		}
+	};
+	
+	int64_t percentile(std::vector<int64_t>& values, double p)
+	{
+		if (values.empty())
+			return 0;
+		size_t idx = std::min(values.size() - 1, (size_t)(p * values.size()));
+		std::nth_element(values.begin(), values.begin() + idx, values.end());
+		return values[idx];
+	}
+	
+	long peak_rss_kb()
+	{
+		struct rusage usage;
+		if (::getrusage(RUSAGE_SELF, &usage) != 0)
+			return 0;
+		return usage.ru_maxrss;
+	}
+	
+	void print(const options& opt, const char* scenario, report& r)
+	{
+		double secs = std::chrono::duration<double>(r.elapsed).count();
+		int64_t p50 = percentile(r.latencies, 0.5);
+		int64_t p99 = percentile(r.latencies, 0.99);
+		int64_t pmax = percentile(r.latencies, 1.0);
+		std::printf("label=%s scenario=%s ops=%zu ops_per_sec=%.0f p50_us=%.1f p99_us=%.1f max_us=%.1f "
+			"peak_rss_kb=%ld allocations=%zu peak_js_bytes=%zu gc_runs=%" PRIu64 " gc_total_ms=%.2f gc_max_us=%.1f\n",
+			opt.label.c_str(), scenario, r.ops, secs > 0 ? r.ops / secs : 0.0, p50 / 1000.0, p99 / 1000.0, pmax / 1000.0,
+			peak_rss_kb(), r.allocations, r.peak_bytes, r.gc.runs,
+			std::chrono::duration<double, std::milli>(r.gc.total).count(), r.gc.max.count() / 1000.0);
+		std::fflush(stdout);
+	}
+	
+	const char handler_script[] =
+		"function handle(id) {\n"
+		"    var items = [];\n"
+		"    for (var i = 0; i < 20; i++)\n"
+		"        items.push({ id: id + i, name: 'item ' + (id + i), tags: ['a', 'b'] });\n"
+		"    return JSON.stringify(items.filter(function (o) { return o.id % 3 == 0; })).length;\n"
+		"}\n";
+	
+	// Many contexts in one runtime, requests spread over all of them
+	report run_contexts(const options& opt)
+	{
+		const size_t contexts = 64;
+		const size_t requests = 20000 * opt.scale;
+		
+		report r;
+		quickjs::runtime rt(quickjs::runtime::allocator::hooks);
+		std::vector<quickjs::context> ctxs;
+		for (size_t i = 0; i < contexts; i++)
+		{
+			ctxs.push_back(rt.new_context());
+			ctxs.back().eval(handler_script);
+		}
+		
+		lcg rnd(1);
+		auto start = clock_type::now();
+		for (size_t i = 0; i < requests; i++)
+		{
+			auto t0 = clock_type::now();
+			ctxs[rnd.next(contexts)].call_global("handle", (int32_t)i);
+			r.add_latency(clock_type::now() - t0);
+		}
+		r.elapsed = clock_type::now() - start;
+		r.ops = requests;
+		r.add_memory(rt);
+		return r;
+	}
+	
+	// One runtime per worker thread, jobs submitted from the main thread
+	report run_threads(const options& opt)
+	{
+		const size_t requests = 20000 * opt.scale;
+		
+		report r;
+		quickjs::runtime_pool pool(opt.threads,
+			[](quickjs::context& ctx)
+			{
+				ctx.eval(handler_script);
+			}, true);
+		
+		std::vector<std::future<int64_t>> done;
+		done.reserve(requests);
+		auto start = clock_type::now();
+		for (size_t i = 0; i < requests; i++)
+		{
+			auto submitted = clock_type::now();
+			done.push_back(pool.submit(
+				[i, submitted](quickjs::context& ctx)
+				{
+					ctx.call_global("handle", (int32_t)i);
+					return std::chrono::duration_cast<std::chrono::nanoseconds>(clock_type::now() - submitted).count();
+				}));
+		}
+		for (auto& d : done)
+			r.latencies.push_back(d.get());
+		r.elapsed = clock_type::now() - start;
+		r.ops = requests;
+		
+		std::mutex lock;
+		pool.broadcast(
+			[&](quickjs::context& ctx)
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				r.add_memory(ctx.get_runtime());
+			});
+		return r;
+	}
+}
+
+class churn_class
+{
+	int32_t id_;
+
+public:
+	static quickjs::class_def_shared<churn_class> class_definition;
+	
+	churn_class(const quickjs::args& a):
+		id_(a[0].as_int32())
+	{
+	}
+	
+	explicit churn_class(int32_t id):
+		id_(id)
+	{
+	}
+	
+	quickjs::value get_id(const quickjs::args& a)
+	{
+		return quickjs::value(a.get_context(), id_);
+	}
+};
+
+quickjs::class_def_shared<churn_class> churn_class::class_definition = quickjs::runtime::create_class_def_shared<churn_class>("churn_class", 1,
+	quickjs::object<churn_class>::function<&churn_class::get_id>("get_id"));
+
+namespace
+{
+	// Shared instances passed to JS over and over: the same JS object is found
+	// again while JS still holds it, otherwise a new one is made
+	report run_objects(const options& opt)
+	{
+		const size_t instances = 1024;
+		const size_t requests = 200000 * opt.scale;
+		
+		report r;
+		quickjs::runtime rt(quickjs::runtime::allocator::hooks);
+		auto ctx = rt.new_context();
+		ctx.register_class<churn_class>();
+		auto keep = ctx.eval(
+			"(function () {\n"
+			"    var kept = new Array(64);\n"
+			"    var n = 0;\n"
+			"    return function (obj) { kept[n++ % kept.length] = obj; return obj.get_id(); };\n"
+			"})()");
+		
+		std::vector<std::shared_ptr<churn_class>> objs;
+		for (size_t i = 0; i < instances; i++)
+			objs.push_back(std::make_shared<churn_class>((int32_t)i));
+		
+		lcg rnd(2);
+		auto start = clock_type::now();
+		for (size_t i = 0; i < requests; i++)
+		{
+			size_t idx = rnd.next(instances);
+			if (rnd.next(16) == 0)
+				objs[idx] = std::make_shared<churn_class>((int32_t)i);
+			auto t0 = clock_type::now();
+			keep(quickjs::value(ctx, objs[idx]));
+			if (i % 256 == 0)
+				ctx.eval("new churn_class(0)");
+			r.add_latency(clock_type::now() - t0);
+		}
+		r.elapsed = clock_type::now() - start;
+		r.ops = requests;
+		r.add_memory(rt);
+		return r;
+	}
+	
+	// Each request runs an async function, then drains the job queue
+	report run_async(const options& opt)
+	{
+		const size_t requests = 50000 * opt.scale;
+		
+		report r;
+		quickjs::runtime rt(quickjs::runtime::allocator::hooks);
+		auto ctx = rt.new_context();
+		auto handle = ctx.eval(
+			"(async function (id) {\n"
+			"    var sum = 0;\n"
+			"    for (var i = 0; i < 8; i++)\n"
+			"        sum += await Promise.resolve(id + i);\n"
+			"    return sum;\n"
+			"})");
+		
+		auto start = clock_type::now();
+		for (size_t i = 0; i < requests; i++)
+		{
+			auto t0 = clock_type::now();
+			handle((int32_t)i);
+			rt.run_pending_jobs();
+			r.add_latency(clock_type::now() - t0);
+		}
+		r.elapsed = clock_type::now() - start;
+		r.ops = requests;
+		r.add_memory(rt);
+		return r;
+	}
+	
+	// Requests leave cyclic garbage behind. Either QuickJS collects when its
+	// threshold is reached, in the middle of a request, or collections are
+	// turned off and run between requests.
+	report run_gc(const options& opt, bool between_requests)
+	{
+		const size_t requests = 20000 * opt.scale;
+		
+		report r;
+		quickjs::runtime rt(quickjs::runtime::allocator::hooks);
+		auto ctx = rt.new_context();
+		auto handle = ctx.eval(
+			"(function (id) {\n"
+			"    var nodes = [];\n"
+			"    for (var i = 0; i < 50; i++)\n"
+			"        nodes.push({ id: id + i, peers: [] });\n"
+			"    for (var i = 0; i < 50; i++)\n"
+			"        nodes[i].peers.push(nodes[(i * 7) % 50], nodes[(i + 1) % 50]);\n"
+			"    return nodes.length;\n"
+			"})");
+		if (between_requests)
+			rt.set_gc_threshold((size_t)-1);
+		
+		auto start = clock_type::now();
+		for (size_t i = 0; i < requests; i++)
+		{
+			auto t0 = clock_type::now();
+			handle((int32_t)i);
+			r.add_latency(clock_type::now() - t0);
+			if (between_requests)
+				rt.run_gc_if_idle(4 * 1024 * 1024);
+		}
+		r.elapsed = clock_type::now() - start;
+		r.ops = requests;
+		r.add_memory(rt);
+		return r;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	options opt;
+	std::vector<std::string> scenarios;
+	for (int i = 1; i < argc; i++)
+	{
+		std::string arg = argv[i];
+		if (arg == "--label" && i + 1 < argc)
+			opt.label = argv[++i];
+		else if (arg == "--scale" && i + 1 < argc)
+			opt.scale = std::max(1, std::atoi(argv[++i]));
+		else if (arg == "--threads" && i + 1 < argc)
+			opt.threads = std::max(1, std::atoi(argv[++i]));
+		else if (arg.compare(0, 2, "--") == 0)
+		{
+			std::fprintf(stderr, "usage: %s [--label NAME] [--scale N] [--threads N] [contexts|threads|objects|async|gc|gc-idle...]\n", argv[0]);
+			return 1;
+		}
+		else
+			scenarios.push_back(arg);
+	}
+	if (scenarios.empty())
+		scenarios = { "contexts", "threads", "objects", "async", "gc", "gc-idle" };
+	
+	try
+	{
+		for (auto const& s : scenarios)
+		{
+			report r;
+			if (s == "contexts")
+				r = run_contexts(opt);
+			else if (s == "threads")
+				r = run_threads(opt);
+			else if (s == "objects")
+				r = run_objects(opt);
+			else if (s == "async")
+				r = run_async(opt);
+			else if (s == "gc")
+				r = run_gc(opt, false);
+			else if (s == "gc-idle")
+				r = run_gc(opt, true);
+			else
+			{
+				std::fprintf(stderr, "unknown scenario: %s\n", s.c_str());
+				return 1;
+			}
+			print(opt, s.c_str(), r);
+		}
+	}
+	catch (const std::exception& e)
+	{
+		std::fprintf(stderr, "failed: %s\n", e.what());
+		return 1;
+	}
+	return 0;
+}
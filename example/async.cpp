@@ -1,7 +1,5 @@
-#include "quickjs.hpp"
-#include <boost/asio.hpp>
+#include "quickjs_asio.hpp"
 #include <iostream>
-#include <set>
 #include <memory>
 
 static quickjs::value do_print(const quickjs::args& a)
@@ -29,6 +27,7 @@ int main(int argc, char* argv[])
 	try
 	{
 		boost::asio::io_context io;
+		quickjs::asio_event_loop loop(io); // must outlive the context
 		
 		quickjs::runtime rt;
 		quickjs::context ctx = rt.new_context();
@@ -36,26 +35,8 @@ int main(int argc, char* argv[])
 		quickjs::value global = ctx.get_global_object();
 		global.set_property("print", do_print);
 		
-		std::set<std::shared_ptr<boost::asio::steady_timer>> timers;
-		global.set_property("setTimeout",
-			[&](const quickjs::value callback, int32_t ms) -> void
-			{
-				if (!callback.is_function())
-					throw quickjs::throw_exception(quickjs::value::type_error(callback.get_context(), "not a function"));
-				if (ms < 0)
-					throw quickjs::throw_exception(quickjs::value::type_error(callback.get_context(), "invalid interval"));
-				
-				auto timer = std::make_shared<boost::asio::steady_timer>(io);
-				timer->expires_from_now(std::chrono::milliseconds(ms));
-				timers.insert(timer);
-				timer->async_wait(
-					[&, timer, callback](const boost::system::error_code& err)
-					{
-						timers.erase(timer);
-						if (!err)
-							callback();
-					});
-			});
+		// setTimeout(), setInterval() etc. running on the io_context
+		ctx.install_timers(loop);
 		
 		boost::asio::steady_timer total_timeout(io);
 		total_timeout.expires_from_now(std::chrono::seconds(5));
@@ -86,6 +67,10 @@ int main(int argc, char* argv[])
 			"    }, 1000);\n"
 			"    return 'main function set up a timer';\n"
 			"}\n"
+			"async function compute() {\n"
+			"    await new Promise(function(resolve) { setTimeout(resolve, 500); });\n"
+			"    return 42;\n"
+			"}\n"
 			"print('script loaded');\n"
 		);
 		if (ret.is_exception())
@@ -114,6 +99,18 @@ int main(int argc, char* argv[])
 				std::cout << "Calling main() returned: " << (ret.valid() ? ret.as_cstring() : "[invalid]") << std::endl;
 			});
 		
+		// The callbacks run as jobs, which are drained on the io_context
+		global.get_property("compute")().then(
+			[](const quickjs::value& result)
+			{
+				std::cout << "compute() resolved: " << result.as_int32() << std::endl;
+			},
+			[](const quickjs::value& reason)
+			{
+				std::cout << "compute() rejected: " << reason.as_string() << std::endl;
+			});
+		rt.post_pending_jobs(loop);
+		
 		std::cout << "main loop running" << std::endl;
 		io.run();
 		
@@ -0,0 +1,59 @@
+#include <quickjs.hpp>
+#include <iostream>
+
+int main(int argc, char* argv[])
+{
+	try
+	{
+		quickjs::simple_event_loop loop; // must outlive the context
+		
+		quickjs::runtime rt;
+		quickjs::context ctx = rt.new_context();
+		ctx.install_timers(loop);
+		
+		quickjs::value global = ctx.get_global_object();
+		ctx.eval(
+			"function sleep(ms) {\n"
+			"    return new Promise(function(resolve) { setTimeout(resolve, ms); });\n"
+			"}\n");
+		
+		// A closure returning a task is an async function to JS, and the
+		// coroutine can co_await any promise
+		quickjs::value sleep = global.get_property("sleep");
+		global.set_property("slowAdd",
+			[sleep](int32_t a, int32_t b) -> quickjs::task<int32_t>
+			{
+				std::cout << "slowAdd(" << a << ", " << b << ") waiting" << std::endl;
+				co_await sleep(100);
+				co_return a + b;
+			});
+		
+		ctx.eval(
+			"(async function() {\n"
+			"    var results = await Promise.all([slowAdd(1, 2), slowAdd(3, 4)]);\n"
+			"    return results.join(', ');\n"
+			"})()").then(
+			[](const quickjs::value& result)
+			{
+				std::cout << "results: " << result.as_string() << std::endl;
+			},
+			[](const quickjs::value& reason)
+			{
+				std::cout << "rejected: " << reason.as_string() << std::endl;
+			});
+		rt.post_pending_jobs(loop);
+		
+		loop.run();
+	}
+	catch (const quickjs::value_error& e)
+	{
+		std::cout << "quickjs error: " << e.what() << std::endl
+			<< "Stack trace: " << e.stack() << std::endl;
+	}
+	catch (const quickjs::exception& e)
+	{
+		std::cout << "unhandled quickjs exception: " << e.what() << std::endl;
+	}
+	
+	return 0;
+}
@@ -408,3 +408,1770 @@ TEST_F(QuickJSCpp, ArgsCount)
 			validate_lines(ex.lines, "number: 1", "string: arg2", "arg3", "false", "true", "0", "string: arg6");
 		});
 }
+
+TEST_F(QuickJSCpp, ClosureStorage)
+{
+	// Stored in the closure itself
+	int32_t base = 10;
+	int32_t* pbase = &base;
+	g_.set_property("add_base",
+		[pbase](int32_t a) -> int32_t
+		{
+			return a + *pbase;
+		});
+	ASSERT_EQ(ctx_.eval("add_base(1)").as_int32(), 11);
+	base = 20;
+	ASSERT_EQ(ctx_.eval("add_base(1)").as_int32(), 21);
+	
+	g_.set_property("count_args",
+		[](const quickjs::args& a) -> int32_t
+		{
+			return (int32_t)a.size();
+		});
+	ASSERT_EQ(ctx_.eval("count_args(1, 2, 3)").as_int32(), 3);
+	
+	// Allocated, and called without copying it
+	g_.set_property("running_total",
+		[base](int32_t step) mutable -> int32_t
+		{
+			base += step;
+			return base;
+		});
+	ASSERT_EQ(ctx_.eval("running_total(1)").as_int32(), 21);
+	ASSERT_EQ(ctx_.eval("running_total(2)").as_int32(), 23);
+	
+	std::string prefix("pre-");
+	std::function<std::string(std::string)> with_prefix =
+		[prefix](std::string s)
+		{
+			return prefix + s;
+		};
+	g_.set_property("with_prefix", with_prefix);
+	ASSERT_EQ(ctx_.eval("with_prefix('fix')").as_string(), "pre-fix");
+}
+
+TEST_F(QuickJSCpp, CompiledScript)
+{
+	auto script = ctx_.compile("function add(a, b) { return a + b; }\nprint('compiled', add(1, 2));");
+	ASSERT_TRUE(script.valid());
+	ASSERT_GT(script.size(), 0);
+	
+	clear_printed();
+	ctx_.eval(script);
+	ctx_.eval(script);
+	validate_printed("compiled 3", "compiled 3");
+	
+	// Bytecode can be serialized and loaded into a context of another runtime
+	auto bytes = script.to_bytes();
+	quickjs::runtime rt2;
+	auto ctx2 = rt2.new_context();
+	ASSERT_TRUE(ctx2.eval(quickjs::compiled_script(bytes)).is_undefined());
+	ASSERT_EQ(ctx2.call_global("add", 40, 2).as_int32(), 42);
+	
+	SCOPED_TRACE("syntax error");
+	EXPECT_THROW(ctx_.compile("function {"), quickjs::exception);
+}
+
+TEST_F(QuickJSCpp, ScriptCache)
+{
+	static const char js_code[] = "print('cached run');";
+	
+	rt_.enable_script_cache();
+	clear_printed();
+	for (int i = 0; i < 3; i++)
+		ctx_.eval(js_code, sizeof(js_code) - 1, quickjs::context::eval_flags::global, "cached.js");
+	ASSERT_EQ(rt_.get_script_cache().size(), 1);
+	
+	// A different filename is a different cache entry
+	ctx_.eval(js_code, sizeof(js_code) - 1, quickjs::context::eval_flags::global, "other.js");
+	ASSERT_EQ(rt_.get_script_cache().size(), 2);
+	validate_printed("cached run", "cached run", "cached run", "cached run");
+	
+	// So is the same source evaluated as a module
+	static const char mod_code[] = "var cache_kind = typeof this;";
+	ctx_.eval(mod_code, sizeof(mod_code) - 1, quickjs::context::eval_flags::global, "kind.js");
+	ASSERT_EQ(ctx_.get_global_object().get_property("cache_kind").as_string(), "object");
+	ctx_.eval(mod_code, sizeof(mod_code) - 1, quickjs::context::eval_flags::module, "kind.js");
+	ASSERT_EQ(rt_.get_script_cache().size(), 4);
+	
+	// Least recently used scripts are dropped beyond the limit
+	rt_.get_script_cache().set_limit(2);
+	ASSERT_EQ(rt_.get_script_cache().size(), 2);
+	ctx_.eval("1 + 1");
+	ctx_.eval("2 + 2");
+	ASSERT_EQ(rt_.get_script_cache().size(), 2);
+	ASSERT_EQ(ctx_.eval("2 + 2").as_int32(), 4);
+	
+	rt_.enable_script_cache(false);
+	ASSERT_EQ(rt_.get_script_cache().size(), 0);
+}
+
+class pool_class
+{
+	int32_t val_;
+
+public:
+	static quickjs::class_def<pool_class> class_definition;
+	
+	pool_class(const quickjs::args& a):
+		val_(a[0].as_int32())
+	{
+	}
+	
+	quickjs::value get_val(const quickjs::args& a)
+	{
+		return quickjs::value(a.get_context(), std::to_string(val_));
+	}
+};
+
+quickjs::class_def<pool_class> pool_class::class_definition = quickjs::runtime::create_class_def<pool_class>("pool_class", 1,
+	quickjs::object<pool_class>::function<&pool_class::get_val>("get_val"));
+
+TEST(QuickJSCppPool, Submit)
+{
+	quickjs::runtime_pool pool(4,
+		[](quickjs::context& ctx)
+		{
+			ctx.eval("function square(x) { return x * x; }");
+		});
+	ASSERT_EQ(pool.size(), 4);
+	pool.register_class<pool_class>();
+	
+	std::vector<std::future<int32_t>> results;
+	for (int32_t i = 0; i < 100; i++)
+	{
+		results.push_back(pool.submit(
+			[i](quickjs::context& ctx)
+			{
+				return ctx.call_global("square", i).as_int32();
+			}));
+	}
+	for (int32_t i = 0; i < 100; i++)
+		ASSERT_EQ(results[i].get(), i * i);
+	
+	for (size_t i = 0; i < pool.size(); i++)
+	{
+		auto str = pool.submit_to(i,
+			[](quickjs::context& ctx)
+			{
+				return ctx.eval("new pool_class(7).get_val()").as_string();
+			});
+		ASSERT_EQ(str.get(), "7");
+	}
+	
+	SCOPED_TRACE("exception");
+	auto failed = pool.submit(
+		[](quickjs::context& ctx)
+		{
+			return ctx.eval("throw 'pool error'").as_string();
+		});
+	try
+	{
+		failed.get();
+		FAIL() << "expected quickjs::value_exception";
+	}
+	catch (const quickjs::value_exception& ex)
+	{
+		ASSERT_STREQ(ex.what(), "pool error");
+		ASSERT_FALSE(ex.val().valid());
+	}
+}
+
+TEST(QuickJSCppTransfer, SerializedValue)
+{
+	quickjs::runtime rt1;
+	quickjs::runtime rt2;
+	auto ctx1 = rt1.new_context();
+	auto ctx2 = rt2.new_context();
+	
+	auto msg = ctx1.eval("var o = { name: 'msg', list: [1, 2, 3], when: new Date(0) }; o.self = o; o").serialize();
+	ASSERT_TRUE(msg.valid());
+	ASSERT_EQ(msg.shared_array_buffers(), 0);
+	
+	auto copy = ctx2.deserialize(msg);
+	ASSERT_EQ(copy.get_property("name").as_string(), "msg");
+	ASSERT_EQ(copy.get_property("list").as<std::vector<int32_t>>(), std::vector<int32_t>({ 1, 2, 3 }));
+	auto check = ctx2.eval("(function (o) { return o.self === o && o.when instanceof Date; })");
+	ASSERT_TRUE(check(copy).as_bool());
+	
+	// SharedArrayBuffers can only be shared between runtimes that enabled it
+	ASSERT_THROW(ctx1.eval("new SharedArrayBuffer(16)").serialize(), quickjs::exception);
+	quickjs::runtime rt3;
+	rt3.enable_shared_array_buffers();
+	auto ctx3 = rt3.new_context();
+	auto sab = ctx3.eval("var sab = new SharedArrayBuffer(16); new Int32Array(sab)[0] = 1; sab").serialize();
+	ASSERT_EQ(sab.shared_array_buffers(), 1);
+	ASSERT_THROW(ctx2.deserialize(sab), quickjs::exception);
+	
+	// Then they share their memory
+	rt2.enable_shared_array_buffers();
+	auto shared = ctx2.deserialize(sab);
+	ctx2.eval("(function (sab) { new Int32Array(sab)[0] = 42; })")(shared);
+	ASSERT_EQ(ctx3.eval("new Int32Array(sab)[0]").as_int32(), 42);
+	
+	// The serialized value keeps the buffer alive
+	ctx3.eval("sab = null");
+	rt3.run_gc();
+	ASSERT_EQ(ctx2.eval("(function (sab) { return new Int32Array(sab)[0]; })")(ctx2.deserialize(sab)).as_int32(), 42);
+	
+	ASSERT_THROW(ctx1.eval("(function () {})").serialize(), quickjs::exception);
+	ASSERT_THROW(ctx2.deserialize(quickjs::serialized_value()), quickjs::exception);
+	
+	// Shared memory counts against the memory limit
+	quickjs::runtime rt4(quickjs::runtime::allocator::hooks);
+	rt4.enable_shared_array_buffers();
+	rt4.set_memory_limit(4 * 1024 * 1024);
+	auto ctx4 = rt4.new_context();
+	ASSERT_THROW(ctx4.eval("new SharedArrayBuffer(8 * 1024 * 1024)"), quickjs::exception);
+	ASSERT_EQ(ctx4.eval("new SharedArrayBuffer(1024).byteLength").as_int32(), 1024);
+}
+
+TEST(QuickJSCppTransfer, Channel)
+{
+	quickjs::channel<int32_t, false> spsc(3);
+	ASSERT_EQ(spsc.capacity(), 4);
+	ASSERT_TRUE(spsc.empty());
+	for (int32_t i = 0; i < 4; i++)
+		ASSERT_TRUE(spsc.try_send(i));
+	ASSERT_FALSE(spsc.try_send(4));
+	int32_t val = -1;
+	ASSERT_TRUE(spsc.try_receive(val));
+	ASSERT_EQ(val, 0);
+	ASSERT_TRUE(spsc.try_send(4));
+	for (int32_t i = 1; i <= 4; i++)
+	{
+		ASSERT_TRUE(spsc.try_receive(val));
+		ASSERT_EQ(val, i);
+	}
+	ASSERT_FALSE(spsc.try_receive(val));
+	
+	// Fan-in of values serialized by several runtimes on their own threads
+	quickjs::channel<quickjs::serialized_value> mpsc(16);
+	const int32_t producers = 4, count = 100;
+	std::vector<std::thread> threads;
+	for (int32_t p = 0; p < producers; p++)
+	{
+		threads.emplace_back(
+			[&mpsc, p]()
+			{
+				quickjs::runtime rt;
+				auto ctx = rt.new_context();
+				for (int32_t i = 0; i < count; i++)
+				{
+					auto msg = quickjs::value(ctx, std::vector<int32_t>{ p, i }).serialize();
+					while (!mpsc.try_send(std::move(msg)))
+						std::this_thread::yield();
+				}
+			});
+	}
+	
+	quickjs::runtime rt;
+	auto ctx = rt.new_context();
+	std::vector<int32_t> next(producers, 0);
+	for (int32_t received = 0; received < producers * count;)
+	{
+		quickjs::serialized_value msg;
+		if (!mpsc.try_receive(msg))
+		{
+			std::this_thread::yield();
+			continue;
+		}
+		auto pair = ctx.deserialize(msg).as<std::vector<int32_t>>();
+		ASSERT_EQ(pair.size(), 2);
+		ASSERT_EQ(pair[1], next[pair[0]]++); // in order per producer
+		received++;
+	}
+	for (auto& t : threads)
+		t.join();
+	ASSERT_TRUE(mpsc.empty());
+}
+
+TEST_F(QuickJSCpp, ContextPool)
+{
+	size_t initialized = 0;
+	quickjs::context_pool pool(rt_,
+		[&](quickjs::context& ctx)
+		{
+			initialized++;
+			ctx.get_global_object().set_property("prelude_val", quickjs::value(ctx, "from prelude"));
+		});
+	pool.reserve(2);
+	ASSERT_EQ(initialized, 2);
+	ASSERT_EQ(pool.idle(), 2);
+	
+	{
+		auto ctx = pool.acquire();
+		ASSERT_EQ(pool.idle(), 1);
+		ASSERT_EQ(ctx->eval("prelude_val").as_string(), "from prelude");
+		ctx->eval("globalThis.added_by_request = 1; prelude_val = 'changed'; Math = null; delete JSON;", quickjs::context::eval_flags::module);
+	}
+	ASSERT_EQ(pool.idle(), 2);
+	ASSERT_EQ(initialized, 2);
+	
+	{
+		// Properties added after initialization are removed when recycled
+		auto ctx1 = pool.acquire();
+		auto ctx2 = pool.acquire();
+		ASSERT_EQ(ctx1->eval("typeof added_by_request").as_string(), "undefined");
+		ASSERT_EQ(ctx2->eval("typeof added_by_request").as_string(), "undefined");
+		
+		// Overwritten and deleted ones are restored
+		for (auto ctx : { &ctx1, &ctx2 })
+		{
+			ASSERT_EQ((*ctx)->eval("prelude_val").as_string(), "from prelude");
+			ASSERT_EQ((*ctx)->eval("typeof Math.max + typeof JSON.parse").as_string(), "functionfunction");
+		}
+		
+		// Global code may leave declarations behind, so the context is discarded
+		ctx1->eval("var not_deletable = 1;");
+		ctx2->eval("let lexical = 1; const constant = 2; function declared() {} class Declared {}");
+		auto ctx3 = pool.acquire();
+		ASSERT_EQ(initialized, 3);
+		ASSERT_EQ(ctx3->eval("prelude_val").as_string(), "from prelude");
+		ctx3->eval("globalThis.from_module = 1;", quickjs::context::eval_flags::module);
+	}
+	ASSERT_EQ(pool.idle(), 1);
+	for (int i = 0; i < 2; i++)
+	{
+		// The same script runs again on a new context, without redeclarations
+		auto ctx = pool.acquire();
+		ASSERT_EQ(ctx->eval("typeof lexical + typeof constant + typeof declared + typeof not_deletable + typeof from_module").as_string(),
+			"undefinedundefinedundefinedundefinedundefined");
+		ctx->eval("let lexical = 1; const constant = 2; function declared() {}");
+	}
+	ASSERT_EQ(initialized, 4);
+	
+	{
+		// Jobs left behind by a request may belong to its context
+		auto ctx = pool.acquire();
+		ctx->eval("Promise.resolve().then(function () { globalThis.late = 1; });", quickjs::context::eval_flags::module);
+		ASSERT_TRUE(rt_.has_pending_jobs());
+	}
+	ASSERT_EQ(pool.idle(), 0);
+	rt_.run_pending_jobs();
+	
+	quickjs::context_pool discarding(rt_, nullptr, quickjs::context_pool::reset_policy::discard);
+	discarding.acquire().release();
+	ASSERT_EQ(discarding.idle(), 0);
+}
+
+TEST(QuickJSCppArena, Allocations)
+{
+	quickjs::detail::slab_arena arena;
+	void* small = arena.malloc(10);
+	ASSERT_NE(small, nullptr);
+	ASSERT_EQ(reinterpret_cast<uintptr_t>(small) % 16, 0);
+	ASSERT_GE(quickjs::detail::slab_arena::usable_size(small), 10);
+	
+	// Freed blocks are reused for the same size class
+	arena.free(small);
+	ASSERT_EQ(arena.malloc(12), small);
+	
+	void* large = arena.malloc(100000);
+	ASSERT_NE(large, nullptr);
+	ASSERT_GE(quickjs::detail::slab_arena::usable_size(large), 100000);
+	::memset(large, 0xaa, 100000);
+	large = arena.realloc(large, 200000);
+	ASSERT_EQ(static_cast<unsigned char*>(large)[99999], 0xaa);
+	
+	auto grown = static_cast<char*>(arena.realloc(small, 400));
+	ASSERT_GE(quickjs::detail::slab_arena::usable_size(grown), 400);
+	ASSERT_EQ(arena.chunk_count(), 1);
+	
+	// Everything is released at once, without freeing individual blocks
+	arena.release_all();
+	ASSERT_EQ(arena.chunk_count(), 0);
+}
+
+TEST(QuickJSCppPointerMap, InsertFindErase)
+{
+	quickjs::detail::pointer_map<int> map;
+	std::vector<int> keys(1000);
+	for (size_t i = 0; i < keys.size(); i++)
+		ASSERT_TRUE(map.insert(&keys[i], static_cast<int>(i)).second);
+	ASSERT_EQ(map.size(), keys.size());
+	
+	auto dup = map.insert(&keys[5], 42);
+	ASSERT_FALSE(dup.second);
+	ASSERT_EQ(*dup.first, 5);
+	
+	// Erasing every other entry must not lose any of the remaining ones
+	for (size_t i = 0; i < keys.size(); i += 2)
+		ASSERT_TRUE(map.erase(&keys[i]));
+	ASSERT_FALSE(map.erase(&keys[0]));
+	ASSERT_EQ(map.size(), keys.size() / 2);
+	for (size_t i = 0; i < keys.size(); i++)
+	{
+		auto val = map.find(&keys[i]);
+		if (i % 2 == 0)
+			ASSERT_EQ(val, nullptr);
+		else
+			ASSERT_EQ(*val, static_cast<int>(i));
+	}
+}
+
+TEST(QuickJSCppArena, Runtime)
+{
+	quickjs::runtime rt(quickjs::runtime::allocator::arena);
+	auto ctx = rt.new_context();
+	auto ret = ctx.eval(
+		"var a = [];\n"
+		"for (var i = 0; i < 10000; i++)\n"
+		"    a.push({ id: i, name: 'item ' + i });\n"
+		"a.length = 100;\n"
+		"a.map(function(o) { return o.name; }).join(',').length");
+	ASSERT_EQ(ret.as_int32(), 789);
+	rt.run_gc();
+}
+
+TEST(QuickJSCppMemory, UsageAndLimits)
+{
+	for (auto alloc : { quickjs::runtime::allocator::hooks, quickjs::runtime::allocator::arena })
+	{
+		quickjs::runtime rt(alloc);
+		auto ctx = rt.new_context();
+		
+		auto before = rt.memory_usage();
+		ASSERT_GT(before.live_bytes, 0);
+		ASSERT_GT(before.total_allocations, 0);
+		ASSERT_EQ(static_cast<size_t>(before.engine.malloc_size), before.live_bytes);
+		
+		ctx.eval("var big = []; for (var i = 0; i < 100000; i++) big.push('s' + i);");
+		auto during = rt.memory_usage();
+		ASSERT_GT(during.live_bytes, before.live_bytes);
+		ASSERT_GE(during.peak_bytes, during.live_bytes);
+		
+		ctx.eval("big = null;");
+		rt.run_gc();
+		auto after = rt.memory_usage();
+		ASSERT_LT(after.live_bytes, during.live_bytes);
+		ASSERT_EQ(after.peak_bytes, during.peak_bytes);
+		
+		size_t histogram_total = 0;
+		for (auto cnt : after.size_histogram)
+			histogram_total += cnt;
+		ASSERT_EQ(histogram_total, after.total_allocations);
+		
+		rt.set_memory_limit(after.live_bytes + 1024 * 1024);
+		EXPECT_THROW(ctx.eval("var a = []; for (var i = 0; i < 10000000; i++) a.push({ i: i });"), quickjs::exception);
+		rt.set_memory_limit(static_cast<size_t>(-1));
+		ctx.eval("a = null;");
+	}
+}
+
+class counting_runtime:
+	public quickjs::runtime
+{
+public:
+	size_t mallocs{0};
+	
+	counting_runtime():
+		quickjs::runtime(allocator::hooks)
+	{
+	}
+
+protected:
+	void* js_malloc(JSMallocState*, size_t size) override
+	{
+		mallocs++;
+		return ::malloc(size);
+	}
+};
+
+TEST(QuickJSCppMemory, OverriddenHooks)
+{
+	counting_runtime rt;
+	auto ctx = rt.new_context();
+	auto before = rt.memory_usage();
+	ctx.eval("var big = []; for (var i = 0; i < 10000; i++) big.push('s' + i);");
+	auto after = rt.memory_usage();
+	ASSERT_GT(rt.mallocs, 0);
+	ASSERT_GT(after.total_allocations, before.total_allocations);
+	
+	// Blocks from an overridden js_malloc aren't measured without js_usable_size,
+	// and those counted before it was first called are written off
+	ASSERT_LE(after.live_bytes, before.live_bytes);
+	ASSERT_EQ(after.live_bytes, 0u);
+	ASSERT_EQ(after.live_allocations, 0u);
+	ASSERT_EQ(after.engine.malloc_size, 0);
+}
+
+class gc_class
+{
+	quickjs::value callback_;
+
+public:
+	static quickjs::class_def<gc_class> class_definition;
+	static int destroyed;
+	
+	gc_class(const quickjs::args& a)
+	{
+	}
+	
+	~gc_class()
+	{
+		destroyed++;
+	}
+	
+	quickjs::value set_callback(const quickjs::args& a)
+	{
+		callback_ = a[0];
+		return quickjs::value::undefined(a.get_context());
+	}
+	
+	void gc_mark(const quickjs::gc_marker& mark)
+	{
+		mark(callback_);
+	}
+};
+
+int gc_class::destroyed = 0;
+
+quickjs::class_def<gc_class> gc_class::class_definition = quickjs::runtime::create_class_def<gc_class>("gc_class", 0,
+	quickjs::object<gc_class>::function<&gc_class::set_callback>("set_callback"));
+
+TEST(QuickJSCppMemory, GarbageCollection)
+{
+	quickjs::runtime rt(quickjs::runtime::allocator::hooks);
+	auto ctx = rt.new_context();
+	ctx.register_class<gc_class>();
+	
+	// The callback refers back to the instance, only marking it frees the cycle
+	gc_class::destroyed = 0;
+	ctx.eval("(function () { var o = new gc_class(); o.set_callback(function () { return o; }); })()");
+	ASSERT_EQ(gc_class::destroyed, 0);
+	rt.run_gc();
+	ASSERT_EQ(gc_class::destroyed, 1);
+	
+	auto stats = rt.gc_statistics();
+	ASSERT_EQ(stats.runs, 1);
+	ASSERT_GT(stats.freed_bytes, 0);
+	ASSERT_EQ(stats.last, stats.total);
+	ASSERT_GE(stats.max, stats.last);
+	
+	// Collect only between jobs, and only once enough memory is in use
+	rt.set_gc_threshold(static_cast<size_t>(-1));
+	ASSERT_FALSE(rt.run_gc_if_idle(64 * 1024 * 1024));
+	ctx.eval("Promise.resolve().then(function () {})");
+	ASSERT_FALSE(rt.run_gc_if_idle());
+	rt.run_pending_jobs();
+	ASSERT_TRUE(rt.run_gc_if_idle());
+	ASSERT_EQ(rt.gc_statistics().runs, 2);
+	
+	quickjs::simple_event_loop loop;
+	rt.set_idle_gc(true);
+	ctx.eval("Promise.resolve().then(function () {})");
+	rt.post_pending_jobs(loop);
+	while (!loop.empty())
+		loop.poll();
+	ASSERT_FALSE(rt.has_pending_jobs());
+	ASSERT_EQ(rt.gc_statistics().runs, 3);
+	
+	rt.reset_gc_statistics();
+	ASSERT_EQ(rt.gc_statistics().runs, 0);
+}
+
+TEST_F(QuickJSCpp, TimeBudget)
+{
+	auto start = std::chrono::steady_clock::now();
+	ctx_.set_time_budget(std::chrono::milliseconds(50));
+	ASSERT_TRUE(ctx_.has_time_budget());
+	EXPECT_THROW(ctx_.eval("try { for (;;) {} } catch (ex) { print('caught', ex); }"), quickjs::time_budget_exceeded);
+	ASSERT_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+	ASSERT_TRUE(printed_.empty());
+	
+	// Also interrupts functions called from C++, even through native closures
+	ctx_.eval("function spin() { for (;;) {} }");
+	g_.set_property("call_spin",
+		[&](const quickjs::args& a) -> quickjs::value
+		{
+			return a.get_context().call_global("spin");
+		});
+	ctx_.set_time_budget(std::chrono::milliseconds(20));
+	EXPECT_THROW(ctx_.eval("call_spin()"), quickjs::time_budget_exceeded);
+	
+	ctx_.clear_time_budget();
+	ASSERT_EQ(ctx_.eval("1 + 1").as_int32(), 2);
+	
+	// The deadline moves along with the context
+	auto other = rt_.new_context();
+	other.set_time_budget(std::chrono::milliseconds(20));
+	auto moved = std::move(other);
+	ASSERT_TRUE(moved.has_time_budget());
+	EXPECT_THROW(moved.eval("for (;;) {}"), quickjs::time_budget_exceeded);
+	ASSERT_EQ(ctx_.eval("2 + 2").as_int32(), 4);
+	
+	// Promise jobs are interrupted by time budgets too
+	ctx_.eval("(async function() { await 0; for (;;) {} })();");
+	ctx_.set_time_budget(std::chrono::milliseconds(20));
+	ASSERT_THROW(rt_.run_pending_jobs(), quickjs::time_budget_exceeded);
+	ctx_.clear_time_budget();
+	ASSERT_FALSE(rt_.has_pending_jobs());
+}
+
+class ref_class
+{
+	int32_t val_{0};
+
+public:
+	static quickjs::class_def<ref_class> class_definition;
+	
+	ref_class(const quickjs::args& a)
+	{
+	}
+	
+	quickjs::value get_val(quickjs::value_ref thisObj)
+	{
+		return quickjs::value(thisObj.get_context(), std::to_string(val_));
+	}
+	
+	void set_val(quickjs::value_ref thisObj, quickjs::value_ref val)
+	{
+		val_ = val.as_int32();
+	}
+};
+
+quickjs::class_def<ref_class> ref_class::class_definition = quickjs::runtime::create_class_def<ref_class>("ref_class", 0,
+	quickjs::object<ref_class>::getset<&ref_class::get_val, &ref_class::set_val>("val"));
+
+TEST_F(QuickJSCpp, ValueRef)
+{
+	g_.set_property("describe",
+		[](quickjs::value_ref num, quickjs::value_ref str, quickjs::value_ref missing) -> std::string
+		{
+			std::ostringstream oss;
+			oss << num.as_int32() << ' ' << str.as_string() << ' ' << (missing.is_undefined() ? "undefined" : "defined");
+			return oss.str();
+		});
+	ASSERT_EQ(ctx_.eval("describe(42, 'str')").as_string(), "42 str undefined");
+	
+	// A value constructed from a value_ref keeps the JS value alive
+	quickjs::value kept;
+	g_.set_property("keep",
+		[&](quickjs::value_ref obj)
+		{
+			kept = obj;
+		});
+	ctx_.eval("keep({ name: 'kept' })");
+	ASSERT_EQ(kept.get_property("name").as_string(), "kept");
+	
+	quickjs::value_ref ref(kept);
+	ASSERT_TRUE(ref.is_object());
+	ASSERT_EQ(ref.get_property("name").as_string(), "kept");
+	
+	ASSERT_THROW(quickjs::value_ref().as_int32(), quickjs::value_exception);
+	
+	ctx_.register_class<ref_class>();
+	ASSERT_EQ(ctx_.eval("var o = new ref_class(); o.val = 12; o.val").as_string(), "12");
+}
+
+TEST_F(QuickJSCpp, ArgsAccess)
+{
+	g_.set_property("collect",
+		[](const quickjs::args& a) -> std::string
+		{
+			std::ostringstream oss;
+			oss << a.size() << ':';
+			for (auto it = a.begin(); it != a.end(); ++it)
+				oss << ' ' << it->as_string();
+			oss << " / " << a.ref(1).as_int32() << " / " << a.get_this_ref().is_object();
+			return oss.str();
+		});
+	ctx_.eval("var o = { collect: collect };");
+	ASSERT_EQ(ctx_.eval("o.collect(1, 2, 'three')").as_string(), "3: 1 2 three / 2 / 1");
+	ASSERT_EQ(ctx_.eval("o.collect(1, 2, 3, 4, 5, 6)").as_string(), "6: 1 2 3 4 5 6 / 2 / 1");
+	
+	g_.set_property("check_bounds",
+		[](const quickjs::args& a, int32_t first) -> std::string
+		{
+			// Declared parameters are always present, even if not passed
+			bool threw = false;
+			try
+			{
+				a.at(a.size());
+			}
+			catch (const std::out_of_range&)
+			{
+				threw = true;
+			}
+			return std::to_string(a.size()) + (a[0].is_undefined() ? " undefined" : " defined") + (threw ? " threw" : "");
+		});
+	ASSERT_EQ(ctx_.eval("check_bounds()").as_string(), "1 undefined threw");
+	
+	// Arguments kept beyond the call are copied into a vector
+	std::vector<quickjs::value> kept;
+	g_.set_property("keep",
+		[&](const quickjs::args& a)
+		{
+			kept = a;
+			return a.back();
+		});
+	ASSERT_EQ(ctx_.eval("keep('x', 'y')").as_string(), "y");
+	ASSERT_EQ(kept.size(), 2);
+	ASSERT_EQ(kept.front().as_string(), "x");
+}
+
+TEST_F(QuickJSCpp, CStringLength)
+{
+	auto str = ctx_.eval("'a\\0b'");
+	auto cstr = str.as_cstring();
+	ASSERT_EQ(cstr.size(), 3);
+	ASSERT_EQ(cstr.str(), std::string("a\0b", 3));
+	ASSERT_EQ(str.as_string().size(), 3);
+	
+	quickjs::value created(ctx_, "x\0y", 3);
+	ASSERT_EQ(created.as_string(), std::string("x\0y", 3));
+}
+
+#ifdef QJSCPP_HAS_STRING_VIEW
+TEST_F(QuickJSCpp, StringView)
+{
+	g_.set_property("first_word",
+		[](std::string_view str) -> std::string_view
+		{
+			return str.substr(0, str.find(' '));
+		});
+	ASSERT_EQ(ctx_.eval("first_word('hello world')").as_string(), "hello");
+	ASSERT_EQ(ctx_.eval("first_word(42)").as_string(), "");
+	
+	auto func = ctx_.eval("(function (s) { return s.length; })");
+	ASSERT_EQ(func(std::string_view("four")).as_int32(), 4);
+	ASSERT_EQ(ctx_.eval("'view'").as_cstring().view(), "view");
+}
+#endif
+
+TEST_F(QuickJSCpp, Atoms)
+{
+	quickjs::atom name(ctx_, "name");
+	quickjs::atom missing(ctx_, std::string("missing"));
+	ASSERT_TRUE(name.valid());
+	ASSERT_EQ(name.str(), "name");
+	
+	auto obj = ctx_.eval("({ name: 'obj' })");
+	ASSERT_EQ(obj.get_property(name).as_string(), "obj");
+	ASSERT_TRUE(obj.has_property(name));
+	ASSERT_FALSE(obj.has_property(missing));
+	ASSERT_TRUE(obj.has_property("name"));
+	
+	obj.set_property(missing, quickjs::value(ctx_, "found"));
+	ASSERT_EQ(obj.get_property("missing").as_string(), "found");
+	
+	auto arr = ctx_.eval("[10, 20, 30]");
+	ASSERT_EQ(arr.get_index(1).as_int32(), 20);
+	arr.set_index(3, quickjs::value(ctx_, "forty"));
+	ASSERT_EQ(arr.get_property("length").as_int32(), 4);
+	ASSERT_EQ(arr.get_property(quickjs::atom(ctx_, 3u)).as_string(), "forty");
+	
+	ctx_.eval("function twice(s) { return s + s; }");
+	quickjs::atom twice(ctx_, "twice");
+	ASSERT_EQ(ctx_.call_global(twice, "ab").as_string(), "abab");
+	
+	// Atoms are invalidated along with their context
+	quickjs::atom outer;
+	{
+		auto ctx = rt_.new_context();
+		quickjs::atom inner(ctx, "inner");
+		outer = inner;
+		ASSERT_TRUE(outer.valid());
+	}
+	ASSERT_FALSE(outer.valid());
+}
+
+TEST_F(QuickJSCpp, FunctionHandle)
+{
+	ctx_.eval("var handler = { prefix: 'handled: ', handle: function (req) { return this.prefix + req; } };"
+		"function join() { return Array.prototype.join.call(arguments, '-'); }");
+	
+	auto handler = g_.get_property("handler");
+	quickjs::function_handle handle(handler.get_property("handle"), handler);
+	ASSERT_TRUE(handle.valid());
+	ASSERT_EQ(handle("a").as_string(), "handled: a");
+	ASSERT_EQ(handle.invoke("b").as_string(), "handled: b");
+	
+	quickjs::function_handle join(ctx_, "join");
+	ASSERT_EQ(join(1, "two", 3.5).as_string(), "1-two-3.5");
+	std::vector<quickjs::value> vals{ ctx_.eval("'x'"), ctx_.eval("'y'") };
+	for (int i = 0; i < 3; i++)
+		ASSERT_EQ(join.invoke_range(vals.begin(), vals.end()).as_string(), "x-y");
+	ASSERT_EQ(join.invoke_range(vals.begin(), vals.begin()).as_string(), "");
+	
+	ASSERT_THROW(quickjs::function_handle(ctx_, "no_such_function"), quickjs::exception);
+	ASSERT_THROW(quickjs::function_handle{handler}, quickjs::exception);
+	ASSERT_THROW(quickjs::function_handle()(), quickjs::exception);
+	
+	// call_global passes the arguments as they are
+	ASSERT_EQ(ctx_.call_global("join", "a", "b").as_string(), "a-b");
+	
+	// Handles are invalidated along with their context
+	quickjs::function_handle assigned;
+	std::unique_ptr<quickjs::function_handle> constructed;
+	quickjs::value moved;
+	{
+		auto ctx = rt_.new_context();
+		ctx.eval("var obj = { f: function () { return 1; } };");
+		assigned = quickjs::function_handle(ctx, "Object");
+		constructed.reset(new quickjs::function_handle(ctx.eval("obj.f"), ctx.eval("obj")));
+		quickjs::value tmp = ctx.eval("obj");
+		moved = std::move(tmp);
+		ASSERT_TRUE(assigned.valid() && constructed->valid() && moved.valid());
+		ASSERT_EQ((*constructed)().as_int32(), 1);
+	}
+	ASSERT_FALSE(assigned.valid());
+	ASSERT_FALSE(constructed->valid());
+	ASSERT_FALSE(constructed->get_this().valid());
+	ASSERT_FALSE(moved.valid());
+	ASSERT_THROW(assigned(), quickjs::exception);
+}
+
+TEST_F(QuickJSCpp, CallBatch)
+{
+	auto func = ctx_.eval("(function (a, b) { if (a < 0) throw 'negative'; return this.scale * (a + (b || 0)); })");
+	auto thisObj = ctx_.eval("({ scale: 2 })");
+	
+	std::vector<std::tuple<int32_t, int32_t>> records{ std::make_tuple(1, 2), std::make_tuple(-1, 0), std::make_tuple(3, 4) };
+	std::vector<quickjs::batch_result> results;
+	ASSERT_EQ(func.call_batch(thisObj, records.begin(), records.end(), std::back_inserter(results)), 1);
+	ASSERT_EQ(results.size(), 3);
+	ASSERT_TRUE(results[0].ok());
+	ASSERT_EQ(results[0].result.as_int32(), 6);
+	ASSERT_FALSE(results[1].ok());
+	ASSERT_EQ(results[1].error.as_string(), "negative");
+	ASSERT_EQ(results[2].result.as_int32(), 14);
+	
+	// Single arguments, and C++ exceptions thrown through JS
+	g_.set_property("fail",
+		[](int32_t a)
+		{
+			if (a == 2)
+				throw std::runtime_error("two");
+		});
+	quickjs::function_handle fail(ctx_, "fail");
+	std::vector<int32_t> singles{ 1, 2, 3 };
+	results.clear();
+	ASSERT_EQ(fail.call_batch(singles.begin(), singles.end(), std::back_inserter(results)), 1);
+	ASSERT_TRUE(results[0].ok());
+	ASSERT_FALSE(results[1].ok());
+	ASSERT_FALSE(results[1].error.valid());
+	ASSERT_THROW(std::rethrow_exception(results[1].exception), std::runtime_error);
+	ASSERT_TRUE(results[2].ok());
+	
+	// The context is still usable afterwards
+	ASSERT_EQ(ctx_.eval("1 + 1").as_int32(), 2);
+	
+	// Results and errors are invalidated along with their context
+	results.clear();
+	{
+		auto ctx = rt_.new_context();
+		quickjs::function_handle check(ctx.eval("(function (a) { if (a < 0) throw new Error('negative'); return { a: a }; })"));
+		std::vector<int32_t> vals{ 1, -1 };
+		ASSERT_EQ(check.call_batch(vals.begin(), vals.end(), std::back_inserter(results)), 1);
+		ASSERT_TRUE(results[0].result.valid());
+		ASSERT_TRUE(results[1].error.valid());
+	}
+	ASSERT_FALSE(results[0].result.valid());
+	ASSERT_FALSE(results[1].error.valid());
+}
+
+TEST_F(QuickJSCpp, TryCall)
+{
+	auto func = ctx_.eval("(function (a) { if (a < 0) throw new RangeError('negative'); if (a == 0) throw 'zero'; return this.scale * a; })");
+	auto thisObj = ctx_.eval("({ scale: 2 })");
+	
+	auto res = func.try_call(thisObj, 3);
+	ASSERT_TRUE(res.ok());
+	ASSERT_TRUE((bool)res);
+	ASSERT_EQ(res.get().as_int32(), 6);
+	ASSERT_FALSE(res.error().valid());
+	
+	// Errors are kept as values, the stack is read on request
+	res = func.try_call(thisObj, -1);
+	ASSERT_FALSE(res.ok());
+	ASSERT_EQ(res.message(), "RangeError: negative");
+	ASSERT_FALSE(res.stack().empty());
+	ASSERT_TRUE(res.value_or(quickjs::value::undefined(ctx_)).is_undefined());
+	ASSERT_THROW(func.call(thisObj, -1), quickjs::value_exception);
+	ASSERT_THROW(res.get(), quickjs::value_exception);
+	ASSERT_THROW(res.rethrow(), quickjs::value_exception);
+	
+	res = func.try_call(thisObj, 0);
+	ASSERT_EQ(res.error().as_string(), "zero");
+	ASSERT_EQ(res.stack(), "");
+	ASSERT_THROW(res.rethrow(), quickjs::value_exception);
+	
+	// C++ exceptions thrown through JS are reported as they are
+	g_.set_property("fail",
+		[](int32_t a)
+		{
+			if (a == 2)
+				throw std::runtime_error("two");
+		});
+	res = g_.try_call_member("fail", 2);
+	ASSERT_FALSE(res.ok());
+	ASSERT_FALSE(res.error().valid());
+	ASSERT_EQ(res.message(), "two");
+	ASSERT_THROW(res.rethrow(), std::runtime_error);
+	ASSERT_TRUE(g_.try_call_member("fail", 1).ok());
+	
+	quickjs::function_handle handle(func, thisObj);
+	ASSERT_EQ(handle.try_invoke(4).get().as_int32(), 8);
+	ASSERT_FALSE(handle.try_invoke(-4).ok());
+	
+	// Closures calling back into JS don't need to catch anything
+	g_.set_property("clamp",
+		[func, thisObj](int32_t a) -> int32_t
+		{
+			auto r = func.try_call(thisObj, a);
+			return r.ok() ? r.get().as_int32() : 0;
+		});
+	ASSERT_EQ(ctx_.eval("clamp(5) + clamp(-5)").as_int32(), 10);
+	
+	// Rethrown inside a closure, errors can be caught by JS like those of call()
+	g_.set_property("rethrowing",
+		[func, thisObj](int32_t a) -> int32_t
+		{
+			return func.try_call(thisObj, a).get().as_int32();
+		});
+	ctx_.eval("function catches(a) { try { return rethrowing(a); } catch (e) { return e instanceof RangeError ? -1 : -2; } }");
+	ASSERT_EQ(ctx_.call_global("catches", 5).as_int32(), 10);
+	ASSERT_EQ(ctx_.call_global("catches", -5).as_int32(), -1);
+	
+	// Results are invalidated along with their context
+	quickjs::result returned, thrown;
+	{
+		auto ctx = rt_.new_context();
+		returned = ctx.try_eval("({ a: 1 })");
+		thrown = ctx.try_eval("throw new Error('gone')");
+		ASSERT_TRUE(returned.get().valid());
+		ASSERT_TRUE(thrown.error().valid());
+	}
+	ASSERT_FALSE(returned.get().valid());
+	ASSERT_FALSE(thrown.error().valid());
+	
+	ASSERT_EQ(ctx_.try_eval("1 + 1").get().as_int32(), 2);
+	ASSERT_EQ(ctx_.try_eval("throw new Error('oops')").message(), "Error: oops");
+	ASSERT_EQ(ctx_.try_eval(ctx_.compile("throw 1")).error().as_int32(), 1);
+	ASSERT_EQ(ctx_.eval("1 + 1").as_int32(), 2);
+}
+
+TEST_F(QuickJSCpp, ArrayBuffers)
+{
+	auto frame = std::make_shared<std::vector<double>>(std::vector<double>{ 1.5, 2.5, 3.5 });
+	std::weak_ptr<std::vector<double>> weak(frame);
+	{
+		auto ctx = rt_.new_context();
+		auto arr = ctx.new_typed_array(frame);
+		frame.reset();
+		ASSERT_FALSE(weak.expired());
+		
+		// JS and C++ share the same memory
+		auto func = ctx.eval("(function (a) { a[1] = a[0] + a[2]; return a.length; })");
+		ASSERT_EQ(func(arr).as_int32(), 3);
+		ASSERT_EQ((*weak.lock())[1], 5.0);
+		
+		auto view = arr.as_span<double>();
+		ASSERT_EQ(view.size(), 3);
+		ASSERT_EQ(view.data(), weak.lock()->data());
+		ASSERT_EQ(arr.as_bytes().size(), 3 * sizeof(double));
+		ASSERT_THROW(arr.as_span<int32_t>(), quickjs::value_exception);
+		
+		// Elements of the same size are reinterpreted
+		ASSERT_EQ(arr.as_span<int64_t>().size(), 3);
+	}
+	ASSERT_TRUE(weak.expired());
+	
+	const uint8_t raw[] = { 1, 2, 3, 4 };
+	auto copy = ctx_.new_array_buffer_copy(raw, sizeof(raw));
+	ASSERT_EQ(copy.as_bytes().size(), 4);
+	ASSERT_NE(copy.as_bytes().data(), raw);
+	
+	g_.set_property("sum_bytes",
+		[](quickjs::span<const uint8_t> bytes) -> std::string
+		{
+			uint32_t sum = 0;
+			for (auto b : bytes)
+				sum += b;
+			return std::to_string(sum);
+		});
+	ASSERT_EQ(ctx_.eval("sum_bytes(new Uint8Array([1, 2, 3]))").as_string(), "6");
+	ASSERT_EQ(ctx_.eval("sum_bytes('nothing')").as_string(), "0");
+	
+	auto sub = ctx_.eval("new Uint8Array([9, 8, 7, 6]).subarray(1, 3)");
+	auto bytes = sub.as_bytes();
+	ASSERT_EQ(bytes.size(), 2);
+	ASSERT_EQ(bytes[0], 8);
+	ASSERT_EQ(bytes[1], 7);
+	
+	quickjs::span<uint8_t> none;
+	ASSERT_FALSE(ctx_.eval("'not a buffer'").as_bytes(none));
+	ASSERT_FALSE(ctx_.eval("({ length: 1 })").as_bytes(none));
+}
+
+TEST_F(QuickJSCpp, Containers)
+{
+	// JS -> C++
+	auto vec = ctx_.eval("[1.5, 2.5, 3.5]").as<std::vector<double>>();
+	ASSERT_EQ(vec, std::vector<double>({ 1.5, 2.5, 3.5 }));
+	auto arr = ctx_.eval("[1, 2, 3]").as<std::array<int32_t, 3>>();
+	ASSERT_EQ(arr[2], 3);
+	std::array<int32_t, 2> wrong_size;
+	ASSERT_FALSE(ctx_.eval("[1, 2, 3]").as(wrong_size));
+	auto tup = ctx_.eval("['a', 2, true]").as<std::tuple<std::string, int32_t, bool>>();
+	ASSERT_EQ(std::get<0>(tup), "a");
+	ASSERT_EQ(std::get<1>(tup), 2);
+	ASSERT_TRUE(std::get<2>(tup));
+	auto m = ctx_.eval("({ one: 1, two: 2 })").as<std::map<std::string, int32_t>>();
+	ASSERT_EQ(m.size(), 2);
+	ASSERT_EQ(m["two"], 2);
+	auto nested = ctx_.eval("({ a: [1, 2], b: [] })").as<std::unordered_map<std::string, std::vector<int32_t>>>();
+	ASSERT_EQ(nested["a"].size(), 2);
+	ASSERT_TRUE(nested["b"].empty());
+	ASSERT_THROW(ctx_.eval("42").as<std::vector<double>>(), quickjs::value_exception);
+	
+	// C++ -> JS
+	quickjs::value js_vec(ctx_, std::vector<std::string>{ "x", "y" });
+	ASSERT_EQ(js_vec.get_property("length").as_int32(), 2);
+	ASSERT_EQ(js_vec.get_index(1).as_string(), "y");
+	quickjs::value js_map(ctx_, std::map<std::string, double>{ { "pi", 3.5 } });
+	ASSERT_EQ(js_map.get_property("pi").as_double(), 3.5);
+	quickjs::value js_num(ctx_, 42);
+	ASSERT_EQ(js_num.as_int32(), 42);
+	
+	// Closure parameters and return values
+	g_.set_property("scale",
+		[](const std::vector<double>& values, double factor) -> std::vector<double>
+		{
+			std::vector<double> ret;
+			for (auto v : values)
+				ret.push_back(v * factor);
+			return ret;
+		});
+	ASSERT_EQ(ctx_.eval("scale([1, 2, 3], 2).join(',')").as_string(), "2,4,6");
+	g_.set_property("count_keys",
+		[](const std::map<std::string, quickjs::value>& obj) -> int32_t
+		{
+			return static_cast<int32_t>(obj.size());
+		});
+	ASSERT_EQ(ctx_.eval("count_keys({ a: 1, b: 'two', c: {} })").as_int32(), 3);
+	
+	auto join = ctx_.eval("(function (a) { return a.join('-'); })");
+	ASSERT_EQ(join(std::vector<int32_t>{ 1, 2, 3 }).as_string(), "1-2-3");
+	ASSERT_EQ(join(std::make_tuple(std::string("a"), 1, false)).as_string(), "a-1-false");
+}
+
+struct struct_point
+{
+	int32_t x{0};
+	int32_t y{0};
+	std::string label;
+	
+	static quickjs::struct_def<struct_point> struct_definition;
+};
+
+quickjs::struct_def<struct_point> struct_point::struct_definition = quickjs::runtime::create_struct_def<struct_point>(
+	quickjs::field("x", &struct_point::x),
+	quickjs::field("y", &struct_point::y),
+	quickjs::field("label", &struct_point::label));
+
+struct struct_line
+{
+	struct_point from;
+	struct_point to;
+	std::vector<double> weights;
+	
+	static quickjs::struct_def<struct_line> struct_definition;
+};
+
+quickjs::struct_def<struct_line> struct_line::struct_definition = quickjs::make_struct_def(
+	quickjs::field("from", &struct_line::from),
+	quickjs::field("to", &struct_line::to),
+	quickjs::field("weights", &struct_line::weights));
+
+TEST_F(QuickJSCpp, Structs)
+{
+	struct_point pt;
+	pt.x = 3;
+	pt.y = 4;
+	pt.label = "p";
+	quickjs::value js_pt(ctx_, pt);
+	ASSERT_EQ(js_pt.get_property("x").as_int32(), 3);
+	ASSERT_EQ(js_pt.get_property("label").as_string(), "p");
+	g_.set_property("pt", js_pt);
+	ASSERT_EQ(ctx_.eval("Object.keys(pt).join(',')").as_string(), "x,y,label");
+	
+	auto back = ctx_.eval("({ x: 1, y: 2, label: 'q', extra: true })").as<struct_point>();
+	ASSERT_EQ(back.x, 1);
+	ASSERT_EQ(back.y, 2);
+	ASSERT_EQ(back.label, "q");
+	
+	// Missing fields keep their value
+	struct_point partial;
+	partial.label = "keep";
+	ASSERT_TRUE(ctx_.eval("({ y: 7 })").as(partial));
+	ASSERT_EQ(partial.y, 7);
+	ASSERT_EQ(partial.label, "keep");
+	ASSERT_FALSE(ctx_.eval("42").as(partial));
+	ASSERT_FALSE(ctx_.eval("({ y: 8, label: Symbol() })").as(partial));
+	ASSERT_EQ(partial.label, "keep");
+	
+	// Nested structs and containers
+	g_.set_property("length2",
+		[](const struct_line& l) -> int32_t
+		{
+			auto dx = l.to.x - l.from.x;
+			auto dy = l.to.y - l.from.y;
+			return dx * dx + dy * dy + static_cast<int32_t>(l.weights.size());
+		});
+	ASSERT_EQ(ctx_.eval("length2({ from: { x: 0, y: 0 }, to: { x: 3, y: 4 }, weights: [1] })").as_int32(), 26);
+	g_.set_property("make_line",
+		[](int32_t len) -> struct_line
+		{
+			struct_line l;
+			l.to.x = len;
+			l.weights.assign(2, 0.5);
+			return l;
+		});
+	ASSERT_EQ(ctx_.eval("let l = make_line(5); l.to.x + l.weights.length").as_int32(), 7);
+	
+	std::vector<struct_point> pts(2);
+	pts[1].x = 9;
+	quickjs::value js_pts(ctx_, pts);
+	ASSERT_EQ(js_pts.get_index(1).get_property("x").as_int32(), 9);
+	
+	// Atoms stay valid in independently created contexts
+	auto other = rt_.new_context();
+	ASSERT_EQ(quickjs::value(other, pt).get_property("y").as_int32(), 4);
+}
+
+TEST_F(QuickJSCpp, Json)
+{
+	auto obj = ctx_.parse_json(std::string("{\"a\": [1, 2], \"b\": \"text\"}"));
+	ASSERT_EQ(obj.get_property("a").get_index(1).as_int32(), 2);
+	ASSERT_EQ(obj.get_property("b").as_string(), "text");
+	ASSERT_THROW(ctx_.parse_json("{ invalid"), quickjs::value_exception);
+	
+	ASSERT_EQ(obj.to_json(), "{\"a\":[1,2],\"b\":\"text\"}");
+	ASSERT_EQ(ctx_.parse_json("[1]").to_json(1), "[\n 1\n]");
+	
+	std::string out("prefix:");
+	ASSERT_TRUE(obj.get_property("a").to_json(out));
+	ASSERT_EQ(out, "prefix:[1,2]");
+	
+	auto undef = ctx_.eval("undefined");
+	ASSERT_FALSE(undef.to_json(out));
+	ASSERT_THROW(undef.to_json(), quickjs::value_exception);
+	
+	char buf[8];
+	ASSERT_EQ(obj.to_json(buf, sizeof(buf)), 22);
+	ASSERT_STREQ(buf, "{\"a\":[1");
+	ASSERT_EQ(undef.to_json(buf, sizeof(buf)), (size_t)-1);
+	
+	std::vector<std::string> chunks;
+	ASSERT_TRUE(obj.to_json_stream(
+		[&](const char* data, size_t len)
+		{
+			chunks.emplace_back(data, len);
+		}, 10));
+	ASSERT_EQ(chunks.size(), 3);
+	ASSERT_EQ(chunks[0] + chunks[1] + chunks[2], obj.to_json());
+	
+	auto cyclic = ctx_.eval("let c = {}; c.self = c; c");
+	ASSERT_THROW(cyclic.to_json(), quickjs::value_exception);
+}
+
+class row_class
+{
+	int32_t id_;
+	std::string name_;
+
+public:
+	static quickjs::class_def<row_class> class_definition;
+	
+	row_class(const quickjs::args& a):
+		id_(a[0].as_int32()),
+		name_(a[1].as_string())
+	{
+	}
+	
+	row_class(int32_t id, std::string name):
+		id_(id),
+		name_(std::move(name))
+	{
+	}
+	
+	quickjs::value describe(const quickjs::args& a)
+	{
+		return quickjs::value(a.get_context(), std::to_string(id_) + ":" + name_);
+	}
+};
+
+quickjs::class_def<row_class> row_class::class_definition = quickjs::runtime::create_class_def<row_class>("row_class", 2,
+	quickjs::object<row_class>::function<&row_class::describe>("describe"));
+
+class row_class_shared
+{
+	int32_t id_;
+
+public:
+	static quickjs::class_def_shared<row_class_shared> class_definition;
+	
+	row_class_shared(const quickjs::args& a):
+		id_(a[0].as_int32())
+	{
+	}
+	
+	explicit row_class_shared(int32_t id):
+		id_(id)
+	{
+	}
+	
+	quickjs::value get_id(const quickjs::args& a)
+	{
+		return quickjs::value(a.get_context(), id_);
+	}
+};
+
+quickjs::class_def_shared<row_class_shared> row_class_shared::class_definition = quickjs::runtime::create_class_def_shared<row_class_shared>("row_class_shared", 1,
+	quickjs::object<row_class_shared>::function<&row_class_shared::get_id>("get_id"));
+
+TEST_F(QuickJSCpp, NewObject)
+{
+	ASSERT_THROW(ctx_.new_object<row_class>(1, "one"), quickjs::exception);
+	ctx_.register_class<row_class>();
+	ctx_.register_class<row_class_shared>();
+	
+	auto row = ctx_.new_object<row_class>(1, "one");
+	g_.set_property("row", row);
+	ASSERT_EQ(ctx_.eval("row.describe()").as_string(), "1:one");
+	ASSERT_TRUE(ctx_.eval("row instanceof row_class").as_bool());
+	// Same class as objects created by the script
+	ASSERT_TRUE(ctx_.eval("Object.getPrototypeOf(row) === Object.getPrototypeOf(new row_class(2, 'two'))").as_bool());
+	
+	auto shared = ctx_.new_object<row_class_shared>(7);
+	g_.set_property("shared", shared);
+	ASSERT_EQ(ctx_.eval("shared.get_id()").as_int32(), 7);
+	ASSERT_TRUE(ctx_.eval("shared instanceof row_class_shared").as_bool());
+}
+
+class typed_class
+{
+public:
+	static quickjs::class_def<typed_class> class_definition;
+	
+	int32_t x{0};
+	double scale{1.0};
+	std::string name{"typed"};
+	std::vector<int32_t> values{1, 2};
+	
+	typed_class(const quickjs::args& a)
+	{
+	}
+	
+	int32_t add(int32_t a, int32_t b) const
+	{
+		return a + b + x;
+	}
+	
+	std::string greet(const std::string& who)
+	{
+		return name + ": " + who;
+	}
+	
+	void reset()
+	{
+		x = 0;
+	}
+	
+	std::vector<double> scaled(const std::vector<double>& values) const
+	{
+		std::vector<double> ret;
+		for (auto v : values)
+			ret.push_back(v * scale);
+		return ret;
+	}
+};
+
+quickjs::class_def<typed_class> typed_class::class_definition = quickjs::runtime::create_class_def<typed_class>("typed_class", 0,
+	quickjs::object<typed_class>::method<int32_t(typed_class::*)(int32_t, int32_t) const, &typed_class::add>("add"),
+	quickjs::object<typed_class>::method<std::string(typed_class::*)(const std::string&), &typed_class::greet>("greet"),
+	quickjs::object<typed_class>::method<void(typed_class::*)(), &typed_class::reset>("reset"),
+#ifdef QJSCPP_HAS_AUTO_TEMPLATE
+	quickjs::object<typed_class>::method<&typed_class::scaled>("scaled"),
+	quickjs::object<typed_class>::field<&typed_class::scale>("scale"),
+#else
+	quickjs::object<typed_class>::method<std::vector<double>(typed_class::*)(const std::vector<double>&) const, &typed_class::scaled>("scaled"),
+	quickjs::object<typed_class>::field<double, &typed_class::scale>("scale"),
+#endif
+	quickjs::object<typed_class>::field<int32_t, &typed_class::x>("x"),
+	quickjs::object<typed_class>::field<std::vector<int32_t>, &typed_class::values>("values"),
+	quickjs::object<typed_class>::field_read_only<std::string, &typed_class::name>("name"));
+
+TEST_F(QuickJSCpp, TypedMembers)
+{
+	ctx_.register_class<typed_class>();
+	ctx_.eval("var t = new typed_class(); t.x = 10;");
+	ASSERT_EQ(ctx_.eval("t.x").as_int32(), 10);
+	ASSERT_EQ(ctx_.eval("t.add(1, 2)").as_int32(), 13);
+	ASSERT_EQ(ctx_.eval("t.add(1)").as_int32(), 11);
+	ASSERT_EQ(ctx_.eval("t.greet('you')").as_string(), "typed: you");
+	ASSERT_TRUE(ctx_.eval("t.reset()").is_undefined());
+	ASSERT_EQ(ctx_.eval("t.x").as_int32(), 0);
+	ASSERT_EQ(ctx_.eval("t.scale = 2; t.scaled([1, 2]).join(',')").as_string(), "2,4");
+	ASSERT_EQ(ctx_.eval("t.name").as_string(), "typed");
+	ASSERT_THROW(ctx_.eval("t.name = 'other'"), quickjs::value_exception);
+	ASSERT_THROW(ctx_.eval("t.add.call({}, 1, 2)"), quickjs::value_exception);
+	ASSERT_EQ(ctx_.eval("typed_class.prototype.add.length").as_int32(), 2);
+	
+	// A failed conversion leaves the field as it was
+	ASSERT_THROW(ctx_.eval("t.values = [3, Symbol()]"), quickjs::value_exception);
+	ASSERT_EQ(ctx_.eval("t.values.join(',')").as_string(), "1,2");
+	ASSERT_EQ(ctx_.eval("t.values = [3, 4]; t.values.join(',')").as_string(), "3,4");
+}
+
+TEST_F(QuickJSCpp, PendingJobs)
+{
+	ASSERT_FALSE(rt_.has_pending_jobs());
+	ctx_.eval("var steps = 0; Promise.resolve().then(() => steps++).then(() => steps++).then(() => steps++);");
+	ASSERT_TRUE(rt_.has_pending_jobs());
+	ASSERT_EQ(rt_.run_pending_jobs(1), 1);
+	ASSERT_EQ(g_.get_property("steps").as_int32(), 1);
+	ASSERT_EQ(rt_.run_pending_jobs(), 2);
+	ASSERT_EQ(g_.get_property("steps").as_int32(), 3);
+	ASSERT_FALSE(rt_.has_pending_jobs());
+	
+	auto past = std::chrono::steady_clock::now();
+	ctx_.eval("Promise.resolve().then(() => steps++);");
+	ASSERT_EQ(rt_.run_pending_jobs_until(past), 0);
+	ASSERT_EQ(rt_.run_pending_jobs(), 1);
+	
+	// C++ exceptions thrown in jobs propagate out of run_pending_jobs()
+	g_.set_property("fail",
+		[](const quickjs::args& a) -> quickjs::value
+		{
+			throw std::runtime_error("job failed");
+		});
+	ctx_.eval("Promise.resolve().then(fail);");
+	ASSERT_THROW(rt_.run_pending_jobs(), std::runtime_error);
+}
+
+TEST_F(QuickJSCpp, PromiseToFuture)
+{
+	auto ok = ctx_.eval("Promise.resolve(41).then(x => x + 1)").to_future<int32_t>();
+	auto plain = ctx_.eval("'not a promise'").to_future<std::string>();
+	auto error = ctx_.eval("Promise.reject(new Error('bad'))").to_future<void>();
+	auto reason = ctx_.eval("Promise.reject(7)").to_future<quickjs::value>();
+	ASSERT_EQ(ok.wait_for(std::chrono::seconds(0)), std::future_status::timeout);
+	
+	rt_.run_pending_jobs();
+	ASSERT_EQ(ok.get(), 42);
+	ASSERT_EQ(plain.get(), "not a promise");
+	ASSERT_THROW(error.get(), quickjs::value_error);
+	try
+	{
+		reason.get();
+		FAIL();
+	}
+	catch (const quickjs::value_exception& e)
+	{
+		ASSERT_EQ(e.val().as_int32(), 7);
+	}
+	
+	std::string settled;
+	ctx_.eval("Promise.reject('no')").then(
+		[&](const quickjs::value& result)
+		{
+			settled = "fulfilled";
+		},
+		[&](const quickjs::value& r)
+		{
+			settled = r.as_string();
+		});
+	rt_.run_pending_jobs();
+	ASSERT_EQ(settled, "no");
+}
+
+TEST_F(QuickJSCpp, Timers)
+{
+	quickjs::simple_event_loop loop;
+	ctx_.install_timers(loop);
+	ctx_.eval(
+		"var log = [];\n"
+		"setTimeout(function() { log.push('late'); }, 20);\n"
+		"clearTimeout(setTimeout(function() { log.push('cancelled'); }, 5));\n"
+		"var id = setInterval(function() { log.push('tick'); if (log.length >= 3) clearInterval(id); }, 1);\n"
+		"setTimeout(function(arg) { log.push(arg); }, 0, 'first');\n"
+		"async function wait(ms) { await new Promise(function(resolve) { setTimeout(resolve, ms); }); return 'waited'; }\n");
+	auto waited = g_.get_property("wait")(10).to_future<std::string>();
+	rt_.post_pending_jobs(loop);
+	
+	loop.run_for(std::chrono::seconds(5));
+	ASSERT_TRUE(loop.empty());
+	ASSERT_EQ(ctx_.eval("log.join(',')").as_string(), "first,tick,tick,late");
+	ASSERT_EQ(waited.wait_for(std::chrono::seconds(0)), std::future_status::ready);
+	ASSERT_EQ(waited.get(), "waited");
+	ASSERT_THROW(ctx_.eval("setTimeout('code', 1)"), quickjs::value_exception);
+	
+	// Callbacks that throw are reported, the loop keeps running
+	std::vector<std::string> errors;
+	auto other = rt_.new_context();
+	other.install_timers(loop,
+		[&](std::exception_ptr excpt)
+		{
+			try
+			{
+				std::rethrow_exception(excpt);
+			}
+			catch (const quickjs::exception& e)
+			{
+				errors.push_back(e.what());
+			}
+		});
+	other.eval(
+		"var log = [];\n"
+		"setTimeout(function() { throw new Error('timer failed'); }, 0);\n"
+		"setTimeout(function() { log.push('still running'); }, 5);\n");
+	loop.run_for(std::chrono::seconds(5));
+	ASSERT_EQ(errors.size(), 1u);
+	ASSERT_NE(errors[0].find("timer failed"), std::string::npos);
+	ASSERT_EQ(other.eval("log.join(',')").as_string(), "still running");
+}
+
+TEST(QuickJSCppEventLoop, SimpleEventLoop)
+{
+	quickjs::simple_event_loop loop;
+	std::vector<int> order;
+	loop.post(
+		[&]()
+		{
+			order.push_back(1);
+			// Runs on the next turn, after the timer that is already due
+			loop.post(
+				[&]()
+				{
+					order.push_back(3);
+				});
+		});
+	loop.start_timer(std::chrono::milliseconds(0),
+		[&]()
+		{
+			order.push_back(2);
+		});
+	auto never = loop.start_timer(std::chrono::milliseconds(0),
+		[&]()
+		{
+			order.push_back(-1);
+		});
+	ASSERT_TRUE(loop.cancel_timer(never));
+	ASSERT_FALSE(loop.cancel_timer(never));
+	
+	ASSERT_EQ(loop.poll(), 2);
+	ASSERT_EQ(loop.run(), 1);
+	ASSERT_EQ(order, std::vector<int>({ 1, 2, 3 }));
+	ASSERT_TRUE(loop.empty());
+}
+
+#ifdef QJSCPP_HAS_COROUTINES
+static quickjs::task<int32_t> add_later(quickjs::value promise, int32_t n)
+{
+	quickjs::value v = co_await promise;
+	co_return v.as_int32() + n;
+}
+
+TEST_F(QuickJSCpp, Coroutines)
+{
+	g_.set_property("addLater", add_later);
+	g_.set_property("failLater",
+		[](quickjs::value promise) -> quickjs::task<void>
+		{
+			co_await promise;
+			throw std::runtime_error("failed later");
+		});
+	ctx_.eval(
+		"var log = [];\n"
+		"var resolveIt;\n"
+		"var p = new Promise(function(resolve) { resolveIt = resolve; });\n"
+		"(async function() { log.push(await addLater(p, 2)); })();\n"
+		"failLater(0).catch(function(e) { log.push(e.message); });\n");
+	rt_.run_pending_jobs();
+	ASSERT_EQ(ctx_.eval("log.join(',')").as_string(), "failed later");
+	ctx_.eval("resolveIt(40);");
+	rt_.run_pending_jobs();
+	ASSERT_EQ(ctx_.eval("log.join(',')").as_string(), "failed later,42");
+	
+	// Tasks awaiting tasks, and rejections thrown into the coroutine
+	auto twice =
+		[](quickjs::value promise) -> quickjs::task<int32_t>
+		{
+			int32_t v = co_await add_later(promise, 1);
+			co_return v * 2;
+		};
+	auto caught =
+		[](quickjs::value promise) -> quickjs::task<std::string>
+		{
+			try
+			{
+				co_await promise;
+			}
+			catch (const quickjs::value_error& e)
+			{
+				co_return e.what();
+			}
+			co_return "not rejected";
+		};
+	auto f1 = quickjs::value(ctx_, twice(ctx_.eval("Promise.resolve(20)"))).to_future<int32_t>();
+	auto f2 = quickjs::value(ctx_, caught(ctx_.eval("Promise.reject(new Error('bad'))"))).to_future<std::string>();
+	rt_.run_pending_jobs();
+	ASSERT_EQ(f1.get(), 42);
+	ASSERT_EQ(f2.get(), "Error: bad");
+	
+	bool done = false;
+	twice(ctx_.eval("1")).start(
+		[&](quickjs::task<int32_t>::promise_type& p)
+		{
+			done = p.get() == 4;
+		});
+	ASSERT_FALSE(done);
+	rt_.run_pending_jobs();
+	ASSERT_TRUE(done);
+	
+	// Captures remain valid after suspending, even when JS let go of the closure
+	int32_t offset = 100;
+	std::string prefix = "sum: ";
+	g_.set_property("addOffset",
+		[offset](quickjs::value promise) -> quickjs::task<int32_t>
+		{
+			quickjs::value v = co_await promise;
+			co_return v.as_int32() + offset;
+		});
+	g_.set_property("describe",
+		[prefix](quickjs::value promise) -> quickjs::task<std::string>
+		{
+			quickjs::value v = co_await promise;
+			co_return prefix + v.as_string();
+		});
+	ctx_.eval(
+		"var resolveLater;\n"
+		"var later = new Promise(function(resolve) { resolveLater = resolve; });\n"
+		"var results = [];\n"
+		"addOffset(later).then(function(v) { results.push(v); });\n"
+		"describe(later).then(function(v) { results.push(v); });\n"
+		"addOffset = describe = undefined;\n");
+	rt_.run_gc();
+	ctx_.eval("resolveLater(2);");
+	rt_.run_pending_jobs();
+	ASSERT_EQ(ctx_.eval("results.join(',')").as_string(), "102,sum: 2");
+}
+#endif
+
+TEST_F(QuickJSCpp, ModuleLoader)
+{
+	std::map<std::string, std::string> sources = {
+		{ "lib/math.js", "export function add(a, b) { return a + b; }" },
+		{ "lib/util.js", "import { add } from './math.js'; export const answer = add(40, 2); export const url = import.meta.url;" },
+	};
+	size_t loads = 0;
+	rt_.set_module_loader(
+		[&](const std::string& name, std::string& source)
+		{
+			loads++;
+			auto it = sources.find(name);
+			if (it == sources.end())
+				return false;
+			source = it->second;
+			return true;
+		});
+	
+	const char* main = "import { answer, url } from 'lib/util.js'; globalThis.answer = answer; globalThis.url = url;";
+	ctx_.eval(main, quickjs::context::eval_flags::module);
+	ASSERT_EQ(g_.get_property("answer").as_int32(), 42);
+	ASSERT_EQ(g_.get_property("url").as_string(), "lib/util.js");
+	ASSERT_EQ(loads, 2u);
+	ASSERT_EQ(rt_.get_module_cache().size(), 2u);
+	
+	// Other contexts run the cached bytecode
+	{
+		auto ctx = rt_.new_context();
+		ctx.eval(main, quickjs::context::eval_flags::module);
+		ASSERT_EQ(ctx.get_global_object().get_property("answer").as_int32(), 42);
+		ASSERT_EQ(loads, 2u);
+	}
+	
+	ASSERT_THROW(ctx_.eval("import 'lib/missing.js';", quickjs::context::eval_flags::module), quickjs::value_exception);
+	
+	sources["lib/broken.js"] = "export const = ;";
+	ASSERT_THROW(ctx_.eval("import 'lib/broken.js';", quickjs::context::eval_flags::module), quickjs::value_exception);
+	ASSERT_EQ(rt_.get_module_cache().count("lib/broken.js"), 0u);
+	
+	rt_.set_module_loader(
+		[](const std::string& name, std::string& source) -> bool
+		{
+			throw std::runtime_error("loader failed");
+		},
+		[](const std::string& base, const std::string& specifier)
+		{
+			return "custom/" + specifier;
+		});
+	ASSERT_THROW(ctx_.eval("import 'other.js';", quickjs::context::eval_flags::module), std::runtime_error);
+}
+
+TEST(QuickJSCppModules, Bundle)
+{
+	std::map<std::string, quickjs::compiled_script> compiled;
+	{
+		quickjs::runtime rt;
+		quickjs::context ctx = rt.new_context();
+		const char* math = "export function add(a, b) { return a + b; }";
+		const char* util = "import { add } from './math.js'; export const answer = add(40, 2);";
+		compiled["lib/math.js"] = ctx.compile(math, strlen(math), quickjs::context::eval_flags::module, "lib/math.js");
+		compiled["lib/util.js"] = ctx.compile(util, strlen(util), quickjs::context::eval_flags::module, "lib/util.js");
+	}
+	
+	std::string path = testing::TempDir() + "quickjscpp_modules.bundle";
+	quickjs::module_bundle::save(path, compiled);
+	auto bundle = quickjs::module_bundle::open(path);
+	std::remove(path.c_str());
+	ASSERT_EQ(bundle.size(), 2u);
+	ASSERT_EQ(bundle.name(0), "lib/math.js");
+	ASSERT_EQ(bundle.name(1), "lib/util.js");
+	const uint8_t* data = nullptr;
+	size_t size = 0;
+	ASSERT_TRUE(bundle.find("lib/util.js", data, size));
+	ASSERT_EQ(size, compiled["lib/util.js"].size());
+	ASSERT_EQ(memcmp(data, compiled["lib/util.js"].data(), size), 0);
+	ASSERT_FALSE(bundle.find("lib/other.js", data, size));
+	ASSERT_FALSE(bundle.find("lib", data, size));
+	
+	quickjs::runtime rt;
+	rt.add_module_bundle(bundle);
+	quickjs::context ctx = rt.new_context();
+	ctx.eval("import { answer } from 'lib/util.js'; globalThis.answer = answer;", quickjs::context::eval_flags::module);
+	ASSERT_EQ(ctx.get_global_object().get_property("answer").as_int32(), 42);
+	ASSERT_TRUE(rt.get_module_cache().empty());
+	
+	auto bytes = quickjs::module_bundle::create(compiled);
+	ASSERT_EQ(quickjs::module_bundle(bytes).size(), 2u);
+	bytes.resize(bytes.size() - 1);
+	ASSERT_THROW(quickjs::module_bundle(std::move(bytes)), quickjs::exception);
+	ASSERT_THROW(quickjs::module_bundle(std::vector<uint8_t>{ 1, 2, 3 }), quickjs::exception);
+	ASSERT_THROW(quickjs::module_bundle::open(path), quickjs::exception);
+}
+
+TEST_F(QuickJSCpp, ContextSnapshot)
+{
+	size_t inits = 0;
+	quickjs::context_snapshot snap(rt_,
+		[&](quickjs::context& ctx)
+		{
+			inits++;
+			ctx.get_global_object().set_property("native",
+				[](int32_t x) -> int32_t
+				{
+					return x * 2;
+				});
+		});
+	snap.add_script("function twice(x) { return native(x); }");
+	snap.get_context().eval(
+		"var config = { name: 'tenant', limits: [1, 2, 3] };\n"
+		"config.self = config;\n"
+		"var table = { rows: [[1, 2], [3, 4]] };\n");
+	snap.copy("config");
+	snap.share("table");
+	
+	auto c1 = snap.new_context();
+	auto c2 = snap.new_context();
+	ASSERT_EQ(inits, 3u);
+	ASSERT_EQ(c1.eval("twice(21)").as_int32(), 42);
+	
+	// Copies are independent, and keep their references
+	ASSERT_TRUE(c1.eval("config.self === config && config.limits.length === 3").as_bool());
+	c1.eval("config.name = 'changed';");
+	ASSERT_EQ(c2.eval("config.name").as_string(), "tenant");
+	
+	// Shared objects are frozen
+	c1.eval("table.rows[0][0] = 100;");
+	ASSERT_EQ(c2.eval("table.rows[0][0]").as_int32(), 1);
+	ASSERT_THROW(c1.eval("'use strict'; table.rows.push([5, 6]);"), quickjs::value_exception);
+	ASSERT_TRUE(c2.eval("Object.isFrozen(table.rows[1])").as_bool());
+	
+	// Their prototypes are frozen too, they are those of the snapshot context
+	c1.eval("Object.getPrototypeOf(table).polluted = true; Object.getPrototypeOf(table.rows).push = null;");
+	ASSERT_THROW(c1.eval("'use strict'; Object.getPrototypeOf(table).polluted = true;"), quickjs::value_exception);
+	ASSERT_TRUE(c2.eval("table.polluted === undefined && typeof table.rows.push === 'function'").as_bool());
+	ASSERT_TRUE(snap.get_context().eval("({}).polluted === undefined").as_bool());
+	ASSERT_TRUE(c2.eval("!(table.rows instanceof Array) && Array.isArray(table.rows)").as_bool());
+	
+	// Builtins replaced by earlier scripts don't stop the freeze
+	quickjs::context_snapshot hostile(rt_);
+	hostile.add_script(
+		"Object.freeze = function (o) { return o; };\n"
+		"Object.getPrototypeOf = function () { return null; };\n"
+		"Reflect.ownKeys = function () { return []; };\n"
+		"var later = { nested: { n: 1 } };\n");
+	hostile.share("later");
+	auto c3 = hostile.new_context();
+	ASSERT_TRUE(c3.eval("Object.isFrozen(later) && Object.isFrozen(later.nested) && Object.isFrozen(Object.getPrototypeOf(later))").as_bool());
+	
+	// The steps are replayed on contexts of a pool
+	quickjs::context_pool pool(rt_,
+		[&](quickjs::context& ctx)
+		{
+			snap.apply(ctx);
+		});
+	{
+		auto h = pool.acquire();
+		ASSERT_EQ(h->eval("twice(config.limits[2])").as_int32(), 6);
+	}
+	
+	snap.get_context().eval("var fn = function() {};");
+	ASSERT_THROW(snap.copy("fn"), quickjs::value_exception);
+}
+
+#ifdef QJSCPP_PROFILE
+static int32_t profiled_add(int32_t a, int32_t b)
+{
+	return a + b;
+}
+
+TEST_F(QuickJSCpp, Profile)
+{
+	g_.set_property("add", profiled_add);
+	g_.set_property("twice",
+		[](int32_t x) -> int32_t
+		{
+			return x * 2;
+		});
+	ctx_.eval("for (var i = 0; i < 10; i++) twice(add(i, 1));");
+	auto profile = rt_.native_call_profile();
+	ASSERT_EQ(profile.size(), 2u);
+	for (auto const& stats : profile)
+	{
+		ASSERT_EQ(stats.calls, 10u);
+		ASSERT_EQ(stats.name.compare(0, 8, "closure "), 0);
+		uint64_t cnt = 0;
+		for (auto n : stats.histogram)
+			cnt += n;
+		ASSERT_EQ(cnt, 10u);
+		ASSERT_LE(stats.max, stats.total);
+	}
+	rt_.reset_profile();
+	ASSERT_TRUE(rt_.native_call_profile().empty());
+	
+	const char* script =
+		"function inner() { var s = 0; for (var i = 0; i < 1000; i++) s += i; return s; }\n"
+		"function outer() { var t = 0; for (var j = 0; j < 5000; j++) t += inner(); return t; }\n"
+		"outer();\n";
+	rt_.start_sampling(std::chrono::microseconds(100));
+	ctx_.eval(script, strlen(script), quickjs::context::eval_flags::global, "profile.js");
+	rt_.stop_sampling();
+	ASSERT_GT(rt_.sample_count(), 0u);
+	ASSERT_NE(rt_.folded_stacks().find("outer (profile.js)"), std::string::npos);
+	
+	// A replaced Error constructor is not called by the sampler
+	ctx_.eval("var errors = 0; Error = function() { errors++; };");
+	rt_.start_sampling(std::chrono::microseconds(100));
+	ctx_.eval(script, strlen(script), quickjs::context::eval_flags::global, "profile.js");
+	rt_.stop_sampling();
+	ASSERT_EQ(ctx_.eval("errors").as_int32(), 0);
+	
+	ASSERT_EQ(quickjs::detail::fold_stack("    at inner (lib.js:3)\n    at outer (lib.js:7:12)\n    at <eval> (main.js)\n"), "<eval> (main.js);outer (lib.js);inner (lib.js)");
+}
+#endif
@@ -28,13 +28,55 @@
 #include <memory>
 #include <cstdlib>
 #include <cstring>
+#include <cstdio>
 #include <cassert>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <tuple>
 #include <string>
 #include <vector>
 #include <exception>
+#include <stdexcept>
 #include <functional>
-#if 0
+#include <deque>
+#include <list>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <future>
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <atomic>
+#if defined(__GLIBC__)
+#include <malloc.h>
+#endif
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#define QJSCPP_HAS_MMAP
+#endif
+#if __cplusplus >= 201703L
+#include <string_view>
+#define QJSCPP_HAS_STRING_VIEW
+#define QJSCPP_HAS_AUTO_TEMPLATE
+#endif
+#if defined(__cpp_fold_expressions)
+#define QJSCPP_HAS_FOLD_EXPRESSIONS
+#define QJSCPP_EXPAND(...) ((void)(__VA_ARGS__), ...)
+#else
+#define QJSCPP_EXPAND(...) __attribute__((unused)) int qjscpp_expand_[] = {{0}, ((void)(__VA_ARGS__), 0)...}
+#endif
+#if __cplusplus >= 202002L && defined(__cpp_impl_coroutine)
+#include <coroutine>
+#include <optional>
+#define QJSCPP_HAS_COROUTINES
+#endif
+// Define QJSCPP_DEBUG_OUTPUT to trace lifetimes and calls on std::cerr
+#ifdef QJSCPP_DEBUG_OUTPUT
 #include <iostream>
 #define QJSCPP_DEBUG(stmt) \
 	do { \
@@ -43,13 +85,45 @@
 #else
 #define QJSCPP_DEBUG(stmt)
 #endif
+// Internal consistency checks, which NDEBUG removes as well. Define QJSCPP_NO_CHECKS
+// to remove them from code that keeps its own assertions enabled.
+#ifdef QJSCPP_NO_CHECKS
+#define QJSCPP_ASSERT(cond) ((void)sizeof(cond))
+#else
+#define QJSCPP_ASSERT(cond) assert(cond)
+#endif
+// Define QJSCPP_PROFILE to collect call statistics of native bindings and to
+// enable runtime::start_sampling(), without it the instrumentation compiles to nothing
+#ifdef QJSCPP_PROFILE
+#if defined(__GNUC__)
+#define QJSCPP_PROFILE_SIGNATURE __PRETTY_FUNCTION__
+#elif defined(_MSC_VER)
+#define QJSCPP_PROFILE_SIGNATURE __FUNCSIG__
+#else
+#define QJSCPP_PROFILE_SIGNATURE __func__
+#endif
+#define QJSCPP_PROFILE_CALL(ctx, kind, key) \
+	static const char qjscpp_profile_site_ = 0; \
+	::quickjs::detail::profile_scope qjscpp_profile_scope_(ctx, kind, QJSCPP_PROFILE_SIGNATURE, key, &qjscpp_profile_site_)
+#else
+#define QJSCPP_PROFILE_CALL(ctx, kind, key)
+#endif
 
 namespace quickjs
 {
 	class runtime;
 	class context;
+	class atom;
 	class value;
 	class args;
+	class result;
+	class gc_marker;
+	class serialized_value;
+	struct batch_result;
+	class event_loop;
+#ifdef QJSCPP_HAS_COROUTINES
+	template <typename T = value> class task;
+#endif
 	
 	class exception:
 		public std::exception
@@ -86,18 +160,30 @@ namespace quickjs
 		}
 	};
 	
+	class time_budget_exceeded:
+		public exception
+	{
+	public:
+		time_budget_exceeded():
+			exception("time budget exceeded")
+		{
+		}
+	};
+	
 	class cstring
 	{
 		friend class context;
 		friend class value;
+		friend class value_ref;
 		
 		JSContext* ctx_{nullptr};
 		const char* cstr_{nullptr};
+		size_t len_{0};
 		
 		cstring(JSContext* ctx, JSValueConst val):
-			ctx_(ctx),
-			cstr_(JS_ToCString(ctx, val))
+			ctx_(ctx)
 		{
+			cstr_ = JS_ToCStringLen(ctx, &len_, val);
 		}
 		
 	public:
@@ -108,10 +194,12 @@ namespace quickjs
 		
 		cstring(cstring&& from):
 			ctx_(from.ctx_),
-			cstr_(from.cstr_)
+			cstr_(from.cstr_),
+			len_(from.len_)
 		{
 			from.ctx_ = nullptr;
 			from.cstr_ = nullptr;
+			from.len_ = 0;
 		}
 		
 		cstring& operator=(cstring&& from)
@@ -124,6 +212,8 @@ namespace quickjs
 				from.ctx_ = nullptr;
 				cstr_ = from.cstr_;
 				from.cstr_ = nullptr;
+				len_ = from.len_;
+				from.len_ = 0;
 			}
 			return *this;
 		}
@@ -136,7 +226,7 @@ namespace quickjs
 		
 		operator std::string() const
 		{
-			return cstr_ ? std::string(cstr_) : std::string();
+			return str();
 		}
 		
 		operator const char*() const
@@ -146,7 +236,7 @@ namespace quickjs
 		
 		std::string str() const
 		{
-			return cstr_ ? std::string(cstr_) : std::string();
+			return cstr_ ? std::string(cstr_, len_) : std::string();
 		}
 		
 		const char* c_str() const
@@ -154,18 +244,102 @@ namespace quickjs
 			return cstr_;
 		}
 		
+		const char* data() const
+		{
+			return cstr_;
+		}
+		
+		// Length in bytes, the string may contain embedded null characters
+		size_t size() const
+		{
+			return len_;
+		}
+
+#ifdef QJSCPP_HAS_STRING_VIEW
+		std::string_view view() const
+		{
+			return cstr_ ? std::string_view(cstr_, len_) : std::string_view();
+		}
+#endif
+		
 		operator bool() const
 		{
 			return cstr_ != nullptr;
 		}
 	};
 	
+	/**
+	 * A view of memory owned by something else, like the contents of an
+	 * ArrayBuffer or typed array.
+	 */
+	template <typename T>
+	class span
+	{
+		T* data_{nullptr};
+		size_t size_{0};
+	
+	public:
+		typedef T element_type;
+		typedef T* iterator;
+		
+		span() = default;
+		
+		span(T* data, size_t size):
+			data_(data),
+			size_(size)
+		{
+		}
+		
+		T* data() const
+		{
+			return data_;
+		}
+		
+		size_t size() const
+		{
+			return size_;
+		}
+		
+		size_t size_bytes() const
+		{
+			return size_ * sizeof(T);
+		}
+		
+		bool empty() const
+		{
+			return size_ == 0;
+		}
+		
+		T& operator[](size_t i) const
+		{
+			return data_[i];
+		}
+		
+		iterator begin() const
+		{
+			return data_;
+		}
+		
+		iterator end() const
+		{
+			return data_ + size_;
+		}
+	};
+	
 	namespace detail
 	{
 		struct jsvalue_list;
 		
+		template <typename T>
+		struct js_traits;
+		
 		template <typename Owned>
 		class owner;
+
+#ifdef QJSCPP_HAS_COROUTINES
+		class promise_awaiter;
+		struct coroutines;
+#endif
 		
 		class list_entry
 		{
@@ -193,7 +367,7 @@ namespace quickjs
 			
 			~list_entry()
 			{
-				assert(!is_linked());
+				QJSCPP_ASSERT(!is_linked());
 			}
 			
 			list_entry(const list_entry&) = delete;
@@ -256,7 +430,7 @@ namespace quickjs
 			
 			~owner()
 			{
-				assert(!head_.is_linked());
+				QJSCPP_ASSERT(!head_.is_linked());
 			}
 			
 			template <typename F>
@@ -272,8 +446,8 @@ namespace quickjs
 			
 			inline void insert_head(list_entry& entry)
 			{
-				assert(&entry != &head_);
-				assert(!entry.is_linked());
+				QJSCPP_ASSERT(&entry != &head_);
+				QJSCPP_ASSERT(!entry.is_linked());
 				list_entry* next = head_.flink_;
 				head_.flink_ = &entry;
 				entry.blink_ = &head_;
@@ -285,6 +459,79 @@ namespace quickjs
 		};
 	}
 	
+	namespace detail
+	{
+		template <typename T>
+		struct typed_array_traits;
+		
+		template <> struct typed_array_traits<int8_t> { static const char* name() { return "Int8Array"; } };
+		template <> struct typed_array_traits<uint8_t> { static const char* name() { return "Uint8Array"; } };
+		template <> struct typed_array_traits<int16_t> { static const char* name() { return "Int16Array"; } };
+		template <> struct typed_array_traits<uint16_t> { static const char* name() { return "Uint16Array"; } };
+		template <> struct typed_array_traits<int32_t> { static const char* name() { return "Int32Array"; } };
+		template <> struct typed_array_traits<uint32_t> { static const char* name() { return "Uint32Array"; } };
+		template <> struct typed_array_traits<float> { static const char* name() { return "Float32Array"; } };
+		template <> struct typed_array_traits<double> { static const char* name() { return "Float64Array"; } };
+		
+		// Finds the memory of an ArrayBuffer or typed array without copying it
+		inline bool get_buffer(JSContext* ctx, JSValueConst val, uint8_t*& data, size_t& size, size_t& elem_size)
+		{
+			if (!JS_IsObject(val))
+				return false;
+			
+			size_t len = 0;
+			if (uint8_t* buf = JS_GetArrayBuffer(ctx, &len, val))
+			{
+				data = buf;
+				size = len;
+				elem_size = 1;
+				return true;
+			}
+			JS_FreeValue(ctx, JS_GetException(ctx));
+			
+			size_t offset = 0, length = 0, per_element = 0;
+			JSValue buffer = JS_GetTypedArrayBuffer(ctx, val, &offset, &length, &per_element);
+			if (JS_IsException(buffer))
+			{
+				JS_FreeValue(ctx, JS_GetException(ctx));
+				return false;
+			}
+			uint8_t* buf = JS_GetArrayBuffer(ctx, &len, buffer);
+			JS_FreeValue(ctx, buffer);
+			if (!buf)
+			{
+				JS_FreeValue(ctx, JS_GetException(ctx));
+				return false;
+			}
+			data = buf + offset;
+			size = length;
+			elem_size = per_element;
+			return true;
+		}
+		
+		// Typed arrays can be viewed as any type of their element size, other
+		// buffers as anything their size and alignment allow. The public API
+		// of older QuickJS versions can't tell the kind of a typed array, so
+		// e.g. a Float64Array is also accepted as span<int64_t>, and the
+		// elements are reinterpreted like memcpy() would.
+		template <typename T>
+		inline bool get_span(JSContext* ctx, JSValueConst val, span<T>& s)
+		{
+			uint8_t* data = nullptr;
+			size_t size = 0, elem_size = 0;
+			if (!get_buffer(ctx, val, data, size, elem_size) ||
+				(elem_size != 1 && sizeof(T) != 1 && elem_size != sizeof(T)) ||
+				size % sizeof(T) != 0 ||
+				reinterpret_cast<uintptr_t>(data) % alignof(T) != 0)
+			{
+				s = span<T>();
+				return false;
+			}
+			s = span<T>(reinterpret_cast<T*>(data), size / sizeof(T));
+			return true;
+		}
+	}
+	
 	class value_error:
 		public exception
 	{
@@ -310,10 +557,28 @@ namespace quickjs
 		}
 	};
 	
+	class value_ref;
 	class value_exception;
 	
 	template <typename ClassType> class class_def;
 	template <typename ClassType> class class_def_shared;
+	template <typename StructType> class struct_def;
+	
+	namespace detail
+	{
+		// Structs converted field by field, see runtime::create_struct_def()
+		template <typename T, typename = void>
+		struct is_struct:
+			public std::false_type
+		{
+		};
+		
+		template <typename T>
+		struct is_struct<T, typename std::enable_if<std::is_same<decltype(T::struct_definition), struct_def<T>>::value>::type>:
+			public std::true_type
+		{
+		};
+	}
 	
 	namespace detail
 	{
@@ -329,6 +594,7 @@ namespace quickjs
 			enum { arity = sizeof...(Args) };
 			
 			typedef R result_type;
+			typedef R signature(Args...);
 			
 			template <size_t i>
 			struct arg
@@ -343,6 +609,7 @@ namespace quickjs
 			enum { arity = sizeof...(Args) };
 			
 			typedef R result_type;
+			typedef R signature(Args...);
 			
 			template <size_t i>
 			struct arg
@@ -351,6 +618,22 @@ namespace quickjs
 			};
 		};
 		
+		template <typename C, typename R, typename... Args>
+		struct func_traits<R(C::*)(Args...)>:
+			public func_traits<R(C::*)(Args...) const>
+		{
+		};
+		
+		template <typename T>
+		struct member_traits;
+		
+		template <typename C, typename M>
+		struct member_traits<M C::*>
+		{
+			typedef C class_type;
+			typedef M member_type;
+		};
+		
 		template <size_t... Ns>
 		struct indices
 		{
@@ -384,9 +667,122 @@ namespace quickjs
 		struct closures_common
 		{
 			template <typename Func, size_t N>
-			static JSValue handle_closure_expand(Func f, JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv);
+			static JSValue handle_closure_expand(Func& f, JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv);
 			template <typename Func, size_t N>
-			static JSValue handle_closure_expand_with_args(Func f, JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv);
+			static JSValue handle_closure_expand_with_args(Func& f, JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv);
+			
+			template <typename T>
+			struct is_const_call: std::false_type{};
+			
+			template <typename R, typename C, typename... Args>
+			struct is_const_call<R(C::*)(Args...) const>: std::true_type{};
+			
+			// Functors that fit into the opaque pointer of the closure are stored in it,
+			// which saves an allocation and a finalizer. They are copied for each call,
+			// so only those that can't change their state qualify.
+			template <typename Func>
+			struct inline_functor
+			{
+				enum : bool
+				{
+					value = sizeof(Func) <= sizeof(void*) && alignof(Func) <= alignof(void*) &&
+						std::is_trivially_copyable<Func>::value && is_const_call<decltype(&Func::operator())>::value
+				};
+				
+				static void* store(const Func& f)
+				{
+					void* opaque = nullptr;
+					::memcpy(&opaque, &f, sizeof(Func));
+					return opaque;
+				}
+				
+				struct load
+				{
+					typename std::aligned_storage<sizeof(Func), alignof(Func)>::type buf_;
+					
+					explicit load(void* opaque)
+					{
+						::memcpy(&buf_, &opaque, sizeof(Func));
+					}
+					
+					Func& get()
+					{
+						return *reinterpret_cast<Func*>(&buf_);
+					}
+				};
+			};
+			
+			// Heap::handler gets a pointer to the functor, Inline::handler the opaque pointer it is stored in
+			template <typename Heap, typename Inline, typename Func, typename std::enable_if<inline_functor<Func>::value>::type* = nullptr>
+			static JSValue create_functor(JSContext* ctx, Func f, int length)
+			{
+				return JS_NewCClosure(ctx, Inline::handler, length, 0, inline_functor<Func>::store(f), nullptr);
+			}
+			
+			template <typename Heap, typename Inline, typename Func, typename std::enable_if<!inline_functor<Func>::value>::type* = nullptr>
+			static JSValue create_functor(JSContext* ctx, Func f, int length)
+			{
+				std::unique_ptr<Func> fcopy(new Func(std::move(f)));
+				JSValue ret = JS_NewCClosure(ctx, Heap::handler, length, 0, reinterpret_cast<void*>(fcopy.get()),
+					[](void* opaque)
+					{
+						delete reinterpret_cast<Func*>(opaque);
+					});
+				if (JS_IsException(ret))
+					return ret;
+				fcopy.release();
+				return ret;
+			}
+			
+			template <typename T>
+			struct is_task: std::false_type{};
+			
+			template <typename Func, typename = void>
+			struct stored_functor
+			{
+				typedef Func type;
+				
+				static Func make(Func f)
+				{
+					return f;
+				}
+			};
+
+#ifdef QJSCPP_HAS_COROUTINES
+			template <typename T>
+			struct is_task<task<T>>: std::true_type{};
+			
+			template <typename Func, typename Sig>
+			struct coroutine_functor;
+			
+			// A coroutine uses the captures of its lambda after the call has returned,
+			// possibly after the closure has been garbage collected, so the lambda is
+			// shared with each task it returns. This also keeps it out of inline storage,
+			// where it would only be a copy on the stack.
+			template <typename Func, typename R, typename... Args>
+			struct coroutine_functor<Func, R(Args...)>
+			{
+				std::shared_ptr<Func> f_;
+				
+				R operator()(Args... args) const
+				{
+					R t = (*f_)(std::forward<Args>(args)...);
+					t.keep_alive(f_);
+					return t;
+				}
+			};
+			
+			template <typename Func>
+			struct stored_functor<Func, typename std::enable_if<is_task<typename func_traits<Func>::result_type>::value>::type>
+			{
+				typedef coroutine_functor<Func, typename func_traits<Func>::signature> type;
+				
+				static type make(Func f)
+				{
+					return type{std::make_shared<Func>(std::move(f))};
+				}
+			};
+#endif
 		};
 		
 		template <typename FirstArg>
@@ -399,7 +795,7 @@ namespace quickjs
 				{
 					typedef R(*Func)(A...);
 					Func f = reinterpret_cast<Func>(opaque);
-					return closures_common::handle_closure_expand<Func, N>(*f, ctx, this_val, argc, argv);
+					return closures_common::handle_closure_expand<Func, N>(f, ctx, this_val, argc, argv);
 				}
 			};
 			
@@ -420,20 +816,23 @@ namespace quickjs
 				}
 			};
 			
+			template <typename Func, size_t N>
+			struct inline_functor
+			{
+				static JSValue handler(JSContext* ctx, JSValueConst this_val, int argc, JSValueConst *argv, int /*magic*/, void* opaque)
+				{
+					typename closures_common::inline_functor<Func>::load f(opaque);
+					return closures_common::handle_closure_expand<Func, N>(f.get(), ctx, this_val, argc, argv);
+				}
+			};
+			
 			template<typename Func>
 			static JSValue create(JSContext* ctx, Func f)
 			{
 				using traits = detail::func_traits<decltype(f)>;
-				std::unique_ptr<decltype(f)> fcopy(new Func(std::move(f)));
-				JSValue ret = JS_NewCClosure(ctx, functor<decltype(f), traits::arity>::handler, traits::arity, 0, reinterpret_cast<void*>(fcopy.get()),
-					[](void* opaque)
-					{
-						delete reinterpret_cast<Func*>(opaque);
-					});
-				if (JS_IsException(ret))
-					return ret;
-				fcopy.release();
-				return ret;
+				using stored = closures_common::stored_functor<Func>;
+				typedef typename stored::type F;
+				return closures_common::create_functor<functor<F, traits::arity>, inline_functor<F, traits::arity>>(ctx, stored::make(std::move(f)), traits::arity);
 			}
 		};
 		
@@ -447,7 +846,7 @@ namespace quickjs
 				{
 					typedef R(*Func)(A...);
 					Func f = reinterpret_cast<Func>(opaque);
-					return closures_common::handle_closure_expand_with_args<Func, N>(*f, ctx, this_val, argc, argv);
+					return closures_common::handle_closure_expand_with_args<Func, N>(f, ctx, this_val, argc, argv);
 				}
 			};
 			
@@ -468,20 +867,23 @@ namespace quickjs
 				}
 			};
 			
+			template <typename Func, size_t N>
+			struct inline_functor
+			{
+				static JSValue handler(JSContext *ctx, JSValue this_val, int argc, JSValueConst *argv, int /*magic*/, void* opaque)
+				{
+					typename closures_common::inline_functor<Func>::load f(opaque);
+					return closures_common::handle_closure_expand_with_args<Func, N>(f.get(), ctx, this_val, argc, argv);
+				}
+			};
+			
 			template<typename Func>
 			static JSValue create(JSContext* ctx, Func f)
 			{
 				using traits = detail::func_traits<decltype(f)>;
-				std::unique_ptr<decltype(f)> fcopy(new Func(std::move(f)));
-				JSValue ret = JS_NewCClosure(ctx, functor<decltype(f), traits::arity - 1>::handler, traits::arity - 1, 0, reinterpret_cast<void*>(fcopy.get()),
-					[](void* opaque)
-					{
-						delete reinterpret_cast<Func*>(opaque);
-					});
-				if (JS_IsException(ret))
-					return ret;
-				fcopy.release();
-				return ret;
+				using stored = closures_common::stored_functor<Func>;
+				typedef typename stored::type F;
+				return closures_common::create_functor<functor<F, traits::arity - 1>, inline_functor<F, traits::arity - 1>>(ctx, stored::make(std::move(f)), traits::arity - 1);
 			}
 		};
 		
@@ -515,6 +917,11 @@ namespace quickjs
 			static value call_common(const value& func, JSContext* ctx, const value& thisObj, Args&&... a);
 			template <typename Begin, typename End>
 			static value call_common_it(const value& func, JSContext* ctx, const value& thisObj, Begin&& begin, End&& end);
+			template <typename Begin, typename End, typename Out>
+			static size_t call_batch(const value& func, JSContext* ctx, const value& thisObj, Begin begin, End end, Out out);
+			static batch_result make_batch_result(context* c, JSContext* ctx, JSValue ret);
+			template <typename... Args>
+			static result try_call(const value& func, JSContext* ctx, const value& thisObj, Args&&... a);
 			
 			static value call(const value& func, JSContext* ctx, const value& thisObj);
 			template <typename A>
@@ -550,6 +957,12 @@ namespace quickjs
 			template <typename ClassType, typename std::enable_if<std::is_base_of<class_def_shared<ClassType>, decltype(ClassType::class_definition)>{}, int>::type>
 			static JSValue class_make_inst(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst *argv);
 			
+			template <typename ClassType, typename... Args>
+			static typename std::enable_if<std::is_base_of<class_def<ClassType>, decltype(ClassType::class_definition)>::value, JSValue>::type class_new_object(JSContext* ctx, Args&&... args);
+			
+			template <typename ClassType, typename... Args>
+			static typename std::enable_if<std::is_base_of<class_def_shared<ClassType>, decltype(ClassType::class_definition)>::value, JSValue>::type class_new_object(JSContext* ctx, Args&&... args);
+			
 			template <typename ClassType>
 			static ClassType* raw_to_inst_ptr(ClassType* raw_ptr)
 			{
@@ -590,7 +1003,7 @@ namespace quickjs
 			struct has_gc_mark: std::false_type{};
 			
 			template <typename C>
-			struct has_gc_mark<C, void_t<decltype(&C::gc_mark)>>: std::is_same<void, decltype(std::declval<C>().gc_mark(nullptr))>{};
+			struct has_gc_mark<C, void_t<decltype(&C::gc_mark)>>: std::is_same<void, decltype(std::declval<C>().gc_mark(std::declval<const gc_marker&>()))>{};
 			
 			template <typename ClassType, typename std::enable_if<has_gc_mark<ClassType>::value, ClassType>::type*>
 			static void gc_mark(JSRuntime *rt, JSValueConst val, JS_MarkFunc *mark_func);
@@ -608,6 +1021,21 @@ namespace quickjs
 			
 			template <typename ClassType, void(ClassType::*Getter)(const value&, const value&)>
 			static JSValue invoke_setter(JSContext *ctx, JSValueConst this_val, JSValueConst val);
+			
+			template <typename ClassType, value(ClassType::*Getter)(value_ref)>
+			static JSValue invoke_getter_ref(JSContext *ctx, JSValueConst this_val);
+			
+			template <typename ClassType, void(ClassType::*Setter)(value_ref, value_ref)>
+			static JSValue invoke_setter_ref(JSContext *ctx, JSValueConst this_val, JSValueConst val);
+			
+			template <typename ClassType, typename Func, Func F>
+			static JSValue invoke_method(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv);
+			
+			template <typename ClassType, typename MemberType, MemberType ClassType::*Member>
+			static JSValue get_field(JSContext *ctx, JSValueConst this_val);
+			
+			template <typename ClassType, typename MemberType, MemberType ClassType::*Member>
+			static JSValue set_field(JSContext *ctx, JSValueConst this_val, JSValueConst val);
 		};
 		
 		struct members
@@ -620,67 +1048,253 @@ namespace quickjs
 		};
 	}
 	
-	class value:
+	/**
+	 * A property key that has been interned once.
+	 * 
+	 * Looking up properties by name has to intern that name on every access.
+	 * For names that are used over and over again, create an atom once and use
+	 * it with get_property(), set_property(), has_property() and
+	 * context::call_global() instead. Like values, atoms are invalidated
+	 * automatically when their context goes away.
+	 */
+	class atom:
 		private detail::list_entry
 	{
 		friend class context;
-		friend class runtime;
-		friend class args;
-		friend class context_exception;
-		friend class detail::jsvalue_list;
-		friend class detail::closures_common;
-		friend class detail::functions;
-		template <typename FirstType> friend class detail::closures;
-		friend class detail::classes;
+		friend class value;
+		friend class value_ref;
 		template <typename Owned> friend class detail::owner;
-		template <typename ClassType> friend class class_builder;
 		
 		context* owner_{nullptr};
 		JSContext* ctx_{nullptr};
-		JSValue val_{0}; // valid if ctx_ is not null
+		JSAtom atom_{JS_ATOM_NULL}; // valid if ctx_ is not null
 		
 		void track();
-		void track(value& from);
 		void untrack();
 		
-		inline void validate() const
+		inline void validate_for(JSContext* ctx) const
 		{
-			if (!valid())
-				throw_value_exception("no context");
+			if (!ctx_ || JS_GetRuntime(ctx_) != JS_GetRuntime(ctx))
+				throw exception("invalid atom");
 		}
 		
-		inline void throw_value_exception(const char* msg) const;
-		
-		inline void do_throw(value exval);
-		
-		void handle_pending_exception();
+		void create(JSContext* ctx, JSAtom atom)
+		{
+			if (!ctx)
+				throw invalid_context();
+			if (atom == JS_ATOM_NULL)
+				throw exception("failed to create atom");
+			ctx_ = ctx;
+			atom_ = atom;
+			track();
+		}
 		
-		inline void check_throw(bool check_exceptions)
+		void abandon()
 		{
 			if (ctx_)
 			{
-				if (check_exceptions)
-					handle_pending_exception();
-				if (JS_IsException(val_))
-					do_throw(value(ctx_, JS_GetException(ctx_)));
+				QJSCPP_DEBUG("abandon atom @" << (void*)this);
+				JS_FreeAtom(ctx_, atom_);
 			}
+			untrack();
+			ctx_ = nullptr;
+			atom_ = JS_ATOM_NULL;
 		}
+	
+	public:
+		atom() = default;
 		
-		JSValue steal()
+		atom(JSContext* ctx, const char* name)
 		{
-			validate();
-			JSValue ret = val_;
-			val_ = {0};
-			ctx_ = nullptr;
-			return ret;
+			create(ctx, ctx ? JS_NewAtom(ctx, name) : JS_ATOM_NULL);
 		}
 		
-		explicit value(JSContext* ctx, JSValue val, bool dup = false):
-			ctx_(ctx),
-			val_(ctx && dup ? JS_DupValue(ctx, val) : val)
+		atom(JSContext* ctx, const std::string& name)
 		{
-			QJSCPP_DEBUG("value(JSContext*, JSValue) @" << (void*)this);
-			validate();
+			create(ctx, ctx ? JS_NewAtomLen(ctx, name.data(), name.length()) : JS_ATOM_NULL);
+		}
+		
+		atom(JSContext* ctx, uint32_t index)
+		{
+			create(ctx, ctx ? JS_NewAtomUInt32(ctx, index) : JS_ATOM_NULL);
+		}
+		
+		atom(const atom& other)
+		{
+			if (other.ctx_)
+				create(other.ctx_, JS_DupAtom(other.ctx_, other.atom_));
+		}
+		
+		atom(atom&& from):
+			ctx_(from.ctx_),
+			atom_(from.atom_)
+		{
+			from.untrack();
+			from.ctx_ = nullptr;
+			from.atom_ = JS_ATOM_NULL;
+			track();
+		}
+		
+		atom& operator=(const atom& other)
+		{
+			if (&other != this)
+			{
+				abandon();
+				if (other.ctx_)
+					create(other.ctx_, JS_DupAtom(other.ctx_, other.atom_));
+			}
+			return *this;
+		}
+		
+		atom& operator=(atom&& from)
+		{
+			if (&from != this)
+			{
+				abandon();
+				ctx_ = from.ctx_;
+				atom_ = from.atom_;
+				from.untrack();
+				from.ctx_ = nullptr;
+				from.atom_ = JS_ATOM_NULL;
+				track();
+			}
+			return *this;
+		}
+		
+		~atom()
+		{
+			abandon();
+		}
+		
+		bool valid() const
+		{
+			return ctx_ != nullptr;
+		}
+		
+		std::string str() const
+		{
+			if (!ctx_)
+				return std::string();
+			const char* name = JS_AtomToCString(ctx_, atom_);
+			if (!name)
+				return std::string();
+			std::string ret(name);
+			JS_FreeCString(ctx_, name);
+			return ret;
+		}
+	};
+	
+	/**
+	 * Passed to the gc_mark() method of class instances, which report the JS
+	 * values they own with it. An instance holding a value that refers back
+	 * to its own JS object (e.g. a callback) must mark it, otherwise the cycle
+	 * collector can't free either. Each owned value must be marked exactly once.
+	 * 
+	 * gc_mark() may also take a value::mark_func, which is slower to call.
+	 */
+	class gc_marker
+	{
+		JSRuntime* rt_;
+		JS_MarkFunc* mark_func_;
+	
+	public:
+		gc_marker(JSRuntime* rt, JS_MarkFunc* mark_func):
+			rt_(rt),
+			mark_func_(mark_func)
+		{
+		}
+		
+		void operator()(JSValueConst val) const
+		{
+			JS_MarkValue(rt_, val, mark_func_);
+		}
+		
+		inline void operator()(const value& val) const;
+	};
+	
+	class value:
+		private detail::list_entry
+	{
+		friend class context;
+		friend class runtime;
+		friend class args;
+		friend class context_exception;
+		friend class detail::jsvalue_list;
+		friend class detail::closures_common;
+		friend class detail::functions;
+		template <typename FirstType> friend class detail::closures;
+		friend class detail::classes;
+		template <typename Owned> friend class detail::owner;
+		template <typename ClassType> friend class class_builder;
+		friend class context_pool;
+		friend class context_snapshot;
+		friend class value_ref;
+		friend class function_handle;
+		friend class result;
+		friend class gc_marker;
+		template <typename T> friend struct detail::js_traits;
+#ifdef QJSCPP_HAS_COROUTINES
+		friend struct detail::coroutines;
+#endif
+		
+		context* owner_{nullptr};
+		JSContext* ctx_{nullptr};
+		JSValue val_{0}; // valid if ctx_ is not null
+		
+		void track();
+		void track(value& from);
+		void untrack();
+		
+		inline void validate() const
+		{
+			if (!valid())
+				throw_value_exception("no context");
+		}
+		
+		inline void throw_value_exception(const char* msg) const;
+		
+		inline void do_throw(value exval) const;
+		
+		template <typename T>
+		void wrap(const T& val)
+		{
+			QJSCPP_DEBUG("value(JSContext*, [converted]) @" << (void*)this);
+			validate();
+			
+			val_ = detail::js_traits<T>::wrap(ctx_, val);
+			check_throw(false);
+			
+			track();
+		}
+		
+		void handle_pending_exception();
+		
+		inline void check_throw(bool check_exceptions)
+		{
+			if (ctx_)
+			{
+				if (check_exceptions)
+					handle_pending_exception();
+				if (JS_IsException(val_))
+					do_throw(value(ctx_, JS_GetException(ctx_)));
+			}
+		}
+		
+		JSValue steal()
+		{
+			validate();
+			JSValue ret = val_;
+			val_ = {0};
+			ctx_ = nullptr;
+			return ret;
+		}
+		
+		explicit value(JSContext* ctx, JSValue val, bool dup = false):
+			ctx_(ctx),
+			val_(ctx && dup ? JS_DupValue(ctx, val) : val)
+		{
+			QJSCPP_DEBUG("value(JSContext*, JSValue) @" << (void*)this);
+			validate();
 			track();
 		}
 		
@@ -761,19 +1375,16 @@ namespace quickjs
 			if (&from != this)
 			{
 				if (ctx_)
-				{
 					JS_FreeValue(ctx_, val_);
-					if (!from.ctx_)
-						untrack();
-				}
-				else if (from.ctx_)
-					track();
 				ctx_ = from.ctx_;
 				from.ctx_ = nullptr;
 				val_ = from.val_;
 				from.val_ = {0};
+				// Tracked by the context of the moved value, once ctx_ is set
 				if (ctx_)
-					from.untrack();
+					track(from);
+				else
+					untrack();
 			}
 			return *this;
 		}
@@ -796,6 +1407,98 @@ namespace quickjs
 			track();
 		}
 		
+		value(JSContext* ctx, const char* str, size_t len):
+			ctx_(ctx),
+			val_(JS_NewStringLen(ctx_, str, len))
+		{
+			QJSCPP_DEBUG("value(JSContext*, const char*, size_t) @" << (void*)this);
+			validate();
+			track();
+		}
+
+#ifdef QJSCPP_HAS_STRING_VIEW
+		value(JSContext* ctx, std::string_view str):
+			ctx_(ctx),
+			val_(JS_NewStringLen(ctx_, str.data(), str.length()))
+		{
+			QJSCPP_DEBUG("value(JSContext*, std::string_view) @" << (void*)this);
+			validate();
+			track();
+		}
+#endif
+		
+		value(JSContext* ctx, bool val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		value(JSContext* ctx, int32_t val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		value(JSContext* ctx, uint32_t val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		value(JSContext* ctx, int64_t val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		value(JSContext* ctx, double val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		template <typename T>
+		value(JSContext* ctx, const std::vector<T>& val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		template <typename T, size_t N>
+		value(JSContext* ctx, const std::array<T, N>& val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		template <typename... T>
+		value(JSContext* ctx, const std::tuple<T...>& val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		template <typename T>
+		value(JSContext* ctx, const std::map<std::string, T>& val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		template <typename T>
+		value(JSContext* ctx, const std::unordered_map<std::string, T>& val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
+		template <typename T, typename std::enable_if<detail::is_struct<T>::value, int>::type = 0>
+		value(JSContext* ctx, const T& val):
+			ctx_(ctx)
+		{
+			wrap(val);
+		}
+		
 		template<typename R, typename... A>
 		value(JSContext* ctx, R(*f)(A...)):
 			ctx_(ctx)
@@ -823,7 +1526,7 @@ namespace quickjs
 			track();
 		}
 		
-		template <typename Func>
+		template <typename Func, typename std::enable_if<!detail::is_struct<Func>::value, int>::type = 0>
 		value(JSContext* ctx, Func f):
 			ctx_(ctx)
 		{
@@ -837,6 +1540,14 @@ namespace quickjs
 			track();
 		}
 		
+		inline value(const value_ref& ref);
+
+#ifdef QJSCPP_HAS_COROUTINES
+		// Starts the coroutine and makes a promise that is settled with its result
+		template <typename T>
+		value(JSContext* ctx, task<T> t);
+#endif
+		
 		template <typename ClassType>
 		value(JSContext* ctx, const std::shared_ptr<ClassType>& inst):
 			ctx_(ctx)
@@ -1054,6 +1765,53 @@ namespace quickjs
 			return false;
 		}
 		
+		template <typename T>
+		span<T> as_span() const
+		{
+			validate();
+			span<T> ret;
+			if (!as_span(ret))
+				throw_value_exception("not a matching ArrayBuffer or typed array");
+			return ret;
+		}
+		
+		template <typename T>
+		bool as_span(span<T>& val) const
+		{
+			if (!valid())
+			{
+				val = span<T>();
+				return false;
+			}
+			return detail::get_span(ctx_, val_, val);
+		}
+		
+		span<uint8_t> as_bytes() const
+		{
+			return as_span<uint8_t>();
+		}
+		
+		bool as_bytes(span<uint8_t>& val) const
+		{
+			return as_span(val);
+		}
+		
+		template <typename T>
+		T as() const
+		{
+			validate();
+			T ret;
+			if (!as(ret))
+				throw_value_exception("conversion failed");
+			return ret;
+		}
+		
+		template <typename T>
+		bool as(T& val) const
+		{
+			return valid() && detail::js_traits<T>::unwrap(ctx_, val_, val);
+		}
+		
 		inline static value undefined(JSContext* ctx)
 		{
 			return value(ctx, JS_UNDEFINED);
@@ -1103,6 +1861,19 @@ namespace quickjs
 			return get_property(name.c_str());
 		}
 		
+		value get_property(const atom& name) const
+		{
+			validate();
+			name.validate_for(ctx_);
+			return value(ctx_, JS_GetProperty(ctx_, val_, name.atom_));
+		}
+		
+		value get_index(uint32_t idx) const
+		{
+			validate();
+			return value(ctx_, JS_GetPropertyUint32(ctx_, val_, idx));
+		}
+		
 		bool set_property(const char* name, value val)
 		{
 			validate();
@@ -1117,44 +1888,87 @@ namespace quickjs
 			return set_property(name.c_str(), std::move(val));
 		}
 		
-		template <typename R, typename... A>
-		bool set_property(const char* name, R(*func)(A...))
+		bool set_property(const atom& name, value val)
 		{
 			validate();
-			int ret = JS_SetPropertyStr(ctx_, val_, name, value(ctx_, func).steal());
+			name.validate_for(ctx_);
+			int ret = JS_SetProperty(ctx_, val_, name.atom_, val.steal());
 			if (ret < 0)
 				do_throw(value(ctx_, JS_GetException(ctx_)));
 			return ret;
 		}
 		
-		template <typename R, typename... A>
-		bool set_property(const std::string& name, R(*func)(A...))
-		{
-			return set_property(name.c_str(), func);
-		}
-		
-		template <typename Func>
-		bool set_property(const char* name, Func func)
+		bool set_index(uint32_t idx, value val)
 		{
 			validate();
-			int ret = JS_SetPropertyStr(ctx_, val_, name, value(ctx_, std::move(func)).steal());
+			int ret = JS_SetPropertyUint32(ctx_, val_, idx, val.steal());
 			if (ret < 0)
 				do_throw(value(ctx_, JS_GetException(ctx_)));
 			return ret;
 		}
 		
-		template <typename Func>
-		bool set_property(const std::string& name, Func func)
+		bool has_property(const char* name) const
 		{
-			return set_property(name.c_str(), func);
+			validate();
+			return has_property(atom(ctx_, name));
 		}
 		
-		template <typename ... Args>
-		value operator()(Args&& ... args) const;
+		bool has_property(const std::string& name) const
+		{
+			return has_property(name.c_str());
+		}
+		
+		bool has_property(const atom& name) const
+		{
+			validate();
+			name.validate_for(ctx_);
+			int ret = JS_HasProperty(ctx_, val_, name.atom_);
+			if (ret < 0)
+				do_throw(value(ctx_, JS_GetException(ctx_)));
+			return ret > 0;
+		}
+		
+		template <typename R, typename... A>
+		bool set_property(const char* name, R(*func)(A...))
+		{
+			validate();
+			int ret = JS_SetPropertyStr(ctx_, val_, name, value(ctx_, func).steal());
+			if (ret < 0)
+				do_throw(value(ctx_, JS_GetException(ctx_)));
+			return ret;
+		}
+		
+		template <typename R, typename... A>
+		bool set_property(const std::string& name, R(*func)(A...))
+		{
+			return set_property(name.c_str(), func);
+		}
+		
+		template <typename Func>
+		bool set_property(const char* name, Func func)
+		{
+			validate();
+			int ret = JS_SetPropertyStr(ctx_, val_, name, value(ctx_, std::move(func)).steal());
+			if (ret < 0)
+				do_throw(value(ctx_, JS_GetException(ctx_)));
+			return ret;
+		}
+		
+		template <typename Func>
+		bool set_property(const std::string& name, Func func)
+		{
+			return set_property(name.c_str(), func);
+		}
+		
+		template <typename ... Args>
+		value operator()(Args&& ... args) const;
 		
 		template <typename ... Args>
 		value call(const value& thisObj, Args&&... args) const;
 		
+		template <typename Begin, typename End, typename Out>
+		size_t call_batch(const value& thisObj, Begin begin, End end, Out out) const;
+		
 		template <typename... Args>
 		value call_member(const char* name, Args&&... args)
 		{
@@ -1168,766 +1982,5657 @@ namespace quickjs
 		{
 			return call_member(name.c_str(), std::forward<Args>(args)...);
 		}
-	};
+		
+		/**
+		 * Like call() and call_member(), but a function that throws doesn't
+		 * throw a C++ exception. The result holds either the returned value or
+		 * whatever was thrown.
+		 */
+		template <typename ... Args>
+		result try_call(const value& thisObj, Args&&... args) const;
+		
+		template <typename... Args>
+		result try_call_member(const char* name, Args&&... args);
+		
+		template <typename... Args>
+		result try_call_member(const std::string& name, Args&&... args);
+		
+		/**
+		 * Serializes the value with JS_JSONStringify, indenting by the given
+		 * number of spaces (0 for compact output).
+		 * 
+		 * The bool overload appends to out and returns false if the value has
+		 * no JSON representation (e.g. undefined or a function), the string
+		 * overload throws in that case. Exceptions thrown by toJSON() or cyclic
+		 * objects are rethrown.
+		 */
+		inline bool to_json(std::string& out, unsigned indent = 0) const;
+		inline std::string to_json(unsigned indent = 0) const;
+		
+		/**
+		 * Writes at most size - 1 bytes of JSON to buf, followed by a 0, and
+		 * returns the length of the whole JSON text like snprintf() does. If
+		 * the value has no JSON representation, (size_t)-1 is returned.
+		 */
+		inline size_t to_json(char* buf, size_t size, unsigned indent = 0) const;
+		
+		/**
+		 * Serializes the value like a structured clone, to be recreated with
+		 * context::deserialize(), e.g. in a runtime on another thread. Only data
+		 * can be serialized, functions and class instances throw.
+		 */
+		inline serialized_value serialize() const;
+		
+		/**
+		 * Passes the JSON text to sink(const char*, size_t) in chunks of at
+		 * most chunk_size bytes, e.g. for writing large outputs to a socket.
+		 */
+		template <typename Sink>
+		bool to_json_stream(Sink sink, size_t chunk_size = 64 * 1024, unsigned indent = 0) const;
+		
+		/**
+		 * Calls on_fulfilled(const value&) or on_rejected(const value&) once the
+		 * promise is settled. Values that aren't promises are treated like
+		 * Promise.resolve() does. The callbacks run as jobs, i.e. from within
+		 * runtime::run_pending_jobs().
+		 */
+		template <typename OnFulfilled, typename OnRejected>
+		void then(OnFulfilled on_fulfilled, OnRejected on_rejected) const;
+		
+		/**
+		 * Returns a future that becomes ready when the promise is settled. The
+		 * result is converted to T (void ignores it), a rejection is stored as
+		 * a value_error (for Error objects) or value_exception. Note that the
+		 * future only becomes ready when the jobs of the runtime are run, so
+		 * waiting for it on the thread that runs them blocks forever.
+		 */
+		template <typename T>
+		std::future<T> to_future() const;
+		
+		// The exception to_future() reports for a rejection reason
+		inline static std::exception_ptr rejection_exception(const value& reason);
+
+#ifdef QJSCPP_HAS_COROUTINES
+		/**
+		 * Lets a coroutine co_await a promise, which yields the result as a
+		 * value or throws like to_future() does. The coroutine is resumed from
+		 * within runtime::run_pending_jobs().
+		 */
+		inline detail::promise_awaiter operator co_await() const;
+#endif
 	
+	private:
+		template <typename Func>
+		bool stringify(unsigned indent, Func f) const;
+	};
 	
-	class args:
-		public std::vector<value>
+	/**
+	 * A non-owning view of a JavaScript value.
+	 * 
+	 * Unlike value, a value_ref is neither reference counted nor tracked by
+	 * its context, which makes it essentially free to create. It is only
+	 * valid for as long as whatever it was created from (e.g. an argument of
+	 * a closure, getter or setter) is alive. Construct a value from it in
+	 * order to keep it around.
+	 */
+	class value_ref
 	{
 		friend class value;
-		friend class detail::classes;
-		friend class detail::closures_common;
 		
-		value this_;
+		JSContext* ctx_{nullptr};
+		JSValueConst val_{0}; // valid if ctx_ is not null
 		
-		args(JSContext* ctx, size_t N, JSValue this_obj, size_t argc, JSValueConst* argv):
-			std::vector<value>((N > argc) ? N : argc),
-			this_(ctx, this_obj, true)
+		inline void validate() const
 		{
-			size_t i = 0;
-			for (; i < argc; i++)
-				(*this)[i] = value(ctx, argv[i], true);
-			for (; i < N; i++)
-				(*this)[i] = value::undefined(ctx);
+			if (!valid())
+				throw_value_exception("no context");
 		}
 		
+		inline void throw_value_exception(const char* msg) const;
+	
 	public:
-		context& get_context() const
+		value_ref() = default;
+		
+		value_ref(JSContext* ctx, JSValueConst val):
+			ctx_(ctx),
+			val_(val)
 		{
-			return this_.get_context();
 		}
 		
-		const value& get_this() const
+		value_ref(const value& val):
+			ctx_(val.ctx_),
+			val_(val.val_)
 		{
-			return this_;
 		}
-	};
-	
-	class throw_exception:
-		public exception
-	{
-		value value_;
 		
-	public:
-		throw_exception()
+		bool valid() const
 		{
+			return ctx_ != nullptr;
 		}
 		
-		throw_exception(value&& val):
-			value_(std::move(val))
+		JSValueConst get() const
 		{
+			validate();
+			return val_;
 		}
 		
-		value val() const
+		bool is_null() const
 		{
-			return value_;
+			validate();
+			return JS_IsNull(val_);
 		}
 		
-		virtual const char* what() const noexcept
+		bool is_undefined() const
 		{
-			return "thrown exception";
+			validate();
+			return JS_IsUndefined(val_);
 		}
-	};
-	
-	class value_exception:
-		public exception
-	{
-		friend class value;
-		
-		value value_;
 		
-		value_exception(value&& val):
-			value_(std::move(val))
+		bool is_exception() const
 		{
+			validate();
+			return JS_IsError(ctx_, val_);
 		}
 		
-		template <typename T>
-		value_exception(T val):
-			exception(val)
+		bool is_function() const
 		{
+			validate();
+			return JS_IsFunction(ctx_, val_);
 		}
 		
-		value_exception(const cstring& val):
-			exception(val.str())
+		bool is_number() const
 		{
+			validate();
+			return JS_IsNumber(val_);
 		}
 		
-	public:
-		value val() const
+		bool is_object() const
 		{
-			return value_;
+			validate();
+			return JS_IsObject(val_);
 		}
-	};
-	
-	template <typename ClassType>
-	class class_def
-	{
-		friend class runtime;
-		friend class context;
-		friend class detail::classes;
-		friend class detail::members;
-		
-		JSClassID id{0};
-		const char* name{nullptr};
-		int ctor_argc{0};
-		std::vector<JSCFunctionListEntry> members;
 		
-		class_def(size_t mem_cnt):
-			members(mem_cnt)
+		bool is_string() const
 		{
+			validate();
+			return JS_IsString(val_);
 		}
-	};
-	
-	template <typename ClassType>
-	class class_def_shared
-	{
-		friend class runtime;
-		friend class context;
-		friend class detail::classes;
-		friend class detail::members;
-		
-		JSClassID id{0};
-		const char* name{nullptr};
-		int ctor_argc{0};
-		std::vector<JSCFunctionListEntry> members;
 		
-		class_def_shared(size_t mem_cnt):
-			members(mem_cnt)
+		bool is_bool() const
 		{
+			validate();
+			return JS_IsBool(val_);
 		}
-	};
-	
-	class context:
-		private detail::list_entry
-	{
-		friend class runtime;
-		friend class value;
-		friend class detail::owner<context>;
-		friend class detail::classes;
-		friend class detail::closures_common;
-		friend class detail::functions;
 		
-		class call_level
+		bool as_bool() const
 		{
-		public:
-			typedef unsigned int val_type;
-			
-			call_level(val_type& val):
-				val_(val)
-			{
-				val_++;
-				assert(val_ != 0);
-			}
-			
-			~call_level()
-			{
-				assert(val_ > 0);
-				val_--;
-			}
-			
-		private:
-			val_type& val_;
-		};
+			validate();
+			bool ret = false;
+			if (!as_bool(ret))
+				throw_value_exception("not a bool value");
+			return ret;
+		}
 		
-		struct class_info
+		bool as_bool(bool& val) const
 		{
-			JSValue ctor;
-			JSValue proto;
-			
-			class_info() = delete;
-			class_info(const class_info&) = delete;
-			class_info(class_info&&) = delete;
-			class_info& operator=(const class_info&) = delete;
-			class_info& operator=(class_info&&) = delete;
-			
-			class_info(JSValue ctor, JSValue proto):
-				ctor(ctor),
-				proto(proto)
+			if (!valid())
 			{
-				assert(!JS_IsUndefined(ctor));
-				assert(!JS_IsUndefined(proto));
+				val = false;
+				return false;
 			}
-			
-			~class_info()
+			int ret = JS_ToBool(ctx_, val_);
+			if (ret < 0)
 			{
-				assert(JS_IsUndefined(ctor));
-				assert(JS_IsUndefined(proto));
+				val = false;
+				return false;
 			}
 			
-			void cleanup(JSContext* ctx)
-			{
-				JS_FreeValue(ctx, ctor);
-				JS_FreeValue(ctx, proto);
-				ctor = JS_UNDEFINED;
-				proto = JS_UNDEFINED;
-			}
-		};
-		
-		std::unique_ptr<JSContext, decltype(&JS_FreeContext)> ctx_{nullptr, nullptr};
-		runtime* owner_{nullptr};
-		call_level::val_type clevel_{0};
-		detail::owner<value> values_;
-		std::exception_ptr excpt_;
-		std::map<JSClassID, std::unique_ptr<class_info>> classes_;
+			val = (ret != 0);
+			return true;
+		}
 		
-		void cleanup_classes()
+		double as_double() const
 		{
-			auto ctx = ctx_.get();
-			for (auto const& it : classes_)
-				it.second->cleanup(ctx);
+			validate();
+			double ret = 0;
+			if (!as_double(ret))
+				throw_value_exception("not a double value");
+			return ret;
 		}
 		
-		const class_info& get_class_info(JSClassID id) const
+		bool as_double(double& val) const
 		{
-			auto it = classes_.find(id);
-			if (it == classes_.end())
-				throw exception("class not registered");
-			return *it->second.get();
+			if (!valid() || JS_ToFloat64(ctx_, &val, val_) < 0)
+			{
+				val = 0.0;
+				return false;
+			}
+			return true;
 		}
 		
-		context(runtime* own, JSRuntime* rt):
-			ctx_(JS_NewContext(rt), &JS_FreeContext),
-			owner_(own)
+		int32_t as_int32() const
 		{
-			QJSCPP_DEBUG("context @" << (void*)this);
-			JS_SetContextOpaque(ctx_.get(), this);
-			track();
+			validate();
+			int32_t ret = 0;
+			if (!as_int32(ret))
+				throw_value_exception("not a int32 value");
+			return ret;
 		}
 		
-		void store_exception(std::exception_ptr excpt)
+		bool as_int32(int32_t& val) const
 		{
-			assert(!excpt_);
-			excpt_ = excpt;
+			if (!valid() || JS_ToInt32(ctx_, &val, val_) < 0)
+			{
+				val = 0;
+				return false;
+			}
+			return true;
 		}
 		
-		std::exception_ptr pop_exception()
+		uint32_t as_uint32() const
 		{
-			auto ret = excpt_;
-			excpt_ = nullptr;
+			validate();
+			uint32_t ret = 0;
+			if (!as_uint32(ret))
+				throw_value_exception("not a uint32 value");
 			return ret;
 		}
 		
-		
-		void track();
-		void track(context& from);
-		void untrack();
-		
-		void abandon()
+		bool as_uint32(uint32_t& val) const
 		{
-			QJSCPP_DEBUG("context @" << (void*)this << " abandoned, delete ctx: " << (ctx_ ? "yes" : "no"));
-			if (ctx_)
-			{
-				cleanup_classes();
-				JS_SetContextOpaque(ctx_.get(), nullptr);
-				ctx_.reset();
-			}
-			if (owner_)
+			if (!valid() || JS_ToUint32(ctx_, &val, val_) < 0)
 			{
-				unlink();
-				owner_ = nullptr;
+				val = 0;
+				return false;
 			}
+			return true;
 		}
 		
-		inline void validate() const
+		int64_t as_int64() const
 		{
-			if (!valid())
-				throw invalid_context();
+			validate();
+			int64_t ret = 0;
+			if (!as_int64(ret))
+				throw_value_exception("not a int64 value");
+			return ret;
 		}
 		
-	public:
-		context() = default;
-		context& operator=(const context&) = delete;
+		bool as_int64(int64_t& val) const
+		{
+			if (!valid() || JS_ToInt64(ctx_, &val, val_) < 0)
+			{
+				val = 0;
+				return false;
+			}
+			return true;
+		}
 		
-		context(context&& from):
-			ctx_(std::move(from.ctx_)),
-			owner_(from.owner_)
+		std::string as_string() const
 		{
-			QJSCPP_DEBUG("context @" << (void*)this << " <- @" << (void*)&from);
-			JS_SetContextOpaque(ctx_.get(), this);
-			track(from);
+			validate();
+			std::string ret;
+			if (!as_string(ret))
+				throw_value_exception("not a string value");
+			return ret;
 		}
 		
-		context& operator=(context&& from)
+		bool as_string(std::string& val) const
 		{
-			if (&from != this)
+			if (valid())
 			{
-				QJSCPP_DEBUG("context @" << (void*)this << " <= @" << (void*)&from);
-				ctx_ = std::move(from.ctx_);
-				JS_SetContextOpaque(ctx_.get(), this);
-				track(from);
+				if (auto cstr = as_cstring())
+				{
+					val = cstr.str();
+					return true;
+				}
 			}
-			return *this;
+			
+			return false;
 		}
 		
-		virtual ~context()
+		template <typename T>
+		span<T> as_span() const
 		{
-			QJSCPP_DEBUG("~context @" << (void*)this);
-			values_.for_each(
-				[](value* val)
-				{
-					val->abandon();
-				});
-			untrack();
-			if (ctx_)
+			validate();
+			span<T> ret;
+			if (!as_span(ret))
+				throw_value_exception("not a matching ArrayBuffer or typed array");
+			return ret;
+		}
+		
+		template <typename T>
+		bool as_span(span<T>& val) const
+		{
+			if (!valid())
 			{
-				cleanup_classes();
-				JS_SetContextOpaque(ctx_.get(), nullptr);
+				val = span<T>();
+				return false;
 			}
+			return detail::get_span(ctx_, val_, val);
 		}
 		
-		runtime& get_runtime() const
+		span<uint8_t> as_bytes() const
 		{
-			if (!ctx_)
-				throw invalid_context();
-			return *reinterpret_cast<runtime*>(JS_GetRuntimeOpaque(JS_GetRuntime(ctx_.get())));
+			return as_span<uint8_t>();
 		}
 		
-		bool valid() const
+		bool as_bytes(span<uint8_t>& val) const
 		{
-			return owner_ != nullptr && ctx_;
+			return as_span(val);
 		}
 		
-		operator JSContext*() const
+		template <typename T>
+		T as() const
 		{
 			validate();
-			return ctx_.get();
+			T ret;
+			if (!as(ret))
+				throw_value_exception("conversion failed");
+			return ret;
 		}
 		
-		enum class eval_flags
-		{
-			global,
-			module,
-			autodetect
-		};
-		
-		value get_global_object() const
+		template <typename T>
+		bool as(T& val) const
 		{
-			validate();
-			auto ctx = ctx_.get();
-			return value(ctx, JS_GetGlobalObject(ctx));
+			return valid() && detail::js_traits<T>::unwrap(ctx_, val_, val);
 		}
 		
-		value eval(const char* str, eval_flags flags = eval_flags::autodetect)
+		context& get_context() const
 		{
-			return eval(str, ::strlen(str), flags);
+			validate();
+			return *reinterpret_cast<context*>(JS_GetContextOpaque(ctx_));
 		}
 		
-		value eval(const char* buf, size_t len, eval_flags flags = eval_flags::autodetect, const char* filename = nullptr)
+		cstring as_cstring() const
 		{
 			validate();
-			
-			int eval_flags;
-			switch (flags)
-			{
-				case eval_flags::global:
-					eval_flags = JS_EVAL_TYPE_GLOBAL;
-					break;
-				case eval_flags::module:
-					eval_flags = JS_EVAL_TYPE_MODULE;
-					break;
-				case eval_flags::autodetect:
-					eval_flags = JS_DetectModule(buf, len) ? JS_EVAL_TYPE_MODULE : JS_EVAL_TYPE_GLOBAL;
-					break;
-			}
-			
-			auto ctx = ctx_.get();
-			value ret(ctx, JS_Eval(ctx, buf, len, (filename && filename[0]) ? filename : "(none)", eval_flags));
-			ret.check_throw(true);
-			return ret;
+			return cstring(ctx_, val_);
 		}
 		
-		template <typename... Args>
-		value call_global(const char* name, Args&&... args)
+		value get_property(const char* name) const
 		{
 			validate();
-			
-			return get_global_object().get_property(name)(value::undefined(ctx_.get()), std::forward<Args>(args) ...);
+			return value(ctx_, JS_GetPropertyStr(ctx_, val_, name));
 		}
 		
-		template <typename... Args>
-		value call_global(const std::string& name, Args&&... args)
+		value get_property(const std::string& name) const
 		{
-			return call_global(name.c_str(), std::forward<Args>(args)...);
+			return get_property(name.c_str());
 		}
 		
-		template <typename ClassType>
-		void register_class()
+		value get_property(const atom& name) const
 		{
 			validate();
-			
-			assert(ClassType::class_definition.id != 0);
-			
-			auto ctx = ctx_.get();
-			auto rt = JS_GetRuntime(ctx_.get());
-			if (!JS_IsRegisteredClass(rt, ClassType::class_definition.id))
-			{
-				JSClassDef cdef{
-					.class_name = ClassType::class_definition.name,
-					.finalizer = detail::classes::finalizer<ClassType>,
-					.gc_mark = detail::classes::gc_mark<ClassType>
-				};
-				if (JS_NewClass(rt, ClassType::class_definition.id, &cdef) < 0)
-					throw exception("failed to register class");
-			}
-			
-			QJSCPP_DEBUG("Registering class '" << ClassType::class_definition.name << "' with id: " << ClassType::class_definition.id);
-			
-			value proto(ctx, JS_NewObject(ctx));
-			if (!ClassType::class_definition.members.empty())
-				JS_SetPropertyFunctionList(ctx, proto.val_, &ClassType::class_definition.members[0], ClassType::class_definition.members.size());
-			JS_SetClassProto(ctx, ClassType::class_definition.id, proto.val_);
-			value ctor(ctx, JS_NewCFunction2(ctx, detail::classes::ctor<ClassType>, ClassType::class_definition.name, ClassType::class_definition.ctor_argc, JS_CFUNC_constructor, 0));
-			if (!ctor.valid() || ctor.is_exception())
-				throw exception("failed to create class constructor");
-			JS_SetConstructor(ctx, ctor.val_, value(ctx, proto.val_, true).steal());
-			get_global_object().set_property(ClassType::class_definition.name, ctor); // TODO: is this the right way?
-			classes_.insert(std::make_pair(ClassType::class_definition.id, new class_info(ctor.steal(), proto.steal())));
+			name.validate_for(ctx_);
+			return value(ctx_, JS_GetProperty(ctx_, val_, name.atom_));
 		}
 		
-		template <typename ClassType, typename InstanceType>
-		value make_object(const std::vector<value>& args, InstanceType& inst) const
+		value get_index(uint32_t idx) const
 		{
 			validate();
-			
-			auto const& info = get_class_info(ClassType::class_definition.id);
-			
-			std::vector<JSValue> a(args.size());
-			for (size_t i = 0; i < args.size(); i++)
-				a[i] = args[i].val_;
-			
-			auto ctx = ctx_.get();
-			value ret(ctx, JS_CallConstructor(ctx, info.ctor, a.size(), !a.empty() ? &a[0] : nullptr));
-			ret.check_throw(true);
-			if (ret.valid() && !ret.is_exception())
-				inst = detail::classes::get_inst<ClassType>(ret.val_);
-			else
-				inst = {};
-			return ret;
+			return value(ctx_, JS_GetPropertyUint32(ctx_, val_, idx));
 		}
 	};
 	
-	template <typename ClassType>
-	class object
+	inline value::value(const value_ref& ref)
 	{
-		friend class detail::members;
-		
-		JSCFunctionListEntry entry_;
-		
-		object(JSCFunctionListEntry&& entry):
-			entry_(std::move(entry))
+		QJSCPP_DEBUG("value(const value_ref&) @" << (void*)this);
+		if (ref.ctx_)
 		{
+			ctx_ = ref.ctx_;
+			val_ = JS_DupValue(ctx_, ref.val_);
+			track();
 		}
+	}
+	
+	/**
+	 * The arguments passed to a closure, member function or constructor.
+	 * 
+	 * The arguments aren't copied, a value is only created (and tracked) when
+	 * an argument is accessed. Up to inline_capacity of them are stored within
+	 * the args object itself, so calls with few arguments don't allocate.
+	 * 
+	 * args is only valid during the call and can't be copied. Use to_vector()
+	 * (or convert to std::vector<value>) to keep the arguments.
+	 */
+	class args
+	{
+		friend class value;
+		friend class detail::classes;
+		friend class detail::closures_common;
+		friend class context;
 		
-	public:
-		template <value(ClassType::*Func)(const quickjs::args&)>
-		static object function(const char* name, uint8_t nargs = 0)
+		enum { inline_capacity = 4 };
+		
+		JSContext* ctx_;
+		JSValueConst this_obj_;
+		JSValueConst* argv_;
+		size_t argc_;
+		size_t size_;
+		mutable value this_;
+		mutable value inline_[inline_capacity];
+		mutable std::vector<value> overflow_;
+		
+		args(JSContext* ctx, size_t N, JSValueConst this_obj, size_t argc, JSValueConst* argv):
+			ctx_(ctx),
+			this_obj_(this_obj),
+			argv_(argv),
+			argc_(argc),
+			size_((N > argc) ? N : argc)
 		{
-			auto func = detail::classes::invoke_member<ClassType, Func>;
-			return object(JSCFunctionListEntry(JS_CFUNC_DEF(name, nargs, func)));
 		}
 		
-		template <value(ClassType::*Getter)(const quickjs::value&), void(ClassType::*Setter)(const quickjs::value&, const quickjs::value&)>
-		static object getset(const char* name)
+		JSValueConst raw(size_t i) const
 		{
-			auto getter = detail::classes::invoke_getter<ClassType, Getter>;
-			auto setter = detail::classes::invoke_setter<ClassType, Setter>;
-			return object(JSCFunctionListEntry(JS_CGETSET_DEF(name, getter, setter)));
+			return i < argc_ ? argv_[i] : JS_UNDEFINED;
 		}
 		
-		template <value(ClassType::*Getter)(const quickjs::value&)>
-		static object get_only(const char* name)
+		value& slot(size_t i) const
 		{
-			auto getter = detail::classes::invoke_getter<ClassType, Getter>;
-			auto setter =
-				[](JSContext *ctx, JSValueConst /*this_val*/, JSValueConst /*val*/) -> JSValue
-				{
-					return JS_ThrowTypeError(ctx, "property is read-only");
-				};
-			return object(JSCFunctionListEntry(JS_CGETSET_DEF(name, getter, setter)));
+			if (i < inline_capacity)
+				return inline_[i];
+			if (overflow_.empty())
+				overflow_.resize(size_ - inline_capacity);
+			return overflow_[i - inline_capacity];
 		}
 		
-		template <void(ClassType::*Setter)(const quickjs::value&, const quickjs::value&)>
-		static object set_only(const char* name)
+	public:
+		class const_iterator
 		{
-			auto getter =
-				[](JSContext *ctx, JSValueConst /*this_val*/) -> JSValue
-				{
-					return JS_ThrowTypeError(ctx, "property is write-only");
-				};
-			auto setter = detail::classes::invoke_setter<ClassType, Setter>;
-			return object(JSCFunctionListEntry(JS_CGETSET_DEF(name, getter, setter)));
-		}
-	};
-	
-	namespace detail
-	{
-		template <typename MemberType>
-		inline void members::add_function_list_entry(JSCFunctionListEntry* entries, size_t& idx, MemberType member)
-		{
-			entries[idx++] = member.entry_;
-		}
-		
-		template <typename ClassType, typename ClassDefType, typename... Args>
-		inline void members::create_class_def(ClassDefType& cdef, const char* name, int ctor_argc, Args&&... args)
-		{
-			JS_NewClassID(&cdef.id);
-			cdef.name = name;
-			cdef.ctor_argc = ctor_argc;
+			friend class args;
 			
-			if (sizeof...(args) > 0)
+			const args* args_{nullptr};
+			size_t idx_{0};
+			
+			const_iterator(const args* a, size_t idx):
+				args_(a),
+				idx_(idx)
 			{
-				size_t ecnt = 0;
-				
-				// C++17 has fold expressions...
-				__attribute__((unused)) int dummy[] = {{0}, ((void)members::add_function_list_entry(&cdef.members[0], ecnt, std::forward<Args>(args)), 0)... };
-				assert(ecnt == sizeof...(args));
 			}
-		}
-	}
-	
-	class runtime
-	{
-		friend class context;
-		friend class value;
-		friend class detail::classes;
 		
-		JSMallocFunctions mf_{
-			[](JSMallocState *s, size_t size) -> void*
+		public:
+			typedef std::random_access_iterator_tag iterator_category;
+			typedef value value_type;
+			typedef std::ptrdiff_t difference_type;
+			typedef const value* pointer;
+			typedef const value& reference;
+			
+			const_iterator() = default;
+			
+			reference operator*() const
 			{
-				return reinterpret_cast<runtime*>(s->opaque)->js_malloc(s, size);
-			},
-			[](JSMallocState *s, void *ptr)
+				return (*args_)[idx_];
+			}
+			
+			pointer operator->() const
 			{
-				reinterpret_cast<runtime*>(s->opaque)->js_free(s, ptr);
-			},
-			[](JSMallocState *s, void *ptr, size_t size) -> void*
+				return &(*args_)[idx_];
+			}
+			
+			reference operator[](difference_type n) const
 			{
-				return reinterpret_cast<runtime*>(s->opaque)->js_realloc(s, ptr, size);
-			},
-			nullptr
-		};
-		std::unique_ptr<JSRuntime, decltype(&JS_FreeRuntime)> rt_;
-		detail::owner<context> contexts_;
-		
-		struct inst_ref
-		{
-			size_t refs_{0};
-			JSValue weak_val_;
+				return (*args_)[idx_ + n];
+			}
 			
-			inst_ref() = delete;
+			const_iterator& operator++()
+			{
+				idx_++;
+				return *this;
+			}
 			
-			inst_ref(JSValue weak_val):
-				weak_val_(weak_val)
+			const_iterator operator++(int)
 			{
+				const_iterator ret(*this);
+				idx_++;
+				return ret;
 			}
 			
-			inst_ref(inst_ref&&) = default;
-			inst_ref& operator=(inst_ref&&) = default;
+			const_iterator& operator--()
+			{
+				idx_--;
+				return *this;
+			}
 			
-			inst_ref(const inst_ref&) = delete;
-			inst_ref& operator=(const inst_ref&) = delete;
+			const_iterator operator--(int)
+			{
+				const_iterator ret(*this);
+				idx_--;
+				return ret;
+			}
 			
-			inline void ref()
+			const_iterator& operator+=(difference_type n)
 			{
-				refs_++;
+				idx_ += n;
+				return *this;
 			}
 			
-			inline bool unref()
+			const_iterator& operator-=(difference_type n)
 			{
-				return --refs_ == 0;
+				idx_ -= n;
+				return *this;
+			}
+			
+			const_iterator operator+(difference_type n) const
+			{
+				return const_iterator(args_, idx_ + n);
+			}
+			
+			const_iterator operator-(difference_type n) const
+			{
+				return const_iterator(args_, idx_ - n);
+			}
+			
+			difference_type operator-(const const_iterator& other) const
+			{
+				return static_cast<difference_type>(idx_) - static_cast<difference_type>(other.idx_);
+			}
+			
+			bool operator==(const const_iterator& other) const
+			{
+				return idx_ == other.idx_;
+			}
+			
+			bool operator!=(const const_iterator& other) const
+			{
+				return idx_ != other.idx_;
+			}
+			
+			bool operator<(const const_iterator& other) const
+			{
+				return idx_ < other.idx_;
+			}
+			
+			bool operator>(const const_iterator& other) const
+			{
+				return idx_ > other.idx_;
+			}
+			
+			bool operator<=(const const_iterator& other) const
+			{
+				return idx_ <= other.idx_;
+			}
+			
+			bool operator>=(const const_iterator& other) const
+			{
+				return idx_ >= other.idx_;
 			}
 		};
-		std::map<void*, inst_ref> weak_object_refs_;
 		
-		inline void ref_inst_value(void* inst, JSValue weak_val)
+		typedef const_iterator iterator;
+		typedef value value_type;
+		typedef size_t size_type;
+		
+		args(const args&) = delete;
+		args& operator=(const args&) = delete;
+		
+		size_t size() const
 		{
-			weak_object_refs_.insert(std::make_pair(inst, inst_ref(weak_val))).first->second.ref();
+			return size_;
 		}
 		
-		inline void unref_inst_value(void* inst)
+		bool empty() const
 		{
-			auto it = weak_object_refs_.find(inst);
-			if (it->second.unref())
-				weak_object_refs_.erase(it);
+			return size_ == 0;
 		}
 		
-		inline bool get_inst_value(JSContext* ctx, void* inst, JSValue& ref) const
+		const value& operator[](size_t i) const
 		{
-			auto it = weak_object_refs_.find(inst);
-			if (it != weak_object_refs_.end())
-			{
-				ref = JS_DupValue(ctx, it->second.weak_val_);
-				return true;
-			}
-			return false;
+			value& val = slot(i);
+			if (!val.valid())
+				val = value(ctx_, raw(i), true);
+			return val;
 		}
-	
-	protected:
-		virtual void* js_malloc(JSMallocState *, size_t size)
+		
+		const value& at(size_t i) const
 		{
-			return ::malloc(size);
+			if (i >= size_)
+				throw std::out_of_range("argument index out of range");
+			return (*this)[i];
 		}
 		
-		virtual void js_free(JSMallocState *, void *ptr)
+		const value& front() const
 		{
-			::free(ptr);
+			return at(0);
 		}
 		
-		virtual void* js_realloc(JSMallocState *, void *ptr, size_t size)
+		const value& back() const
 		{
-			return ::realloc(ptr, size);
+			return at(size_ - 1);
 		}
 		
-	public:
-		runtime(const runtime&) = delete;
-		runtime(runtime&&) = delete;
-		runtime& operator=(const runtime&) = delete;
-		runtime& operator=(runtime&&) = delete;
+		std::vector<value> to_vector() const
+		{
+			return std::vector<value>(begin(), end());
+		}
 		
-		runtime(bool enableMemoryHooks = false):
-			rt_(enableMemoryHooks ? JS_NewRuntime2(&mf_, this) : JS_NewRuntime(), &::JS_FreeRuntime)
+		operator std::vector<value>() const
 		{
-			QJSCPP_DEBUG("runtime @" << (void*)this);
-			JS_SetRuntimeOpaque(rt_.get(), this);
+			return to_vector();
 		}
 		
-		virtual ~runtime()
+		value_ref ref(size_t i) const
 		{
-			QJSCPP_DEBUG("~runtime @" << (void*)this);
-			contexts_.for_each(
-				[](context *ctx)
-				{
-					ctx->abandon();
-				});
-			JS_SetRuntimeOpaque(rt_.get(), nullptr);
+			return value_ref(ctx_, raw(i));
 		}
 		
-		operator JSRuntime*() const { return rt_.get(); }
+		const_iterator begin() const
+		{
+			return const_iterator(this, 0);
+		}
 		
-		context new_context()
+		const_iterator end() const
 		{
-			return context(this, rt_.get());
+			return const_iterator(this, size_);
 		}
 		
-		void run_gc() const
+		context& get_context() const
 		{
-			JS_RunGC(rt_.get());
+			return *reinterpret_cast<context*>(JS_GetContextOpaque(ctx_));
 		}
 		
-		template <typename ClassType, typename... Args>
-		static class_def<ClassType> create_class_def(const char* name, int ctor_argc = 0, Args&&... args)
+		const value& get_this() const
 		{
-			class_def<ClassType> cdef(sizeof...(args));
-			detail::members::create_class_def<ClassType>(cdef,name, ctor_argc, std::forward<Args>(args)...);
-			return cdef;
+			if (!this_.valid())
+				this_ = value(ctx_, this_obj_, true);
+			return this_;
 		}
 		
-		template <typename ClassType, typename... Args>
-		static class_def_shared<ClassType> create_class_def_shared(const char* name, int ctor_argc = 0, Args&&... args)
+		value_ref get_this_ref() const
 		{
-			class_def_shared<ClassType> cdef(sizeof...(args));
-			detail::members::create_class_def<ClassType>(cdef,name, ctor_argc, std::forward<Args>(args)...);
-			return cdef;
+			return value_ref(ctx_, this_obj_);
 		}
 	};
 	
-	inline void value::throw_value_exception(const char* msg) const
-	{
-		throw value_exception(msg);
-	}
-	
-	inline void value::do_throw(value exval)
-	{
-			if (JS_IsError(ctx_, val_))
-			{
-				value stack = exval.get_property("stack");
-				throw value_error(exval.as_cstring(), !stack.is_undefined() ? stack.as_cstring() : cstring());
-			}
-			else
-			{
-				context& c = *reinterpret_cast<context*>(JS_GetContextOpaque(ctx_));
-				if (c.clevel_ > 1)
-				{
-					QJSCPP_DEBUG("do_throw: clevel: " << c.clevel_ << ": throwing internal throw_exception");
-					throw throw_exception(std::move(exval));
-				}
-				else
-				{
-					QJSCPP_DEBUG("do_throw: throwing value_exception");
-					throw value_exception(std::move(exval));
-				}
-			}
-	}
-	
-	inline void value::handle_pending_exception()
+	class throw_exception:
+		public exception
 	{
-		if (auto excpt = get_context().pop_exception())
+		value value_;
+		
+	public:
+		throw_exception()
 		{
-			QJSCPP_DEBUG("value @" << (void*)this << ": rethrow forwarded exception");
-			std::rethrow_exception(excpt);
 		}
-	}
-	
-	inline void value::track()
-	{
-		if (!owner_ && ctx_)
+		
+		throw_exception(value&& val):
+			value_(std::move(val))
 		{
-			owner_ = &get_context();
-			QJSCPP_DEBUG("value track() @" << (void*)this << ": add");
-			owner_->values_.insert_head(*this);
 		}
-	}
+		
+		value val() const
+		{
+			return value_;
+		}
+		
+		virtual const char* what() const noexcept
+		{
+			return "thrown exception";
+		}
+	};
 	
-	inline void value::track(value& from)
+	class value_exception:
+		public exception
 	{
-		if (from.owner_)
+		friend class value;
+		friend class value_ref;
+		friend class runtime_pool;
+		friend class result;
+		
+		value value_;
+		
+		value_exception(value&& val):
+			value_(std::move(val))
 		{
-			QJSCPP_DEBUG("value track(value&) @" << (void*)this << ": abandon: @" << (void*)&from);
-			from.untrack();
-			from.owner_ = nullptr;
 		}
-		if (owner_)
+		
+		template <typename T>
+		value_exception(T val):
+			exception(val)
 		{
-			QJSCPP_DEBUG("value track(value&) @" << (void*)this << ": remove");
-			unlink();
-			owner_ = nullptr;
 		}
-		if (ctx_)
+		
+		value_exception(const cstring& val):
+			exception(val.str())
 		{
-			QJSCPP_DEBUG("value track(value&) @" << (void*)this << ": add");
-			owner_ = &get_context();
-			owner_->values_.insert_head(*this);
 		}
-	}
-	
-	inline void value::untrack()
-	{
-		if (owner_)
+		
+	public:
+		value val() const
+		{
+			return value_;
+		}
+	};
+
+#ifdef QJSCPP_HAS_COROUTINES
+	//
+	// coroutines
+	//
+	
+	namespace detail
+	{
+		struct task_promise_base
+		{
+			std::coroutine_handle<> continuation_;
+			std::function<void()> on_done_; // set when started by task::start()
+			std::exception_ptr exception_;
+			std::shared_ptr<void> keep_alive_; // e.g. the lambda whose captures the coroutine uses
+			
+			struct final_awaiter
+			{
+				bool await_ready() const noexcept
+				{
+					return false;
+				}
+				
+				template <typename Promise>
+				std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept
+				{
+					auto& p = h.promise();
+					if (p.continuation_)
+						return p.continuation_;
+					if (p.on_done_)
+					{
+						p.on_done_();
+						h.destroy();
+					}
+					return std::noop_coroutine();
+				}
+				
+				void await_resume() const noexcept
+				{
+				}
+			};
+			
+			std::suspend_always initial_suspend() const noexcept
+			{
+				return {};
+			}
+			
+			final_awaiter final_suspend() const noexcept
+			{
+				return {};
+			}
+			
+			void unhandled_exception() noexcept
+			{
+				exception_ = std::current_exception();
+			}
+		};
+		
+		template <typename T>
+		struct task_promise:
+			public task_promise_base
+		{
+			std::optional<T> result_;
+			
+			inline task<T> get_return_object() noexcept;
+			
+			template <typename U>
+			void return_value(U&& val)
+			{
+				result_.emplace(std::forward<U>(val));
+			}
+			
+			// Returns the result of the finished coroutine, or rethrows its exception
+			T get()
+			{
+				if (exception_)
+					std::rethrow_exception(exception_);
+				return std::move(*result_);
+			}
+		};
+		
+		template <>
+		struct task_promise<void>:
+			public task_promise_base
+		{
+			inline task<void> get_return_object() noexcept;
+			
+			void return_void() const noexcept
+			{
+			}
+			
+			void get() const
+			{
+				if (exception_)
+					std::rethrow_exception(exception_);
+			}
+		};
+		
+		class promise_awaiter
+		{
+			value promise_;
+			value result_;
+			std::exception_ptr exception_;
+		
+		public:
+			explicit promise_awaiter(const value& promise):
+				promise_(promise)
+			{
+			}
+			
+			bool await_ready() const noexcept
+			{
+				return false;
+			}
+			
+			// The callbacks must not touch the awaiter after resuming, the
+			// coroutine may have finished and destroyed it by then
+			void await_suspend(std::coroutine_handle<> h)
+			{
+				promise_.then(
+					[this, h](const value& result)
+					{
+						result_ = result;
+						h.resume();
+					},
+					[this, h](const value& reason)
+					{
+						exception_ = value::rejection_exception(reason);
+						h.resume();
+					});
+			}
+			
+			value await_resume()
+			{
+				if (exception_)
+					std::rethrow_exception(exception_);
+				return std::move(result_);
+			}
+		};
+		
+		struct coroutines
+		{
+			template <typename T>
+			static void settle(const value& resolve, task_promise<T>& p)
+			{
+				resolve(p.get());
+			}
+			
+			static void settle(const value& resolve, task_promise<void>& p)
+			{
+				p.get();
+				resolve();
+			}
+			
+			// C++ exceptions of a coroutine become the rejection reason of its promise
+			static value rejection_reason(JSContext* ctx, std::exception_ptr excpt)
+			{
+				const char* msg = "unknown exception";
+				try
+				{
+					std::rethrow_exception(excpt);
+				}
+				catch (const throw_exception& e)
+				{
+					return e.val();
+				}
+				catch (const value_exception& e)
+				{
+					value val = e.val();
+					if (val.valid())
+						return val;
+					msg = e.what();
+				}
+				catch (const std::exception& e)
+				{
+					msg = e.what();
+				}
+				catch (...)
+				{
+				}
+				value err(ctx, JS_NewError(ctx));
+				err.check_throw(false);
+				err.set_property("message", msg);
+				return err;
+			}
+		};
+	}
+	
+	/**
+	 * The return type of a coroutine, which may co_await promises (values)
+	 * and other tasks.
+	 * 
+	 * A task is lazy, it doesn't run until it is awaited or started. Returning
+	 * a task from a closure makes it an async function to JS: the task is
+	 * started and a promise is returned that is settled with its result. As
+	 * with any coroutine, only parameters taken by value remain valid after
+	 * the first suspension, i.e. closures must not take const args& or
+	 * const value& parameters if they co_await. The captures of a lambda
+	 * passed as a closure are kept alive by each task it returns; a lambda
+	 * called directly must outlive the tasks it returns.
+	 */
+	template <typename T>
+	class task
+	{
+		friend struct detail::task_promise<T>;
+	
+	public:
+		typedef detail::task_promise<T> promise_type;
+	
+	private:
+		typedef std::coroutine_handle<promise_type> handle;
+		
+		handle h_;
+		
+		explicit task(handle h) noexcept:
+			h_(h)
+		{
+		}
+	
+	public:
+		task(const task&) = delete;
+		task& operator=(const task&) = delete;
+		
+		task(task&& other) noexcept:
+			h_(other.h_)
+		{
+			other.h_ = nullptr;
+		}
+		
+		task& operator=(task&& other) noexcept
+		{
+			if (this != &other)
+			{
+				if (h_)
+					h_.destroy();
+				h_ = other.h_;
+				other.h_ = nullptr;
+			}
+			return *this;
+		}
+		
+		~task()
+		{
+			if (h_)
+				h_.destroy();
+		}
+		
+		bool valid() const noexcept
+		{
+			return !!h_;
+		}
+		
+		bool await_ready() const noexcept
+		{
+			return false;
+		}
+		
+		std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept
+		{
+			h_.promise().continuation_ = awaiting;
+			return h_;
+		}
+		
+		T await_resume()
+		{
+			return h_.promise().get();
+		}
+		
+		/**
+		 * Runs the task without awaiting it, it destroys itself when it has
+		 * finished. done(promise_type&) is then called and may use get() to
+		 * obtain the result or the exception, it must not throw.
+		 */
+		template <typename Done>
+		void start(Done done)
+		{
+			handle h = h_;
+			h_ = nullptr;
+			h.promise().on_done_ =
+				[h, done]() mutable
+				{
+					done(h.promise());
+				};
+			h.resume();
+		}
+		
+		void start()
+		{
+			start([](promise_type&) {});
+		}
+		
+		/**
+		 * Keeps owner alive until the coroutine frame is destroyed.
+		 */
+		void keep_alive(std::shared_ptr<void> owner)
+		{
+			h_.promise().keep_alive_ = std::move(owner);
+		}
+	};
+	
+	namespace detail
+	{
+		template <typename T>
+		inline task<T> task_promise<T>::get_return_object() noexcept
+		{
+			return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+		}
+		
+		inline task<void> task_promise<void>::get_return_object() noexcept
+		{
+			return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+		}
+	}
+	
+	template <typename T>
+	value::value(JSContext* ctx, task<T> t):
+		ctx_(ctx)
+	{
+		QJSCPP_DEBUG("value(JSContext*, [task]) @" << (void*)this);
+		validate();
+		
+		JSValue funcs[2];
+		val_ = JS_NewPromiseCapability(ctx_, funcs);
+		check_throw(false);
+		
+		track();
+		
+		value resolve(ctx_, funcs[0]);
+		value reject(ctx_, funcs[1]);
+		t.start(
+			[resolve, reject](typename task<T>::promise_type& p)
+			{
+				try
+				{
+					detail::coroutines::settle(resolve, p);
+				}
+				catch (...)
+				{
+					try
+					{
+						reject(detail::coroutines::rejection_reason(reject.ctx_, std::current_exception()));
+					}
+					catch (...)
+					{
+						// Nothing is left to report it to
+					}
+				}
+			});
+	}
+	
+	inline detail::promise_awaiter value::operator co_await() const
+	{
+		validate();
+		return detail::promise_awaiter(*this);
+	}
+#endif
+	
+	template <typename ClassType>
+	class class_def
+	{
+		friend class runtime;
+		friend class context;
+		friend class detail::classes;
+		friend class detail::members;
+		
+		JSClassID id{0};
+		const char* name{nullptr};
+		int ctor_argc{0};
+		std::vector<JSCFunctionListEntry> members;
+		
+		class_def(size_t mem_cnt):
+			members(mem_cnt)
+		{
+		}
+	};
+	
+	template <typename ClassType>
+	class class_def_shared
+	{
+		friend class runtime;
+		friend class context;
+		friend class detail::classes;
+		friend class detail::members;
+		
+		JSClassID id{0};
+		const char* name{nullptr};
+		int ctor_argc{0};
+		std::vector<JSCFunctionListEntry> members;
+		
+		class_def_shared(size_t mem_cnt):
+			members(mem_cnt)
+		{
+		}
+	};
+	
+	namespace detail
+	{
+		template <typename StructType, typename MemberType>
+		struct struct_member
+		{
+			const char* name;
+			MemberType StructType::* member;
+		};
+		
+		struct structs;
+	}
+	
+	// Describes a struct as a list of fields, which are converted to and
+	// from plain JS objects. See runtime::create_struct_def()
+	template <typename StructType>
+	class struct_def
+	{
+		friend class runtime;
+		friend class context;
+		friend struct detail::structs;
+		
+		typedef bool (*wrap_func)(JSContext* ctx, const void* fields, const JSAtom* atoms, JSValueConst obj, const StructType& val);
+		typedef bool (*unwrap_func)(JSContext* ctx, const void* fields, const JSAtom* atoms, JSValueConst obj, StructType& out);
+		
+		uint32_t id{0};
+		std::vector<const char*> names;
+		std::shared_ptr<const void> fields; // std::tuple of detail::struct_member
+		wrap_func wrap_fields{nullptr};
+		unwrap_func unwrap_fields{nullptr};
+		
+		struct_def() = default;
+	
+	public:
+		struct_def(struct_def&&) = default;
+		struct_def& operator=(struct_def&&) = default;
+		
+		size_t size() const
+		{
+			return names.size();
+		}
+	};
+	
+	template <typename StructType, typename MemberType>
+	inline detail::struct_member<StructType, MemberType> field(const char* name, MemberType StructType::* member)
+	{
+		return detail::struct_member<StructType, MemberType>{name, member};
+	}
+	
+	namespace detail
+	{
+		inline bool conversion_failed(JSContext* ctx);
+		
+		// Values are converted into a temporary first, so a failed conversion
+		// leaves the destination as it was. Structs start out as a copy, since
+		// fields missing from the JS object keep their value.
+		template <typename T>
+		inline typename std::enable_if<is_struct<T>::value || !std::is_default_constructible<T>::value, T>::type unwrap_init(const T& current)
+		{
+			return current;
+		}
+		
+		template <typename T>
+		inline typename std::enable_if<!is_struct<T>::value && std::is_default_constructible<T>::value, T>::type unwrap_init(const T&)
+		{
+			return T();
+		}
+		
+		// The conversions of all fields, expanded at compile time over the
+		// tuple of members. Only the struct_def itself is type-erased.
+		template <typename StructType, typename... Members>
+		struct struct_fields
+		{
+			typedef std::tuple<Members...> tuple_type;
+			
+			template <typename MemberType>
+			static bool wrap_field(JSContext* ctx, JSValueConst obj, JSAtom atom, const MemberType& val)
+			{
+				// Defining doesn't look for setters on the prototype chain like
+				// JS_SetProperty does, and the object is known to be extensible
+				JSValue v = js_traits<MemberType>::wrap(ctx, val);
+				return !JS_IsException(v) && JS_DefinePropertyValue(ctx, obj, atom, v, JS_PROP_C_W_E) >= 0;
+			}
+			
+			// Missing (undefined) fields leave the member untouched
+			template <typename MemberType>
+			static bool unwrap_field(JSContext* ctx, JSValueConst obj, JSAtom atom, MemberType& out)
+			{
+				JSValue v = JS_GetProperty(ctx, obj, atom);
+				if (JS_IsException(v))
+					return conversion_failed(ctx);
+				if (JS_IsUndefined(v))
+					return true;
+				MemberType tmp(unwrap_init(out));
+				bool ok = js_traits<MemberType>::unwrap(ctx, v, tmp);
+				JS_FreeValue(ctx, v);
+				if (ok)
+					out = std::move(tmp);
+				return ok;
+			}
+			
+			template <size_t... Is>
+			static bool wrap_all(JSContext* ctx, const tuple_type& fields, const JSAtom* atoms, JSValueConst obj, const StructType& val, indices<Is...>)
+			{
+				bool ok = true;
+				QJSCPP_EXPAND((ok = ok && wrap_field(ctx, obj, atoms[Is], val.*std::get<Is>(fields).member)));
+				return ok;
+			}
+			
+			template <size_t... Is>
+			static bool unwrap_all(JSContext* ctx, const tuple_type& fields, const JSAtom* atoms, JSValueConst obj, StructType& out, indices<Is...>)
+			{
+				bool ok = true;
+				QJSCPP_EXPAND((ok = ok && unwrap_field(ctx, obj, atoms[Is], out.*std::get<Is>(fields).member)));
+				return ok;
+			}
+			
+			static bool wrap(JSContext* ctx, const void* fields, const JSAtom* atoms, JSValueConst obj, const StructType& val)
+			{
+				return wrap_all(ctx, *static_cast<const tuple_type*>(fields), atoms, obj, val, typename make_indices<sizeof...(Members)>::type());
+			}
+			
+			static bool unwrap(JSContext* ctx, const void* fields, const JSAtom* atoms, JSValueConst obj, StructType& out)
+			{
+				return unwrap_all(ctx, *static_cast<const tuple_type*>(fields), atoms, obj, out, typename make_indices<sizeof...(Members)>::type());
+			}
+		};
+		
+		struct structs
+		{
+			inline static uint32_t next_id();
+			
+			template <typename StructType, typename... Members>
+			static void create_struct_def(struct_def<StructType>& sdef, Members&&... fields)
+			{
+				typedef struct_fields<StructType, typename std::decay<Members>::type...> fields_type;
+				
+				sdef.id = next_id();
+				sdef.names = std::vector<const char*>{ fields.name... };
+				sdef.fields = std::make_shared<typename fields_type::tuple_type>(std::forward<Members>(fields)...);
+				sdef.wrap_fields = &fields_type::wrap;
+				sdef.unwrap_fields = &fields_type::unwrap;
+			}
+			
+			template <typename StructType, typename... Members>
+			static struct_def<StructType> make_struct_def(Members&&... fields)
+			{
+				struct_def<StructType> sdef;
+				create_struct_def(sdef, std::forward<Members>(fields)...);
+				return sdef;
+			}
+			
+			template <typename StructType>
+			static const JSAtom* get_atoms(JSContext* ctx, const struct_def<StructType>& sdef);
+			
+			template <typename StructType>
+			static JSValue wrap(JSContext* ctx, const StructType& val);
+			
+			template <typename StructType>
+			static bool unwrap(JSContext* ctx, JSValueConst val, StructType& out);
+		};
+	}
+	
+	// Like runtime::create_struct_def(), with the struct type taken from the fields
+	template <typename StructType, typename MemberType, typename... Fields>
+	inline struct_def<StructType> make_struct_def(detail::struct_member<StructType, MemberType> first, Fields&&... fields)
+	{
+		return detail::structs::make_struct_def<StructType>(std::move(first), std::forward<Fields>(fields)...);
+	}
+	
+	namespace detail
+	{
+		// FNV-1a
+		inline uint64_t hash_bytes(const void* data, size_t len, uint64_t hash = 14695981039346656037ULL)
+		{
+			auto p = reinterpret_cast<const unsigned char*>(data);
+			for (size_t i = 0; i < len; i++)
+			{
+				hash ^= p[i];
+				hash *= 1099511628211ULL;
+			}
+			return hash;
+		}
+		
+		// Open addressing hash map keyed by non-null pointers. Collisions are
+		// resolved by linear probing, and erasing shifts the following entries
+		// back, so lookups never have to skip over tombstones.
+		template <typename T>
+		class pointer_map
+		{
+			struct slot
+			{
+				const void* key{nullptr};
+				T val;
+			};
+			
+			enum : size_t
+			{
+				min_capacity = 16
+			};
+			
+			std::vector<slot> slots_;
+			size_t size_{0};
+			
+			inline size_t mask() const
+			{
+				return slots_.size() - 1;
+			}
+			
+			// splitmix64 finalizer, pointers have too few random low bits
+			static inline size_t hash(const void* key)
+			{
+				uint64_t h = static_cast<uint64_t>(reinterpret_cast<uintptr_t>(key));
+				h ^= h >> 30;
+				h *= 0xbf58476d1ce4e5b9ULL;
+				h ^= h >> 27;
+				h *= 0x94d049bb133111ebULL;
+				h ^= h >> 31;
+				return static_cast<size_t>(h);
+			}
+			
+			size_t find_slot(const void* key) const
+			{
+				if (slots_.empty())
+					return (size_t)-1;
+				for (size_t i = hash(key) & mask();; i = (i + 1) & mask())
+				{
+					if (slots_[i].key == key)
+						return i;
+					if (!slots_[i].key)
+						return (size_t)-1;
+				}
+			}
+			
+			void rehash(size_t capacity)
+			{
+				std::vector<slot> old(capacity);
+				old.swap(slots_);
+				for (auto& s : old)
+				{
+					if (!s.key)
+						continue;
+					size_t i = hash(s.key) & mask();
+					while (slots_[i].key)
+						i = (i + 1) & mask();
+					slots_[i] = std::move(s);
+				}
+			}
+		
+		public:
+			size_t size() const
+			{
+				return size_;
+			}
+			
+			bool empty() const
+			{
+				return size_ == 0;
+			}
+			
+			T* find(const void* key)
+			{
+				size_t i = find_slot(key);
+				return i != (size_t)-1 ? &slots_[i].val : nullptr;
+			}
+			
+			const T* find(const void* key) const
+			{
+				size_t i = find_slot(key);
+				return i != (size_t)-1 ? &slots_[i].val : nullptr;
+			}
+			
+			template <typename Func>
+			void for_each(Func f) const
+			{
+				for (auto const& s : slots_)
+				{
+					if (s.key)
+						f(s.key, s.val);
+				}
+			}
+			
+			void clear()
+			{
+				slots_.clear();
+				size_ = 0;
+			}
+			
+			// Returns the existing entry if the key is already present
+			std::pair<T*, bool> insert(const void* key, T val)
+			{
+				QJSCPP_ASSERT(key != nullptr);
+				// Keep the load factor at or below 1/2
+				if ((size_ + 1) * 2 > slots_.size())
+					rehash(slots_.empty() ? min_capacity : slots_.size() * 2);
+				
+				size_t i = hash(key) & mask();
+				for (; slots_[i].key; i = (i + 1) & mask())
+				{
+					if (slots_[i].key == key)
+						return std::make_pair(&slots_[i].val, false);
+				}
+				slots_[i].key = key;
+				slots_[i].val = std::move(val);
+				size_++;
+				return std::make_pair(&slots_[i].val, true);
+			}
+			
+			bool erase(const void* key)
+			{
+				size_t i = find_slot(key);
+				if (i == (size_t)-1)
+					return false;
+				
+				for (size_t j = (i + 1) & mask(); slots_[j].key; j = (j + 1) & mask())
+				{
+					// The entry at j can fill the hole at i unless its home slot
+					// lies cyclically in (i, j]
+					size_t home = hash(slots_[j].key) & mask();
+					if (i <= j ? (i < home && home <= j) : (i < home || home <= j))
+						continue;
+					slots_[i] = std::move(slots_[j]);
+					i = j;
+				}
+				slots_[i].key = nullptr;
+				slots_[i].val = T();
+				size_--;
+				return true;
+			}
+		};
+	}
+	
+	class compiled_script
+	{
+		friend class context;
+		
+		std::shared_ptr<const std::vector<uint8_t>> bytecode_;
+	
+	public:
+		compiled_script() = default;
+		
+		compiled_script(std::vector<uint8_t> bytecode):
+			bytecode_(!bytecode.empty() ? std::make_shared<const std::vector<uint8_t>>(std::move(bytecode)) : nullptr)
+		{
+		}
+		
+		compiled_script(const uint8_t* data, size_t len):
+			bytecode_(len ? std::make_shared<const std::vector<uint8_t>>(data, data + len) : nullptr)
+		{
+		}
+		
+		bool valid() const
+		{
+			return bytecode_ != nullptr;
+		}
+		
+		const uint8_t* data() const
+		{
+			return bytecode_ ? bytecode_->data() : nullptr;
+		}
+		
+		size_t size() const
+		{
+			return bytecode_ ? bytecode_->size() : 0;
+		}
+		
+		std::vector<uint8_t> to_bytes() const
+		{
+			return bytecode_ ? *bytecode_ : std::vector<uint8_t>();
+		}
+	};
+	
+	/**
+	 * Bytecode of the scripts evaluated through the runtime, keyed by file
+	 * name, eval flags and source. A hash match is confirmed by comparing the
+	 * source. Holds at most limit() scripts, the least recently used one is
+	 * dropped first.
+	 */
+	class script_cache
+	{
+		typedef std::tuple<std::string, int, uint64_t> key_type;
+		
+		struct entry
+		{
+			std::string source;
+			compiled_script script;
+			std::list<key_type>::iterator lru;
+		};
+		
+		std::map<key_type, entry> scripts_;
+		std::list<key_type> lru_; // most recently used first
+		size_t limit_{default_limit};
+		
+		static key_type make_key(const char* filename, int flags, const char* buf, size_t len)
+		{
+			return key_type(filename ? filename : "", flags, detail::hash_bytes(buf, len, detail::hash_bytes(&len, sizeof(len))));
+		}
+		
+		void trim()
+		{
+			while (scripts_.size() > limit_)
+			{
+				scripts_.erase(lru_.back());
+				lru_.pop_back();
+			}
+		}
+	
+	public:
+		static constexpr size_t default_limit = 1024;
+		
+		bool find(const char* filename, int flags, const char* buf, size_t len, compiled_script& script)
+		{
+			auto it = scripts_.find(make_key(filename, flags, buf, len));
+			if (it == scripts_.end() || it->second.source.size() != len || std::memcmp(it->second.source.data(), buf, len) != 0)
+				return false;
+			lru_.splice(lru_.begin(), lru_, it->second.lru);
+			script = it->second.script;
+			return true;
+		}
+		
+		void insert(const char* filename, int flags, const char* buf, size_t len, const compiled_script& script)
+		{
+			if (limit_ == 0)
+				return;
+			auto key = make_key(filename, flags, buf, len);
+			auto it = scripts_.find(key);
+			if (it == scripts_.end())
+			{
+				lru_.push_front(key);
+				it = scripts_.insert(std::make_pair(key, entry{std::string(), compiled_script(), lru_.begin()})).first;
+			}
+			else
+				lru_.splice(lru_.begin(), lru_, it->second.lru);
+			// On a hash collision the newer script replaces the older one
+			it->second.source.assign(buf, len);
+			it->second.script = script;
+			trim();
+		}
+		
+		size_t size() const
+		{
+			return scripts_.size();
+		}
+		
+		size_t limit() const
+		{
+			return limit_;
+		}
+		
+		void set_limit(size_t limit)
+		{
+			limit_ = limit;
+			trim();
+		}
+		
+		void clear()
+		{
+			scripts_.clear();
+			lru_.clear();
+		}
+	};
+	
+	/**
+	 * A file of precompiled modules, e.g. produced by a build step with
+	 * save(). open() maps the file into memory where possible, so modules
+	 * are loaded from it without reading or parsing any sources, and the
+	 * index is searched in place. The bytecode is only valid for the QuickJS
+	 * version it was compiled with.
+	 */
+	class module_bundle
+	{
+		// All fields are stored in native byte order
+		struct entry
+		{
+			uint64_t name_offset;
+			uint64_t name_size;
+			uint64_t data_offset;
+			uint64_t data_size;
+		};
+		
+		static constexpr uint32_t version_ = 1;
+		static constexpr size_t header_size_ = 16; // magic, version, count
+		
+		std::shared_ptr<const uint8_t> data_; // the mapped file or an owned buffer
+		size_t size_{0};
+		size_t count_{0};
+		
+		entry get_entry(size_t i) const
+		{
+			entry e;
+			std::memcpy(&e, data_.get() + header_size_ + i * sizeof(entry), sizeof(e));
+			return e;
+		}
+		
+		int compare_name(const entry& e, const char* name, size_t len) const
+		{
+			int ret = std::memcmp(data_.get() + e.name_offset, name, std::min<size_t>(e.name_size, len));
+			if (ret == 0 && e.name_size != len)
+				ret = e.name_size < len ? -1 : 1;
+			return ret;
+		}
+		
+		// Checks the header and the bounds of all entries, but not the bytecode
+		void load(std::shared_ptr<const uint8_t> data, size_t size)
+		{
+			uint32_t version;
+			uint64_t count;
+			if (size < header_size_ || std::memcmp(data.get(), "QJSB", 4) != 0)
+				throw exception("invalid module bundle");
+			std::memcpy(&version, data.get() + 4, sizeof(version));
+			std::memcpy(&count, data.get() + 8, sizeof(count));
+			if (version != version_)
+				throw exception("unsupported module bundle version");
+			if (count > (size - header_size_) / sizeof(entry))
+				throw exception("invalid module bundle");
+			
+			data_ = std::move(data);
+			size_ = size;
+			count_ = (size_t)count;
+			for (size_t i = 0; i < count_; i++)
+			{
+				entry e = get_entry(i);
+				if (e.name_offset > size_ || e.name_size > size_ - e.name_offset ||
+					e.data_offset > size_ || e.data_size > size_ - e.data_offset)
+				{
+					data_.reset();
+					size_ = count_ = 0;
+					throw exception("invalid module bundle");
+				}
+			}
+		}
+	
+	public:
+		module_bundle() = default;
+		
+		explicit module_bundle(std::vector<uint8_t> bytes)
+		{
+			auto buf = std::make_shared<const std::vector<uint8_t>>(std::move(bytes));
+			load(std::shared_ptr<const uint8_t>(buf, buf->data()), buf->size());
+		}
+		
+		static module_bundle open(const std::string& path)
+		{
+			module_bundle ret;
+#ifdef QJSCPP_HAS_MMAP
+			int fd = ::open(path.c_str(), O_RDONLY);
+			if (fd < 0)
+				throw exception("cannot open module bundle " + path);
+			struct stat st;
+			void* p = MAP_FAILED;
+			if (::fstat(fd, &st) == 0 && st.st_size > 0)
+				p = ::mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			::close(fd);
+			if (p == MAP_FAILED)
+				throw exception("cannot map module bundle " + path);
+			
+			size_t size = (size_t)st.st_size;
+			std::shared_ptr<const uint8_t> data(static_cast<const uint8_t*>(p),
+				[size](const uint8_t* ptr)
+				{
+					::munmap(const_cast<uint8_t*>(ptr), size);
+				});
+			ret.load(std::move(data), size);
+#else
+			std::unique_ptr<FILE, decltype(&::fclose)> f(::fopen(path.c_str(), "rb"), &::fclose);
+			if (!f)
+				throw exception("cannot open module bundle " + path);
+			std::vector<uint8_t> bytes;
+			uint8_t buf[64 * 1024];
+			size_t n;
+			while ((n = ::fread(buf, 1, sizeof(buf), f.get())) > 0)
+				bytes.insert(bytes.end(), buf, buf + n);
+			ret = module_bundle(std::move(bytes));
+#endif
+			return ret;
+		}
+		
+		bool valid() const
+		{
+			return data_ != nullptr;
+		}
+		
+		// The number of modules
+		size_t size() const
+		{
+			return count_;
+		}
+		
+		std::string name(size_t i) const
+		{
+			entry e = get_entry(i);
+			return std::string(reinterpret_cast<const char*>(data_.get() + e.name_offset), (size_t)e.name_size);
+		}
+		
+		bool find(const char* name, const uint8_t*& data, size_t& size) const
+		{
+			size_t len = ::strlen(name);
+			size_t lo = 0, hi = count_;
+			while (lo < hi)
+			{
+				size_t mid = lo + (hi - lo) / 2;
+				entry e = get_entry(mid);
+				int cmp = compare_name(e, name, len);
+				if (cmp == 0)
+				{
+					data = data_.get() + e.data_offset;
+					size = (size_t)e.data_size;
+					return true;
+				}
+				if (cmp < 0)
+					lo = mid + 1;
+				else
+					hi = mid;
+			}
+			return false;
+		}
+		
+		/**
+		 * Creates the contents of a bundle from (name, compiled_script) pairs,
+		 * e.g. a std::map or runtime::get_module_cache(). The scripts must
+		 * have been compiled as modules, with their name as the file name.
+		 */
+		template <typename Modules>
+		static std::vector<uint8_t> create(const Modules& modules)
+		{
+			std::vector<std::pair<std::string, compiled_script>> sorted(modules.begin(), modules.end());
+			std::sort(sorted.begin(), sorted.end(),
+				[](const std::pair<std::string, compiled_script>& a, const std::pair<std::string, compiled_script>& b)
+				{
+					return a.first < b.first;
+				});
+			
+			uint32_t version = version_;
+			uint64_t count = sorted.size();
+			size_t offset = header_size_ + sorted.size() * sizeof(entry);
+			std::vector<entry> entries;
+			for (auto const& it : sorted)
+			{
+				entry e;
+				e.name_offset = offset;
+				e.name_size = it.first.size();
+				offset += it.first.size();
+				offset = (offset + 7) & ~(size_t)7;
+				e.data_offset = offset;
+				e.data_size = it.second.size();
+				offset += it.second.size();
+				entries.push_back(e);
+			}
+			
+			std::vector<uint8_t> ret(offset, 0);
+			std::memcpy(ret.data(), "QJSB", 4);
+			std::memcpy(ret.data() + 4, &version, sizeof(version));
+			std::memcpy(ret.data() + 8, &count, sizeof(count));
+			for (size_t i = 0; i < entries.size(); i++)
+			{
+				std::memcpy(ret.data() + header_size_ + i * sizeof(entry), &entries[i], sizeof(entry));
+				std::memcpy(ret.data() + entries[i].name_offset, sorted[i].first.data(), sorted[i].first.size());
+				if (sorted[i].second.size())
+					std::memcpy(ret.data() + entries[i].data_offset, sorted[i].second.data(), sorted[i].second.size());
+			}
+			return ret;
+		}
+		
+		template <typename Modules>
+		static void save(const std::string& path, const Modules& modules)
+		{
+			std::vector<uint8_t> bytes = create(modules);
+			std::unique_ptr<FILE, decltype(&::fclose)> f(::fopen(path.c_str(), "wb"), &::fclose);
+			if (!f || ::fwrite(bytes.data(), 1, bytes.size(), f.get()) != bytes.size() || ::fflush(f.get()) != 0)
+				throw exception("cannot write module bundle " + path);
+		}
+	};
+	
+	class context:
+		private detail::list_entry
+	{
+		friend class runtime;
+		friend class value;
+		friend class atom;
+		friend class detail::owner<context>;
+		friend class detail::classes;
+		friend class detail::closures_common;
+		friend class detail::functions;
+		friend struct detail::structs;
+		friend class result;
+		friend class context_pool;
+		
+		class call_level
+		{
+		public:
+			typedef unsigned int val_type;
+			
+			call_level(val_type& val):
+				val_(val)
+			{
+				val_++;
+				QJSCPP_ASSERT(val_ != 0);
+			}
+			
+			~call_level()
+			{
+				QJSCPP_ASSERT(val_ > 0);
+				val_--;
+			}
+			
+		private:
+			val_type& val_;
+		};
+		
+		struct class_info
+		{
+			JSValue ctor;
+			JSValue proto;
+			
+			class_info() = delete;
+			class_info(const class_info&) = delete;
+			class_info(class_info&&) = delete;
+			class_info& operator=(const class_info&) = delete;
+			class_info& operator=(class_info&&) = delete;
+			
+			class_info(JSValue ctor, JSValue proto):
+				ctor(ctor),
+				proto(proto)
+			{
+				QJSCPP_ASSERT(!JS_IsUndefined(ctor));
+				QJSCPP_ASSERT(!JS_IsUndefined(proto));
+			}
+			
+			~class_info()
+			{
+				QJSCPP_ASSERT(JS_IsUndefined(ctor));
+				QJSCPP_ASSERT(JS_IsUndefined(proto));
+			}
+			
+			void cleanup(JSContext* ctx)
+			{
+				JS_FreeValue(ctx, ctor);
+				JS_FreeValue(ctx, proto);
+				ctor = JS_UNDEFINED;
+				proto = JS_UNDEFINED;
+			}
+		};
+		
+		std::unique_ptr<JSContext, decltype(&JS_FreeContext)> ctx_{nullptr, nullptr};
+		runtime* owner_{nullptr};
+		call_level::val_type clevel_{0};
+		call_level::val_type running_{0};
+		size_t global_scripts_{0}; // global (not module) code evaluated, see context_pool
+		std::chrono::steady_clock::time_point deadline_{std::chrono::steady_clock::time_point::max()};
+		detail::owner<value> values_;
+		detail::owner<atom> atoms_;
+		std::exception_ptr excpt_;
+		std::vector<std::unique_ptr<class_info>> classes_; // indexed by JSClassID
+		std::vector<std::vector<JSAtom>> struct_atoms_;
+		
+		void cleanup_classes()
+		{
+			auto ctx = ctx_.get();
+			for (auto const& info : classes_)
+			{
+				if (info)
+					info->cleanup(ctx);
+			}
+		}
+		
+		void cleanup_structs()
+		{
+			auto ctx = ctx_.get();
+			for (auto& atoms : struct_atoms_)
+			{
+				for (auto a : atoms)
+					JS_FreeAtom(ctx, a);
+				atoms.clear();
+			}
+		}
+		
+		const class_info& get_class_info(JSClassID id) const
+		{
+			if (id >= classes_.size() || !classes_[id])
+				throw exception("class not registered");
+			return *classes_[id];
+		}
+		
+		context(runtime* own, JSRuntime* rt):
+			ctx_(JS_NewContext(rt), &JS_FreeContext),
+			owner_(own)
+		{
+			QJSCPP_DEBUG("context @" << (void*)this);
+			JS_SetContextOpaque(ctx_.get(), this);
+			track();
+		}
+		
+		void store_exception(std::exception_ptr excpt)
+		{
+			QJSCPP_ASSERT(!excpt_);
+			excpt_ = excpt;
+		}
+		
+		std::exception_ptr pop_exception()
+		{
+			auto ret = excpt_;
+			excpt_ = nullptr;
+			return ret;
+		}
+		
+		
+		void track();
+		void track(context& from);
+		void untrack();
+		
+		void abandon()
+		{
+			QJSCPP_DEBUG("context @" << (void*)this << " abandoned, delete ctx: " << (ctx_ ? "yes" : "no"));
+			if (ctx_)
+			{
+				cleanup_classes();
+				cleanup_structs();
+				JS_SetContextOpaque(ctx_.get(), nullptr);
+				ctx_.reset();
+			}
+			if (owner_)
+			{
+				unlink();
+				owner_ = nullptr;
+			}
+		}
+		
+		inline void validate() const
+		{
+			if (!valid())
+				throw invalid_context();
+		}
+	
+	public:
+		context() = default;
+		context& operator=(const context&) = delete;
+		
+		context(context&& from):
+			ctx_(std::move(from.ctx_)),
+			owner_(from.owner_),
+			global_scripts_(from.global_scripts_),
+			deadline_(from.deadline_),
+			struct_atoms_(std::move(from.struct_atoms_))
+		{
+			QJSCPP_DEBUG("context @" << (void*)this << " <- @" << (void*)&from);
+			JS_SetContextOpaque(ctx_.get(), this);
+			track(from);
+		}
+		
+		context& operator=(context&& from)
+		{
+			if (&from != this)
+			{
+				QJSCPP_DEBUG("context @" << (void*)this << " <= @" << (void*)&from);
+				untrack();
+				ctx_ = std::move(from.ctx_);
+				global_scripts_ = from.global_scripts_;
+				deadline_ = from.deadline_;
+				struct_atoms_ = std::move(from.struct_atoms_);
+				JS_SetContextOpaque(ctx_.get(), this);
+				track(from);
+			}
+			return *this;
+		}
+		
+		virtual ~context()
+		{
+			QJSCPP_DEBUG("~context @" << (void*)this);
+			values_.for_each(
+				[](value* val)
+				{
+					val->abandon();
+				});
+			atoms_.for_each(
+				[](atom* a)
+				{
+					a->abandon();
+				});
+			untrack();
+			if (ctx_)
+			{
+				cleanup_classes();
+				cleanup_structs();
+				JS_SetContextOpaque(ctx_.get(), nullptr);
+			}
+		}
+		
+		runtime& get_runtime() const
+		{
+			if (!ctx_)
+				throw invalid_context();
+			return *reinterpret_cast<runtime*>(JS_GetRuntimeOpaque(JS_GetRuntime(ctx_.get())));
+		}
+		
+		bool valid() const
+		{
+			return owner_ != nullptr && ctx_;
+		}
+		
+		operator JSContext*() const
+		{
+			validate();
+			return ctx_.get();
+		}
+		
+		enum class eval_flags
+		{
+			global,
+			module,
+			autodetect
+		};
+		
+		template <typename T>
+		value new_array_buffer(std::shared_ptr<T> owner, void* data, size_t size) const
+		{
+			validate();
+			
+			// The buffer keeps the owner alive until it is garbage collected
+			auto ctx = ctx_.get();
+			std::unique_ptr<std::shared_ptr<void>> holder(new std::shared_ptr<void>(std::move(owner)));
+			JSValue buf = JS_NewArrayBuffer(ctx, static_cast<uint8_t*>(data), size,
+				[](JSRuntime* /*rt*/, void* opaque, void* /*ptr*/)
+				{
+					delete static_cast<std::shared_ptr<void>*>(opaque);
+				}, holder.get(), false);
+			if (!JS_IsException(buf))
+				holder.release();
+			value ret(ctx, buf);
+			ret.check_throw(false);
+			return ret;
+		}
+		
+		template <typename T>
+		value new_array_buffer(std::shared_ptr<std::vector<T>> vec) const
+		{
+			auto data = vec->data();
+			auto size = vec->size() * sizeof(T);
+			return new_array_buffer(std::move(vec), data, size);
+		}
+		
+		value new_array_buffer_copy(const void* data, size_t size) const
+		{
+			validate();
+			
+			auto ctx = ctx_.get();
+			value ret(ctx, JS_NewArrayBufferCopy(ctx, static_cast<const uint8_t*>(data), size));
+			ret.check_throw(false);
+			return ret;
+		}
+		
+		template <typename E, typename T>
+		value new_typed_array(std::shared_ptr<T> owner, E* data, size_t count) const
+		{
+			value buf = new_array_buffer(std::move(owner), data, count * sizeof(E));
+			value ctor = get_global_object().get_property(detail::typed_array_traits<E>::name());
+			
+			auto ctx = ctx_.get();
+			value ret(ctx, JS_CallConstructor(ctx, ctor.val_, 1, &buf.val_));
+			ret.check_throw(true);
+			return ret;
+		}
+		
+		template <typename E>
+		value new_typed_array(std::shared_ptr<std::vector<E>> vec) const
+		{
+			auto data = vec->data();
+			auto count = vec->size();
+			return new_typed_array(std::move(vec), data, count);
+		}
+		
+		value get_global_object() const
+		{
+			validate();
+			auto ctx = ctx_.get();
+			return value(ctx, JS_GetGlobalObject(ctx));
+		}
+		
+		value eval(const char* str, eval_flags flags = eval_flags::autodetect)
+		{
+			return eval(str, ::strlen(str), flags);
+		}
+		
+		value eval(const char* buf, size_t len, eval_flags flags = eval_flags::autodetect, const char* filename = nullptr);
+		
+		value eval(const compiled_script& script)
+		{
+			validate();
+			
+			if (!script.valid())
+				throw exception("invalid compiled script");
+			
+			auto ctx = ctx_.get();
+			value obj(ctx, JS_ReadObject(ctx, script.data(), script.size(), JS_READ_OBJ_BYTECODE));
+			obj.check_throw(true);
+			if (JS_VALUE_GET_TAG(obj.val_) != JS_TAG_MODULE)
+				global_scripts_++;
+			else if (JS_ResolveModule(ctx, obj.val_) < 0)
+				value(ctx, JS_EXCEPTION).check_throw(true);
+			
+			// JS_EvalFunction takes ownership of the function object
+			call_level rl(running_);
+			value ret(ctx, JS_EvalFunction(ctx, obj.steal()));
+			ret.check_throw(true);
+			return ret;
+		}
+		
+		/**
+		 * Like eval(), but exceptions thrown by the script are returned in the
+		 * result instead of being thrown. Syntax errors found while compiling
+		 * a script for the script cache are still thrown.
+		 */
+		result try_eval(const char* str, eval_flags flags = eval_flags::autodetect);
+		result try_eval(const char* buf, size_t len, eval_flags flags = eval_flags::autodetect, const char* filename = nullptr);
+		result try_eval(const compiled_script& script);
+		
+		// Recreates a value serialized with value::serialize(), in this context
+		inline value deserialize(const serialized_value& val);
+		
+		// Interrupts scripts running in this context once the budget, starting now,
+		// is used up. The interrupted call throws time_budget_exceeded, which JS code
+		// can't catch. The deadline applies to all following calls until cleared.
+		void set_time_budget(std::chrono::microseconds budget);
+		
+		void clear_time_budget();
+		
+		bool has_time_budget() const
+		{
+			return deadline_ != std::chrono::steady_clock::time_point::max();
+		}
+		
+		// Receives what a callback run by the event loop threw
+		typedef std::function<void(std::exception_ptr)> error_func;
+		
+		/**
+		 * Installs setTimeout(), setInterval(), clearTimeout() and clearInterval()
+		 * as global functions, backed by the event loop. After each callback the
+		 * pending jobs are posted to the loop (see runtime::post_pending_jobs).
+		 * Exceptions thrown by callbacks are passed to on_error, or ignored
+		 * without one, so they don't stop the loop for other contexts. The loop
+		 * must outlive the context.
+		 */
+		inline void install_timers(event_loop& loop, error_func on_error = nullptr);
+		
+		compiled_script compile(const char* str, eval_flags flags = eval_flags::autodetect)
+		{
+			return compile(str, ::strlen(str), flags);
+		}
+		
+		compiled_script compile(const char* buf, size_t len, eval_flags flags = eval_flags::autodetect, const char* filename = nullptr)
+		{
+			validate();
+			
+			auto ctx = ctx_.get();
+			value obj(ctx, JS_Eval(ctx, buf, len, (filename && filename[0]) ? filename : "(none)", to_eval_flags(flags, buf, len) | JS_EVAL_FLAG_COMPILE_ONLY));
+			obj.check_throw(true);
+			
+			size_t size = 0;
+			uint8_t* bytecode = JS_WriteObject(ctx, &size, obj.val_, JS_WRITE_OBJ_BYTECODE);
+			if (!bytecode)
+				value(ctx, JS_EXCEPTION).check_throw(true);
+			
+			std::vector<uint8_t> bytes;
+			try
+			{
+				bytes.assign(bytecode, bytecode + size);
+			}
+			catch (...)
+			{
+				js_free(ctx, bytecode);
+				throw;
+			}
+			js_free(ctx, bytecode);
+			return compiled_script(std::move(bytes));
+		}
+		
+		// buf[len] must be 0, like for eval(). Syntax errors throw a value_exception
+		value parse_json(const char* buf, size_t len, const char* filename = nullptr)
+		{
+			validate();
+			
+			auto ctx = ctx_.get();
+			value ret(ctx, JS_ParseJSON(ctx, buf, len, (filename && filename[0]) ? filename : "(json)"));
+			ret.check_throw(true);
+			return ret;
+		}
+		
+		value parse_json(const char* str)
+		{
+			return parse_json(str, ::strlen(str));
+		}
+		
+		value parse_json(const std::string& str)
+		{
+			return parse_json(str.c_str(), str.length());
+		}
+		
+		template <typename... Args>
+		value call_global(const char* name, Args&&... args)
+		{
+			validate();
+			
+			return get_global_object().get_property(name)(std::forward<Args>(args) ...);
+		}
+		
+		template <typename... Args>
+		value call_global(const std::string& name, Args&&... args)
+		{
+			return call_global(name.c_str(), std::forward<Args>(args)...);
+		}
+		
+		template <typename... Args>
+		value call_global(const atom& name, Args&&... args)
+		{
+			validate();
+			
+			return get_global_object().get_property(name)(std::forward<Args>(args) ...);
+		}
+		
+		template <typename ClassType>
+		void register_class()
+		{
+			validate();
+			
+			QJSCPP_ASSERT(ClassType::class_definition.id != 0);
+			
+			auto ctx = ctx_.get();
+			auto rt = JS_GetRuntime(ctx_.get());
+			if (!JS_IsRegisteredClass(rt, ClassType::class_definition.id))
+			{
+				JSClassDef cdef{
+					.class_name = ClassType::class_definition.name,
+					.finalizer = detail::classes::finalizer<ClassType>,
+					.gc_mark = detail::classes::gc_mark<ClassType>
+				};
+				if (JS_NewClass(rt, ClassType::class_definition.id, &cdef) < 0)
+					throw exception("failed to register class");
+			}
+			
+			QJSCPP_DEBUG("Registering class '" << ClassType::class_definition.name << "' with id: " << ClassType::class_definition.id);
+			
+			value proto(ctx, JS_NewObject(ctx));
+			if (!ClassType::class_definition.members.empty())
+				JS_SetPropertyFunctionList(ctx, proto.val_, &ClassType::class_definition.members[0], ClassType::class_definition.members.size());
+			JS_SetClassProto(ctx, ClassType::class_definition.id, proto.val_);
+			value ctor(ctx, JS_NewCFunction2(ctx, detail::classes::ctor<ClassType>, ClassType::class_definition.name, ClassType::class_definition.ctor_argc, JS_CFUNC_constructor, 0));
+			if (!ctor.valid() || ctor.is_exception())
+				throw exception("failed to create class constructor");
+			JS_SetConstructor(ctx, ctor.val_, value(ctx, proto.val_, true).steal());
+			get_global_object().set_property(ClassType::class_definition.name, ctor); // TODO: is this the right way?
+			auto id = ClassType::class_definition.id;
+			if (id >= classes_.size())
+				classes_.resize(id + 1);
+			else if (classes_[id])
+				classes_[id]->cleanup(ctx);
+			classes_[id].reset(new class_info(ctor.steal(), proto.steal()));
+		}
+		
+		template <typename ClassType, typename InstanceType>
+		value make_object(const std::vector<value>& args, InstanceType& inst) const
+		{
+			validate();
+			
+			std::vector<JSValue> a(args.size());
+			for (size_t i = 0; i < args.size(); i++)
+				a[i] = args[i].val_;
+			
+			return construct_object<ClassType>(a.size(), !a.empty() ? &a[0] : nullptr, inst);
+		}
+		
+		template <typename ClassType, typename InstanceType>
+		value make_object(const quickjs::args& args, InstanceType& inst) const
+		{
+			validate();
+			
+			// Forward the caller's arguments as they are, unless they need padding
+			if (args.argc_ >= args.size_)
+				return construct_object<ClassType>(args.argc_, args.argv_, inst);
+			
+			std::vector<JSValue> a(args.size_);
+			for (size_t i = 0; i < args.size_; i++)
+				a[i] = args.raw(i);
+			
+			return construct_object<ClassType>(a.size(), !a.empty() ? &a[0] : nullptr, inst);
+		}
+	
+		/**
+		 * Creates an object of a registered class from a C++ constructor call,
+		 * ClassType(args...), skipping the JS constructor, the conversion of
+		 * arguments and any temporary vectors.
+		 */
+		template <typename ClassType, typename... Args>
+		value new_object(Args&&... args) const
+		{
+			validate();
+			
+			auto ctx = ctx_.get();
+			value ret(ctx, detail::classes::class_new_object<ClassType>(ctx, std::forward<Args>(args)...));
+			ret.check_throw(false);
+			return ret;
+		}
+	
+	private:
+		template <typename ClassType, typename InstanceType>
+		value construct_object(size_t argc, JSValueConst* argv, InstanceType& inst) const
+		{
+			auto const& info = get_class_info(ClassType::class_definition.id);
+			
+			auto ctx = ctx_.get();
+			value ret(ctx, JS_CallConstructor(ctx, info.ctor, argc, argv));
+			ret.check_throw(true);
+			if (ret.valid() && !ret.is_exception())
+				inst = detail::classes::get_inst<ClassType>(ret.val_);
+			else
+				inst = {};
+			return ret;
+		}
+		
+		static int to_eval_flags(eval_flags flags, const char* buf, size_t len)
+		{
+			switch (flags)
+			{
+				case eval_flags::global:
+					return JS_EVAL_TYPE_GLOBAL;
+				case eval_flags::module:
+					return JS_EVAL_TYPE_MODULE;
+				case eval_flags::autodetect:
+				default:
+					return JS_DetectModule(buf, len) ? JS_EVAL_TYPE_MODULE : JS_EVAL_TYPE_GLOBAL;
+			}
+		}
+	};
+	
+	namespace detail
+	{
+		// Same as JS_CFUNC_DEF and JS_CGETSET_DEF, which mix designated and
+		// positional initializers and therefore don't compile as C++20
+		inline JSCFunctionListEntry cfunc_entry(const char* name, uint8_t length, JSCFunction* func)
+		{
+			JSCFunctionListEntry entry;
+			std::memset(&entry, 0, sizeof(entry));
+			entry.name = name;
+			entry.prop_flags = JS_PROP_WRITABLE | JS_PROP_CONFIGURABLE;
+			entry.def_type = JS_DEF_CFUNC;
+			entry.u.func.length = length;
+			entry.u.func.cproto = JS_CFUNC_generic;
+			entry.u.func.cfunc.generic = func;
+			return entry;
+		}
+		
+		inline JSCFunctionListEntry cgetset_entry(const char* name, JSValue(*getter)(JSContext*, JSValueConst), JSValue(*setter)(JSContext*, JSValueConst, JSValueConst))
+		{
+			JSCFunctionListEntry entry;
+			std::memset(&entry, 0, sizeof(entry));
+			entry.name = name;
+			entry.prop_flags = JS_PROP_CONFIGURABLE;
+			entry.def_type = JS_DEF_CGETSET;
+			entry.u.getset.get.getter = getter;
+			entry.u.getset.set.setter = setter;
+			return entry;
+		}
+	}
+	
+	template <typename ClassType>
+	class object
+	{
+		friend class detail::members;
+		
+		JSCFunctionListEntry entry_;
+		
+		object(JSCFunctionListEntry&& entry):
+			entry_(std::move(entry))
+		{
+		}
+		
+	public:
+		template <value(ClassType::*Func)(const quickjs::args&)>
+		static object function(const char* name, uint8_t nargs = 0)
+		{
+			auto func = detail::classes::invoke_member<ClassType, Func>;
+			return object(detail::cfunc_entry(name, nargs, func));
+		}
+		
+		template <value(ClassType::*Getter)(const quickjs::value&), void(ClassType::*Setter)(const quickjs::value&, const quickjs::value&)>
+		static object getset(const char* name)
+		{
+			auto getter = detail::classes::invoke_getter<ClassType, Getter>;
+			auto setter = detail::classes::invoke_setter<ClassType, Setter>;
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		template <value(ClassType::*Getter)(const quickjs::value&)>
+		static object get_only(const char* name)
+		{
+			auto getter = detail::classes::invoke_getter<ClassType, Getter>;
+			auto setter =
+				[](JSContext *ctx, JSValueConst /*this_val*/, JSValueConst /*val*/) -> JSValue
+				{
+					return JS_ThrowTypeError(ctx, "property is read-only");
+				};
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		template <void(ClassType::*Setter)(const quickjs::value&, const quickjs::value&)>
+		static object set_only(const char* name)
+		{
+			auto getter =
+				[](JSContext *ctx, JSValueConst /*this_val*/) -> JSValue
+				{
+					return JS_ThrowTypeError(ctx, "property is write-only");
+				};
+			auto setter = detail::classes::invoke_setter<ClassType, Setter>;
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		template <value(ClassType::*Getter)(quickjs::value_ref), void(ClassType::*Setter)(quickjs::value_ref, quickjs::value_ref)>
+		static object getset(const char* name)
+		{
+			auto getter = detail::classes::invoke_getter_ref<ClassType, Getter>;
+			auto setter = detail::classes::invoke_setter_ref<ClassType, Setter>;
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		template <value(ClassType::*Getter)(quickjs::value_ref)>
+		static object get_only(const char* name)
+		{
+			auto getter = detail::classes::invoke_getter_ref<ClassType, Getter>;
+			auto setter =
+				[](JSContext *ctx, JSValueConst /*this_val*/, JSValueConst /*val*/) -> JSValue
+				{
+					return JS_ThrowTypeError(ctx, "property is read-only");
+				};
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		template <void(ClassType::*Setter)(quickjs::value_ref, quickjs::value_ref)>
+		static object set_only(const char* name)
+		{
+			auto getter =
+				[](JSContext *ctx, JSValueConst /*this_val*/) -> JSValue
+				{
+					return JS_ThrowTypeError(ctx, "property is write-only");
+				};
+			auto setter = detail::classes::invoke_setter_ref<ClassType, Setter>;
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		/**
+		 * Binds a member function with arbitrary parameter and return types,
+		 * e.g. method<int32_t(T::*)(int32_t, int32_t), &T::add>("add"). The
+		 * arguments are converted like those of closures, without creating args.
+		 */
+		template <typename Func, Func F>
+		static object method(const char* name)
+		{
+			auto func = detail::classes::invoke_method<ClassType, Func, F>;
+			return object(detail::cfunc_entry(name, detail::func_traits<Func>::arity, func));
+		}
+		
+		// Binds a data member as a property, e.g. field<double, &T::x>("x")
+		template <typename MemberType, MemberType ClassType::*Member>
+		static object field(const char* name)
+		{
+			auto getter = detail::classes::get_field<ClassType, MemberType, Member>;
+			auto setter = detail::classes::set_field<ClassType, MemberType, Member>;
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+		
+		template <typename MemberType, MemberType ClassType::*Member>
+		static object field_read_only(const char* name)
+		{
+			auto getter = detail::classes::get_field<ClassType, MemberType, Member>;
+			auto setter =
+				[](JSContext *ctx, JSValueConst /*this_val*/, JSValueConst /*val*/) -> JSValue
+				{
+					return JS_ThrowTypeError(ctx, "property is read-only");
+				};
+			return object(detail::cgetset_entry(name, getter, setter));
+		}
+
+#ifdef QJSCPP_HAS_AUTO_TEMPLATE
+		// method<&T::add>("add")
+		template <auto F>
+		static object method(const char* name)
+		{
+			return method<decltype(F), F>(name);
+		}
+		
+		// field<&T::x>("x")
+		template <auto Member>
+		static object field(const char* name)
+		{
+			return field<typename detail::member_traits<decltype(Member)>::member_type, Member>(name);
+		}
+		
+		template <auto Member>
+		static object field_read_only(const char* name)
+		{
+			return field_read_only<typename detail::member_traits<decltype(Member)>::member_type, Member>(name);
+		}
+#endif
+	};
+	
+	namespace detail
+	{
+		template <typename MemberType>
+		inline void members::add_function_list_entry(JSCFunctionListEntry* entries, size_t& idx, MemberType member)
+		{
+			entries[idx++] = member.entry_;
+		}
+		
+		template <typename ClassType, typename ClassDefType, typename... Args>
+		inline void members::create_class_def(ClassDefType& cdef, const char* name, int ctor_argc, Args&&... args)
+		{
+			JS_NewClassID(&cdef.id);
+			cdef.name = name;
+			cdef.ctor_argc = ctor_argc;
+			
+			if (sizeof...(args) > 0)
+			{
+				size_t ecnt = 0;
+				
+				QJSCPP_EXPAND(members::add_function_list_entry(&cdef.members[0], ecnt, std::forward<Args>(args)));
+				QJSCPP_ASSERT(ecnt == sizeof...(args));
+			}
+		}
+	}
+	
+	namespace detail
+	{
+		// Size-class allocator owned by a single runtime, so it doesn't need
+		// any locking. Small blocks are carved from 64 KiB chunks and recycled
+		// through per-class free lists, larger blocks go to ::malloc. Like with
+		// glibc, every block is preceded by an 8 byte header holding its usable
+		// size, which lets usable_size() work without knowing the arena.
+		class slab_arena
+		{
+		public:
+			enum : size_t
+			{
+				granularity = 16,
+				header_size = sizeof(uint64_t),
+				max_block_size = 512,
+				max_small_size = max_block_size - header_size,
+				class_count = max_block_size / granularity,
+				chunk_size = 64 * 1024
+			};
+		
+		private:
+			enum : uint64_t
+			{
+				large_flag = 1
+			};
+			
+			struct free_block
+			{
+				free_block* next;
+			};
+			
+			// Header of blocks allocated with ::malloc, hdr immediately precedes the payload
+			struct large_block
+			{
+				large_block* prev;
+				large_block* next;
+				uint64_t reserved;
+				uint64_t hdr;
+			};
+			
+			free_block* free_[class_count];
+			char* bump_{nullptr};
+			char* bump_end_{nullptr};
+			std::vector<void*> chunks_;
+			large_block large_;
+			
+			static uint64_t& header(void* ptr)
+			{
+				return *reinterpret_cast<uint64_t*>(reinterpret_cast<char*>(ptr) - header_size);
+			}
+			
+			static large_block* to_large(void* ptr)
+			{
+				return reinterpret_cast<large_block*>(reinterpret_cast<char*>(ptr) - sizeof(large_block));
+			}
+			
+			void link_large(large_block* b)
+			{
+				b->prev = &large_;
+				b->next = large_.next;
+				large_.next->prev = b;
+				large_.next = b;
+			}
+			
+			static void unlink_large(large_block* b)
+			{
+				b->prev->next = b->next;
+				b->next->prev = b->prev;
+			}
+			
+			void* malloc_large(size_t size)
+			{
+				size_t usable = (size + granularity - 1) & ~size_t(granularity - 1);
+				auto b = reinterpret_cast<large_block*>(::malloc(sizeof(large_block) + usable));
+				if (!b)
+					return nullptr;
+				b->hdr = usable | large_flag;
+				link_large(b);
+				return b + 1;
+			}
+			
+			bool new_chunk()
+			{
+				chunks_.reserve(chunks_.size() + 1);
+				auto chunk = reinterpret_cast<char*>(::malloc(chunk_size));
+				if (!chunk)
+					return false;
+				chunks_.push_back(chunk);
+				// Offset the first header so that payloads are 16 byte aligned
+				bump_ = chunk + header_size;
+				bump_end_ = chunk + chunk_size;
+				return true;
+			}
+		
+		public:
+			slab_arena(const slab_arena&) = delete;
+			slab_arena& operator=(const slab_arena&) = delete;
+			
+			slab_arena()
+			{
+				for (auto& f : free_)
+					f = nullptr;
+				large_.prev = &large_;
+				large_.next = &large_;
+			}
+			
+			~slab_arena()
+			{
+				release_all();
+			}
+			
+			static size_t usable_size(const void* ptr)
+			{
+				return ptr ? static_cast<size_t>(header(const_cast<void*>(ptr)) & ~uint64_t(large_flag)) : 0;
+			}
+			
+			void* malloc(size_t size)
+			{
+				if (size > max_small_size)
+					return malloc_large(size);
+				
+				size_t idx = (size + header_size + granularity - 1) / granularity - 1;
+				if (auto b = free_[idx])
+				{
+					free_[idx] = b->next;
+					return b;
+				}
+				
+				size_t block_size = (idx + 1) * granularity;
+				if (static_cast<size_t>(bump_end_ - bump_) < block_size && !new_chunk())
+					return nullptr;
+				auto block = bump_;
+				bump_ += block_size;
+				*reinterpret_cast<uint64_t*>(block) = block_size - header_size;
+				return block + header_size;
+			}
+			
+			void free(void* ptr)
+			{
+				if (!ptr)
+					return;
+				
+				uint64_t hdr = header(ptr);
+				if (hdr & large_flag)
+				{
+					auto b = to_large(ptr);
+					unlink_large(b);
+					::free(b);
+				}
+				else
+				{
+					size_t idx = (static_cast<size_t>(hdr) + header_size) / granularity - 1;
+					auto b = reinterpret_cast<free_block*>(ptr);
+					b->next = free_[idx];
+					free_[idx] = b;
+				}
+			}
+			
+			void* realloc(void* ptr, size_t size)
+			{
+				if (!ptr)
+					return malloc(size);
+				if (size == 0)
+				{
+					free(ptr);
+					return nullptr;
+				}
+				
+				uint64_t hdr = header(ptr);
+				size_t usable = static_cast<size_t>(hdr & ~uint64_t(large_flag));
+				if ((hdr & large_flag) && size > max_small_size)
+				{
+					auto b = to_large(ptr);
+					unlink_large(b);
+					size_t new_usable = (size + granularity - 1) & ~size_t(granularity - 1);
+					auto nb = reinterpret_cast<large_block*>(::realloc(b, sizeof(large_block) + new_usable));
+					if (!nb)
+					{
+						link_large(b);
+						return nullptr;
+					}
+					nb->hdr = new_usable | large_flag;
+					link_large(nb);
+					return nb + 1;
+				}
+				if (size <= usable)
+					return ptr;
+				
+				void* ret = malloc(size);
+				if (ret)
+				{
+					::memcpy(ret, ptr, usable);
+					free(ptr);
+				}
+				return ret;
+			}
+			
+			// Frees all memory at once, any outstanding blocks become invalid
+			void release_all()
+			{
+				for (auto chunk : chunks_)
+					::free(chunk);
+				chunks_.clear();
+				for (auto b = large_.next; b != &large_; )
+				{
+					auto next = b->next;
+					::free(b);
+					b = next;
+				}
+				large_.prev = &large_;
+				large_.next = &large_;
+				for (auto& f : free_)
+					f = nullptr;
+				bump_ = nullptr;
+				bump_end_ = nullptr;
+			}
+			
+			size_t chunk_count() const
+			{
+				return chunks_.size();
+			}
+		};
+		
+		// SharedArrayBuffer memory, reference counted across runtimes and threads,
+		// see runtime::enable_shared_array_buffers()
+		struct shared_array_buffers
+		{
+			struct header
+			{
+				std::atomic<size_t> refs;
+				size_t padding; // keeps the data 16 byte aligned
+			};
+			
+			static header* get_header(void* ptr)
+			{
+				return reinterpret_cast<header*>(ptr) - 1;
+			}
+			
+			static void* alloc(size_t size)
+			{
+				if (size > (size_t)-1 - sizeof(header))
+					return nullptr;
+				void* mem = ::calloc(1, sizeof(header) + size);
+				if (!mem)
+					return nullptr;
+				header* h = new (mem) header();
+				h->refs.store(1, std::memory_order_relaxed);
+				return h + 1;
+			}
+			
+			static void free(void* ptr)
+			{
+				header* h = get_header(ptr);
+				if (h->refs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+				{
+					h->~header();
+					::free(h);
+				}
+			}
+			
+			static void dup(void* ptr)
+			{
+				get_header(ptr)->refs.fetch_add(1, std::memory_order_relaxed);
+			}
+		};
+	}
+	
+	/**
+	 * A value serialized with JS_WriteObject, see value::serialize(). It can be
+	 * recreated with context::deserialize() in any runtime, e.g. one running
+	 * on another thread. References between objects, including cycles, are
+	 * preserved. SharedArrayBuffers aren't copied, the recreated value shares
+	 * their memory with the original one. That requires both runtimes to use
+	 * the same SharedArrayBuffer functions, see
+	 * runtime::enable_shared_array_buffers().
+	 */
+	class serialized_value
+	{
+		friend class value;
+		friend class context;
+		
+		std::vector<uint8_t> data_;
+		std::vector<void*> sabs_; // each holds a reference
+		JSSharedArrayBufferFunctions sab_funcs_{}; // of the serializing runtime, which allocated sabs_
+		
+		void release()
+		{
+			for (auto sab : sabs_)
+				sab_funcs_.sab_free(sab_funcs_.sab_opaque, sab);
+			sabs_.clear();
+		}
+	
+	public:
+		serialized_value() = default;
+		
+		serialized_value(const serialized_value& from):
+			data_(from.data_),
+			sabs_(from.sabs_),
+			sab_funcs_(from.sab_funcs_)
+		{
+			for (auto sab : sabs_)
+				sab_funcs_.sab_dup(sab_funcs_.sab_opaque, sab);
+		}
+		
+		serialized_value(serialized_value&& from):
+			data_(std::move(from.data_)),
+			sabs_(std::move(from.sabs_)),
+			sab_funcs_(from.sab_funcs_)
+		{
+			from.sabs_.clear();
+		}
+		
+		~serialized_value()
+		{
+			release();
+		}
+		
+		serialized_value& operator=(serialized_value from)
+		{
+			release();
+			data_ = std::move(from.data_);
+			sabs_ = std::move(from.sabs_);
+			sab_funcs_ = from.sab_funcs_;
+			from.sabs_.clear();
+			return *this;
+		}
+		
+		bool valid() const
+		{
+			return !data_.empty();
+		}
+		
+		const uint8_t* data() const
+		{
+			return data_.data();
+		}
+		
+		size_t size() const
+		{
+			return data_.size();
+		}
+		
+		size_t shared_array_buffers() const
+		{
+			return sabs_.size();
+		}
+	};
+	
+	/**
+	 * A bounded lock-free queue for handing values over to another thread,
+	 * e.g. serialized_values between runtimes. Any number of threads may send,
+	 * or just one if MultiProducer is false, which saves a compare-and-swap
+	 * per send. Only one thread may receive. Neither side ever blocks, a full
+	 * channel fails to send and an empty one fails to receive.
+	 * 
+	 * The capacity is rounded up to a power of 2.
+	 */
+	template <typename T, bool MultiProducer = true>
+	class channel
+	{
+		struct cell
+		{
+			std::atomic<size_t> seq;
+			T val;
+		};
+		
+		enum
+		{
+			cache_line = 64
+		};
+		
+		std::unique_ptr<cell[]> cells_;
+		size_t mask_;
+		char pad0_[cache_line];
+		std::atomic<size_t> head_{0}; // next position to send to
+		char pad1_[cache_line - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> tail_{0}; // next position to receive from
+		char pad2_[cache_line - sizeof(std::atomic<size_t>)];
+		
+		static size_t round_capacity(size_t capacity)
+		{
+			size_t ret = 2;
+			while (ret < capacity)
+				ret <<= 1;
+			return ret;
+		}
+		
+		template <typename V>
+		bool send(V&& val)
+		{
+			size_t pos = head_.load(std::memory_order_relaxed);
+			cell* c;
+			for (;;)
+			{
+				c = &cells_[pos & mask_];
+				size_t seq = c->seq.load(std::memory_order_acquire);
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if (diff == 0)
+				{
+					if (!MultiProducer)
+					{
+						head_.store(pos + 1, std::memory_order_relaxed);
+						break;
+					}
+					if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+					return false; // full
+				else
+					pos = head_.load(std::memory_order_relaxed);
+			}
+			c->val = std::forward<V>(val);
+			c->seq.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+	
+	public:
+		channel(const channel&) = delete;
+		channel& operator=(const channel&) = delete;
+		
+		explicit channel(size_t capacity):
+			cells_(new cell[round_capacity(capacity)]),
+			mask_(round_capacity(capacity) - 1)
+		{
+			for (size_t i = 0; i <= mask_; i++)
+				cells_[i].seq.store(i, std::memory_order_relaxed);
+		}
+		
+		size_t capacity() const
+		{
+			return mask_ + 1;
+		}
+		
+		bool try_send(T&& val)
+		{
+			return send(std::move(val));
+		}
+		
+		bool try_send(const T& val)
+		{
+			return send(val);
+		}
+		
+		// Only to be called by the receiving thread
+		bool try_receive(T& val)
+		{
+			size_t pos = tail_.load(std::memory_order_relaxed);
+			cell& c = cells_[pos & mask_];
+			if ((intptr_t)c.seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1) < 0)
+				return false;
+			val = std::move(c.val);
+			c.val = T(); // don't keep resources of a received value alive
+			c.seq.store(pos + mask_ + 1, std::memory_order_release);
+			tail_.store(pos + 1, std::memory_order_relaxed);
+			return true;
+		}
+		
+		// May already be outdated when it returns, unless called by the receiving thread while no one sends
+		bool empty() const
+		{
+			size_t pos = tail_.load(std::memory_order_relaxed);
+			return (intptr_t)cells_[pos & mask_].seq.load(std::memory_order_acquire) - (intptr_t)(pos + 1) < 0;
+		}
+	};
+	
+	struct memory_stats
+	{
+		enum
+		{
+			histogram_buckets = 32
+		};
+		
+		// Computed by QuickJS
+		JSMemoryUsage engine;
+		
+		// Only maintained when memory hooks or the arena allocator are used
+		size_t live_bytes{0};
+		size_t peak_bytes{0};
+		size_t live_allocations{0};
+		size_t total_allocations{0};
+		std::array<size_t, histogram_buckets> size_histogram{}; // bucket i counts sizes up to 2^i
+		
+		memory_stats()
+		{
+			::memset(&engine, 0, sizeof(engine));
+		}
+		
+		static size_t histogram_bucket(size_t size)
+		{
+			size_t i = 0;
+			while (i < histogram_buckets - 1 && (size_t(1) << i) < size)
+				i++;
+			return i;
+		}
+	};
+	
+	// Collections run by runtime::run_gc() and runtime::run_gc_if_idle()
+	struct gc_stats
+	{
+		uint64_t runs{0};
+		std::chrono::nanoseconds total{0};
+		std::chrono::nanoseconds max{0};
+		std::chrono::nanoseconds last{0};
+		size_t freed_bytes{0}; // only maintained when memory hooks or the arena allocator are used
+	};
+
+#ifdef QJSCPP_PROFILE
+	// Calls of a native binding (closure or class member), see runtime::native_call_profile()
+	struct native_call_stats
+	{
+		enum
+		{
+			histogram_buckets = 40
+		};
+		
+		std::string name;
+		uint64_t calls{0};
+		std::chrono::nanoseconds total{0}; // including nested calls
+		std::chrono::nanoseconds max{0};
+		std::array<uint64_t, histogram_buckets> histogram{}; // bucket i counts durations below 2^(i+1) ns
+		
+		static size_t histogram_bucket(uint64_t ns)
+		{
+			size_t i = 0;
+			while (i < histogram_buckets - 1 && (ns >> (i + 1)) != 0)
+				i++;
+			return i;
+		}
+	};
+	
+	namespace detail
+	{
+		// Closures of the same type share a call site, plain functions are
+		// told apart by their address
+		template <typename Func>
+		inline const void* profile_key(const Func&, const void* site)
+		{
+			return site;
+		}
+		
+		template <typename R, typename... A>
+		inline const void* profile_key(R(*f)(A...), const void* /*site*/)
+		{
+			return reinterpret_cast<const void*>(f);
+		}
+		
+		inline const void* profile_key(std::nullptr_t, const void* site)
+		{
+			return site;
+		}
+		
+		// Extracts the bound member (e.g. "&foo::bar") or the closure type from
+		// the signature of the dispatching function template
+		inline std::string profile_site_name(const char* kind, const char* signature, const void* key, bool by_address)
+		{
+			std::string sig(signature);
+			std::string name;
+			size_t pos = sig.rfind("= &");
+			if (pos != std::string::npos)
+				name = sig.substr(pos + 3, sig.find_first_of(";]", pos) - pos - 3);
+			else if ((pos = sig.find("Func = ")) != std::string::npos)
+				name = sig.substr(pos + 7, sig.find_first_of(";]", pos) - pos - 7);
+			else if ((pos = sig.find("ClassType = ")) != std::string::npos)
+				name = sig.substr(pos + 12, sig.find_first_of(";]", pos) - pos - 12);
+			else
+				name = sig;
+			
+			std::string ret(kind);
+			ret += ' ';
+			ret += name;
+			if (by_address)
+			{
+				char buf[32];
+				snprintf(buf, sizeof(buf), " @%p", key);
+				ret += buf;
+			}
+			return ret;
+		}
+		
+		class profile_scope
+		{
+			JSContext* ctx_;
+			const char* kind_;
+			const char* signature_;
+			const void* key_;
+			bool by_address_;
+			std::chrono::steady_clock::time_point start_;
+		
+		public:
+			profile_scope(const profile_scope&) = delete;
+			profile_scope& operator=(const profile_scope&) = delete;
+			
+			template <typename Key>
+			profile_scope(JSContext* ctx, const char* kind, const char* signature, const Key& key, const void* site):
+				ctx_(ctx),
+				kind_(kind),
+				signature_(signature),
+				key_(profile_key(key, site)),
+				by_address_(key_ != site),
+				start_(std::chrono::steady_clock::now())
+			{
+			}
+			
+			inline ~profile_scope();
+		};
+		
+		// Turns a stack trace of QuickJS into a line of folded stacks, outermost
+		// frame first, e.g. "<eval> (main.js);run (lib.js);compute (lib.js)"
+		inline std::string fold_stack(const char* stack)
+		{
+			std::vector<std::string> frames;
+			const char* p = stack;
+			while (*p)
+			{
+				const char* end = ::strchr(p, '\n');
+				if (!end)
+					end = p + ::strlen(p);
+				std::string line(p, end);
+				p = *end ? end + 1 : end;
+				
+				size_t start = line.find("at ");
+				if (start == std::string::npos)
+					continue;
+				line = line.substr(start + 3);
+				// Drop line and column numbers, so samples aggregate by function
+				size_t paren = line.rfind(')');
+				if (paren != std::string::npos)
+				{
+					size_t colon = line.find(':', line.rfind('(') != std::string::npos ? line.rfind('(') : 0);
+					if (colon != std::string::npos && colon < paren)
+						line.erase(colon, paren - colon);
+				}
+				std::replace(line.begin(), line.end(), ';', ',');
+				frames.push_back(line);
+			}
+			
+			std::string ret;
+			for (auto it = frames.rbegin(); it != frames.rend(); ++it)
+			{
+				if (!ret.empty())
+					ret += ';';
+				ret += *it;
+			}
+			return ret;
+		}
+	}
+#endif
+	
+	/**
+	 * Interface to the host's event loop, which runs timers and drains the
+	 * job queue of runtimes. See simple_event_loop, and asio_event_loop in
+	 * quickjs_asio.hpp. All functions are only called from the loop thread.
+	 */
+	class event_loop
+	{
+	public:
+		typedef std::function<void()> task;
+		typedef uint64_t timer_id;
+		
+		virtual ~event_loop() = default;
+		
+		// Runs the task on the next turn of the loop
+		virtual void post(task t) = 0;
+		
+		// Runs the task after the delay, and then every delay if repeat is set,
+		// until the timer is cancelled. Ids are never 0.
+		virtual timer_id start_timer(std::chrono::milliseconds delay, task t, bool repeat = false) = 0;
+		
+		// Returns false if the timer doesn't exist (anymore)
+		virtual bool cancel_timer(timer_id id) = 0;
+	};
+	
+	// A minimal single-threaded event loop, for hosts without one
+	class simple_event_loop:
+		public event_loop
+	{
+		typedef std::chrono::steady_clock clock;
+		
+		struct timer
+		{
+			clock::time_point due;
+			std::chrono::milliseconds interval;
+			bool repeat;
+			task fn;
+		};
+		
+		std::deque<task> tasks_;
+		std::map<timer_id, timer> timers_;
+		std::multimap<clock::time_point, timer_id> due_; // may contain stale entries of cancelled timers
+		timer_id next_id_{1};
+		bool stopped_{false};
+		
+		size_t run_timers(clock::time_point now)
+		{
+			size_t cnt = 0;
+			while (!due_.empty() && due_.begin()->first <= now && !stopped_)
+			{
+				auto id = due_.begin()->second;
+				auto when = due_.begin()->first;
+				due_.erase(due_.begin());
+				auto it = timers_.find(id);
+				if (it == timers_.end() || it->second.due != when)
+					continue;
+				
+				task fn;
+				if (it->second.repeat)
+				{
+					it->second.due = now + it->second.interval;
+					due_.insert(std::make_pair(it->second.due, id));
+					fn = it->second.fn;
+				}
+				else
+				{
+					fn = std::move(it->second.fn);
+					timers_.erase(it);
+				}
+				cnt++;
+				fn();
+			}
+			return cnt;
+		}
+	
+	public:
+		void post(task t) override
+		{
+			tasks_.push_back(std::move(t));
+		}
+		
+		timer_id start_timer(std::chrono::milliseconds delay, task t, bool repeat = false) override
+		{
+			if (delay.count() < 0)
+				delay = std::chrono::milliseconds(0);
+			auto id = next_id_++;
+			auto due = clock::now() + delay;
+			// An interval of 0 would make run_timers() loop forever
+			auto interval = (repeat && delay.count() == 0) ? std::chrono::milliseconds(1) : delay;
+			timers_.insert(std::make_pair(id, timer{ due, interval, repeat, std::move(t) }));
+			due_.insert(std::make_pair(due, id));
+			return id;
+		}
+		
+		bool cancel_timer(timer_id id) override
+		{
+			return timers_.erase(id) > 0;
+		}
+		
+		bool empty() const
+		{
+			return tasks_.empty() && timers_.empty();
+		}
+		
+		// Makes run() return after the current task
+		void stop()
+		{
+			stopped_ = true;
+		}
+		
+		/**
+		 * Runs the tasks that were posted before the call and the timers that
+		 * are due, without waiting. Tasks posted meanwhile run on the next
+		 * call, so a task that keeps posting itself can't starve the timers.
+		 * Returns the number of tasks and timers run.
+		 */
+		size_t poll()
+		{
+			size_t cnt = 0;
+			for (size_t n = tasks_.size(); n > 0 && !stopped_; n--)
+			{
+				task t = std::move(tasks_.front());
+				tasks_.pop_front();
+				cnt++;
+				t();
+			}
+			return cnt + run_timers(clock::now());
+		}
+		
+		// Runs until there is nothing left to do, stop() is called or the deadline passed
+		size_t run_until(clock::time_point deadline)
+		{
+			size_t cnt = 0;
+			stopped_ = false;
+			while (!stopped_ && !empty() && clock::now() < deadline)
+			{
+				cnt += poll();
+				if (tasks_.empty() && !due_.empty() && !stopped_)
+					std::this_thread::sleep_until(std::min(due_.begin()->first, deadline));
+			}
+			return cnt;
+		}
+		
+		template <typename Rep, typename Period>
+		size_t run_for(std::chrono::duration<Rep, Period> duration)
+		{
+			return run_until(clock::now() + duration);
+		}
+		
+		size_t run()
+		{
+			return run_until(clock::time_point::max());
+		}
+	};
+	
+	class runtime
+	{
+		friend class context;
+		friend class value;
+		friend class detail::classes;
+		
+	public:
+		enum class allocator
+		{
+			system, // QuickJS' default allocator
+			hooks,  // js_malloc, js_free and js_realloc
+			arena   // detail::slab_arena
+		};
+		
+		// Provides the source of the module with the (normalized) name, returns false if there is none
+		typedef std::function<bool(const std::string& name, std::string& source)> module_loader;
+		// Returns the name of the module imported as specifier by the module base
+		typedef std::function<std::string(const std::string& base, const std::string& specifier)> module_normalizer;
+	
+	private:
+		std::unique_ptr<detail::slab_arena> arena_; // must outlive rt_
+		memory_stats stats_;
+		bool accounting_{false}; // set by create_runtime(), so declared before rt_
+		mutable gc_stats gc_stats_;
+		mutable size_t gc_live_bytes_{0}; // live_bytes after the last run_gc()
+		bool idle_gc_{false};
+		size_t idle_gc_growth_{0};
+		bool gc_posted_{false};
+		bool default_alloc_called_{false}; // set by the default js_malloc and js_realloc
+		bool custom_alloc_{false}; // js_malloc or js_realloc was overridden
+		
+		// QuickJS expects the allocator to maintain malloc_count and malloc_size,
+		// and to enforce malloc_limit. This only works if the size of blocks is known.
+		void account_alloc(JSMallocState *s, size_t size, size_t usable)
+		{
+			stats_.total_allocations++;
+			stats_.size_histogram[memory_stats::histogram_bucket(size)]++;
+			if (usable)
+			{
+				s->malloc_count++;
+				s->malloc_size += usable;
+				stats_.live_allocations++;
+				stats_.live_bytes += usable;
+				if (stats_.live_bytes > stats_.peak_bytes)
+					stats_.peak_bytes = stats_.live_bytes;
+			}
+		}
+		
+		void account_free(JSMallocState *s, size_t usable)
+		{
+			if (usable)
+			{
+				s->malloc_count--;
+				s->malloc_size -= usable;
+				stats_.live_allocations--;
+				stats_.live_bytes -= usable;
+			}
+		}
+		
+		static bool over_limit(JSMallocState *s, size_t size)
+		{
+			return s->malloc_size > s->malloc_limit || size > s->malloc_limit - s->malloc_size;
+		}
+		
+		// Called after each js_malloc and js_realloc, so blocks of an overridden
+		// allocator are never passed to the default js_usable_size(), which
+		// expects them to come from ::malloc. Blocks counted before, e.g. while
+		// the base class was constructed, are written off when the default one
+		// stops measuring: they would be freed with a usable size of 0. Returns
+		// true if they were.
+		bool check_custom_alloc(JSMallocState *s, void* ptr)
+		{
+			if (default_alloc_called_ || custom_alloc_)
+				return false;
+			custom_alloc_ = true;
+			if (js_usable_size(ptr) != 0)
+				return false; // js_usable_size() was overridden as well
+			s->malloc_count -= stats_.live_allocations;
+			s->malloc_size -= stats_.live_bytes;
+			stats_.live_allocations = 0;
+			stats_.live_bytes = 0;
+			return true;
+		}
+		
+		JSMallocFunctions mf_{
+			[](JSMallocState *s, size_t size) -> void*
+			{
+				auto r = reinterpret_cast<runtime*>(s->opaque);
+				if (over_limit(s, size))
+					return nullptr;
+				r->default_alloc_called_ = false;
+				void* ptr = r->js_malloc(s, size);
+				r->check_custom_alloc(s, ptr);
+				if (ptr)
+					r->account_alloc(s, size, r->js_usable_size(ptr));
+				return ptr;
+			},
+			[](JSMallocState *s, void *ptr)
+			{
+				if (!ptr)
+					return;
+				auto r = reinterpret_cast<runtime*>(s->opaque);
+				r->account_free(s, r->js_usable_size(ptr));
+				r->js_free(s, ptr);
+			},
+			[](JSMallocState *s, void *ptr, size_t size) -> void*
+			{
+				auto r = reinterpret_cast<runtime*>(s->opaque);
+				size_t old_usable = ptr ? r->js_usable_size(ptr) : 0;
+				if (size > old_usable && over_limit(s, size - old_usable))
+					return nullptr;
+				r->default_alloc_called_ = false;
+				void* ret = r->js_realloc(s, ptr, size);
+				if (r->check_custom_alloc(s, ret))
+					old_usable = 0;
+				if (ret || size == 0)
+				{
+					// ptr was moved or freed
+					r->account_free(s, old_usable);
+					if (ret)
+						r->account_alloc(s, size, r->js_usable_size(ret));
+				}
+				return ret;
+			},
+			nullptr
+		};
+		std::unique_ptr<JSRuntime, decltype(&JS_FreeRuntime)> rt_;
+		detail::owner<context> contexts_;
+		script_cache scripts_;
+		bool use_script_cache_{false};
+		bool interrupt_handler_{false};
+		size_t time_budgets_{0}; // contexts with a deadline, checked by handle_interrupt()
+		bool draining_{false}; // running a pending job, whose context isn't known
+		bool drain_interrupted_{false}; // the job was interrupted by an exceeded time budget
+		size_t memory_limit_{(size_t)-1};
+		JSSharedArrayBufferFunctions sab_funcs_{}; // as installed, all null by default
+		bool jobs_posted_{false};
+		std::shared_ptr<runtime*> alive_; // reset on destruction, for tasks still queued in an event loop
+		module_loader module_loader_;
+		module_normalizer module_normalizer_;
+		std::vector<module_bundle> module_bundles_;
+		std::unordered_map<std::string, compiled_script> modules_; // compiled by module_loader_
+#ifdef QJSCPP_PROFILE
+		detail::pointer_map<native_call_stats> native_calls_;
+		std::unordered_map<std::string, uint64_t> samples_; // by folded stack
+		std::chrono::microseconds sample_interval_{0};
+		std::chrono::steady_clock::time_point next_sample_;
+		bool sampling_{false};
+		bool in_sample_{false};
+		
+		inline void record_native_call(const void* key, bool by_address, const char* kind, const char* signature, std::chrono::nanoseconds duration);
+		inline void sample();
+		friend class detail::profile_scope;
+#endif
+		
+		bool handle_interrupt();
+		inline void throw_out_of_memory();
+		
+		inline JSModuleDef* load_module(JSContext* ctx, const char* name);
+		inline char* normalize_module(JSContext* ctx, const char* base, const char* name);
+		
+		void install_module_loader()
+		{
+			JS_SetModuleLoaderFunc(rt_.get(),
+				module_normalizer_ ?
+					[](JSContext* ctx, const char* base, const char* name, void* opaque) -> char*
+					{
+						return reinterpret_cast<runtime*>(opaque)->normalize_module(ctx, base, name);
+					} : static_cast<JSModuleNormalizeFunc*>(nullptr),
+				[](JSContext* ctx, const char* name, void* opaque) -> JSModuleDef*
+				{
+					return reinterpret_cast<runtime*>(opaque)->load_module(ctx, name);
+				}, this);
+		}
+		
+		void enable_interrupt_handler()
+		{
+			if (interrupt_handler_)
+				return;
+			JS_SetInterruptHandler(rt_.get(),
+				[](JSRuntime*, void* opaque) -> int
+				{
+					return reinterpret_cast<runtime*>(opaque)->handle_interrupt() ? 1 : 0;
+				}, this);
+			interrupt_handler_ = true;
+		}
+		
+		struct inst_ref
+		{
+			size_t refs_{0};
+			JSValue weak_val_;
+			
+			inst_ref():
+				weak_val_(JS_UNDEFINED)
+			{
+			}
+			
+			inst_ref(JSValue weak_val):
+				weak_val_(weak_val)
+			{
+			}
+			
+			inst_ref(inst_ref&&) = default;
+			inst_ref& operator=(inst_ref&&) = default;
+			
+			inst_ref(const inst_ref&) = delete;
+			inst_ref& operator=(const inst_ref&) = delete;
+			
+			inline void ref()
+			{
+				refs_++;
+			}
+			
+			inline bool unref()
+			{
+				return --refs_ == 0;
+			}
+		};
+		detail::pointer_map<inst_ref> weak_object_refs_;
+		
+		inline void ref_inst_value(void* inst, JSValue weak_val)
+		{
+			weak_object_refs_.insert(inst, inst_ref(weak_val)).first->ref();
+		}
+		
+		inline void unref_inst_value(void* inst)
+		{
+			auto ref = weak_object_refs_.find(inst);
+			QJSCPP_ASSERT(ref != nullptr);
+			if (ref->unref())
+				weak_object_refs_.erase(inst);
+		}
+		
+		inline bool get_inst_value(JSContext* ctx, void* inst, JSValue& ref) const
+		{
+			if (auto r = weak_object_refs_.find(inst))
+			{
+				ref = JS_DupValue(ctx, r->weak_val_);
+				return true;
+			}
+			return false;
+		}
+	
+		JSRuntime* create_runtime(allocator alloc)
+		{
+			switch (alloc)
+			{
+				case allocator::arena:
+					arena_.reset(new detail::slab_arena());
+					mf_.js_malloc_usable_size = &detail::slab_arena::usable_size;
+					accounting_ = true;
+					return JS_NewRuntime2(&mf_, this);
+				case allocator::hooks:
+					accounting_ = true;
+					return JS_NewRuntime2(&mf_, this);
+				case allocator::system:
+				default:
+					return JS_NewRuntime();
+			}
+		}
+	
+	protected:
+		virtual void* js_malloc(JSMallocState *, size_t size)
+		{
+			default_alloc_called_ = true;
+			return arena_ ? arena_->malloc(size) : ::malloc(size);
+		}
+		
+		virtual void js_free(JSMallocState *, void *ptr)
+		{
+			if (arena_)
+				arena_->free(ptr);
+			else
+				::free(ptr);
+		}
+		
+		virtual void* js_realloc(JSMallocState *, void *ptr, size_t size)
+		{
+			default_alloc_called_ = true;
+			return arena_ ? arena_->realloc(ptr, size) : ::realloc(ptr, size);
+		}
+		
+		// Used for accounting and the memory limit. Returning 0 disables both,
+		// which the default does once an overridden js_malloc or js_realloc
+		// was called. Override it along with them to keep them working.
+		virtual size_t js_usable_size(const void* ptr) const
+		{
+			if (!ptr || custom_alloc_)
+				return 0;
+			if (arena_)
+				return detail::slab_arena::usable_size(ptr);
+#if defined(__GLIBC__)
+			return ::malloc_usable_size(const_cast<void*>(ptr));
+#else
+			return 0;
+#endif
+		}
+	
+	public:
+		runtime(const runtime&) = delete;
+		runtime(runtime&&) = delete;
+		runtime& operator=(const runtime&) = delete;
+		runtime& operator=(runtime&&) = delete;
+		
+		runtime(bool enableMemoryHooks = false):
+			runtime(enableMemoryHooks ? allocator::hooks : allocator::system)
+		{
+		}
+		
+		explicit runtime(allocator alloc):
+			rt_(create_runtime(alloc), &::JS_FreeRuntime),
+			alive_(std::make_shared<runtime*>(this))
+		{
+			QJSCPP_DEBUG("runtime @" << (void*)this);
+			JS_SetRuntimeOpaque(rt_.get(), this);
+		}
+		
+		virtual ~runtime()
+		{
+			QJSCPP_DEBUG("~runtime @" << (void*)this);
+			*alive_ = nullptr;
+			contexts_.for_each(
+				[](context *ctx)
+				{
+					ctx->abandon();
+				});
+			JS_SetRuntimeOpaque(rt_.get(), nullptr);
+		}
+		
+		operator JSRuntime*() const { return rt_.get(); }
+		
+		context new_context()
+		{
+			return context(this, rt_.get());
+		}
+		
+		// Runs a full collection, its pause is added to gc_statistics()
+		void run_gc() const
+		{
+			size_t live = stats_.live_bytes;
+			auto start = std::chrono::steady_clock::now();
+			JS_RunGC(rt_.get());
+			auto pause = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+			
+			gc_stats_.runs++;
+			gc_stats_.total += pause;
+			gc_stats_.last = pause;
+			if (pause > gc_stats_.max)
+				gc_stats_.max = pause;
+			if (live > stats_.live_bytes)
+				gc_stats_.freed_bytes += live - stats_.live_bytes;
+			gc_live_bytes_ = stats_.live_bytes;
+		}
+		
+		/**
+		 * Runs a collection unless jobs are pending. With memory hooks or the
+		 * arena allocator, it is also skipped until at least min_growth bytes
+		 * more are in use than after the previous collection. Returns true if
+		 * it collected.
+		 */
+		bool run_gc_if_idle(size_t min_growth = 0) const
+		{
+			if (has_pending_jobs())
+				return false;
+			if (accounting_ && min_growth && stats_.live_bytes < gc_live_bytes_ + min_growth)
+				return false;
+			run_gc();
+			return true;
+		}
+		
+		/**
+		 * Once post_pending_jobs() has drained the job queue, it posts
+		 * run_gc_if_idle(min_growth) to the loop, so collections happen between
+		 * requests rather than in the middle of one. Together with
+		 * set_gc_threshold((size_t)-1), no collections happen anywhere else.
+		 */
+		void set_idle_gc(bool enable, size_t min_growth = 0)
+		{
+			idle_gc_ = enable;
+			idle_gc_growth_ = min_growth;
+		}
+		
+		const gc_stats& gc_statistics() const
+		{
+			return gc_stats_;
+		}
+		
+		void reset_gc_statistics()
+		{
+			gc_stats_ = gc_stats();
+		}
+		
+		bool has_pending_jobs() const
+		{
+			return JS_IsJobPending(rt_.get());
+		}
+		
+		/**
+		 * Runs at most max_jobs pending jobs (promise reactions etc.) of all
+		 * contexts, in the order they were queued, and returns the number of
+		 * jobs run. Exceptions of a failed job are rethrown, the remaining
+		 * jobs stay queued. Contexts must not be destroyed while they still
+		 * have pending jobs. The context of a job isn't known before it runs,
+		 * so the time budgets of all contexts apply to it: once one is
+		 * exceeded, the job is interrupted and time_budget_exceeded thrown.
+		 */
+		inline size_t run_pending_jobs(size_t max_jobs = (size_t)-1);
+		
+		// Like run_pending_jobs(), but also stops once the deadline has passed
+		inline size_t run_pending_jobs_until(std::chrono::steady_clock::time_point deadline, size_t max_jobs = (size_t)-1);
+		
+		/**
+		 * Drains the job queue from the event loop, max_jobs at a time. Each
+		 * slice is posted as a separate task, so timers and I/O of the loop get
+		 * their turn in between. Does nothing if a slice is already posted.
+		 */
+		inline void post_pending_jobs(event_loop& loop, size_t max_jobs = 64);
+		
+		// Allocations that would exceed the limit fail, and throw an out of memory error in the script.
+		// (size_t)-1 removes the limit.
+		void set_memory_limit(size_t limit)
+		{
+			JS_SetMemoryLimit(rt_.get(), limit);
+			memory_limit_ = limit;
+		}
+		
+		/**
+		 * Lets SharedArrayBuffers be passed to other runtimes (threads) with
+		 * value::serialize(), which all need to enable them. Their memory is
+		 * reference counted and may outlive the runtime, so it isn't taken from
+		 * the runtime's allocator and isn't part of its memory usage. Buffers
+		 * that would take the runtime over its memory limit still fail (with
+		 * allocator::system, only their size is compared with the limit).
+		 * Must be called before the first SharedArrayBuffer is created.
+		 */
+		void enable_shared_array_buffers()
+		{
+			JSSharedArrayBufferFunctions sf;
+			sf.sab_alloc = [](void* opaque, size_t size) -> void*
+				{
+					auto r = reinterpret_cast<runtime*>(opaque);
+					size_t used = r->accounting_ ? r->stats_.live_bytes : 0;
+					void* ptr = nullptr;
+					if (size <= r->memory_limit_ && used <= r->memory_limit_ - size)
+						ptr = detail::shared_array_buffers::alloc(size);
+					if (!ptr)
+						r->throw_out_of_memory();
+					return ptr;
+				};
+			sf.sab_free = [](void*, void* ptr)
+				{
+					detail::shared_array_buffers::free(ptr);
+				};
+			sf.sab_dup = [](void*, void* ptr)
+				{
+					detail::shared_array_buffers::dup(ptr);
+				};
+			sf.sab_opaque = this;
+			set_shared_array_buffer_functions(sf);
+		}
+		
+		/**
+		 * Installs other SharedArrayBuffer functions, e.g. of a host embedding
+		 * QuickJS. Values are serialized with (and keep shared memory alive
+		 * through) the functions installed here, so this must be used instead of
+		 * JS_SetSharedArrayBufferFunctions().
+		 */
+		void set_shared_array_buffer_functions(const JSSharedArrayBufferFunctions& sf)
+		{
+			JS_SetSharedArrayBufferFunctions(rt_.get(), &sf);
+			sab_funcs_ = sf;
+		}
+		
+		// QuickJS collects once more than threshold bytes are allocated, and
+		// afterwards raises it to 1.5 times the memory still in use.
+		// (size_t)-1 turns these collections off, only run_gc() collects then.
+		void set_gc_threshold(size_t threshold)
+		{
+			JS_SetGCThreshold(rt_.get(), threshold);
+		}
+		
+		memory_stats memory_usage() const
+		{
+			memory_stats ret = stats_;
+			JS_ComputeMemoryUsage(rt_.get(), &ret.engine);
+			return ret;
+		}
+		
+		void reset_peak_memory_usage()
+		{
+			stats_.peak_bytes = stats_.live_bytes;
+		}
+		
+		// When enabled, context::eval() compiles each distinct script only once
+		// per runtime, and runs the cached bytecode on subsequent calls
+		void enable_script_cache(bool enable = true)
+		{
+			use_script_cache_ = enable;
+			if (!enable)
+				scripts_.clear();
+		}
+		
+		bool script_cache_enabled() const
+		{
+			return use_script_cache_;
+		}
+		
+		script_cache& get_script_cache()
+		{
+			return scripts_;
+		}
+		
+		/**
+		 * Resolves imports through loader(name, source), which provides the
+		 * source of a module. normalize(base, specifier) maps specifiers to
+		 * module names; without it, "./" and "../" are resolved relative to
+		 * the importing module. Each module is compiled once per runtime, other
+		 * contexts importing it run the cached bytecode.
+		 */
+		void set_module_loader(module_loader loader, module_normalizer normalize = nullptr)
+		{
+			module_loader_ = std::move(loader);
+			module_normalizer_ = std::move(normalize);
+			install_module_loader();
+		}
+		
+		// Modules in bundles are loaded from their bytecode before asking the
+		// module loader, bundles added first take precedence
+		void add_module_bundle(module_bundle bundle)
+		{
+			if (!bundle.valid())
+				throw exception("invalid module bundle");
+			module_bundles_.push_back(std::move(bundle));
+			install_module_loader();
+		}
+		
+		// The modules compiled from sources of the module loader, by name
+		const std::unordered_map<std::string, compiled_script>& get_module_cache() const
+		{
+			return modules_;
+		}
+		
+		void clear_module_cache()
+		{
+			modules_.clear();
+		}
+
+#ifdef QJSCPP_PROFILE
+		// Statistics of all native bindings called so far, most expensive first
+		std::vector<native_call_stats> native_call_profile() const
+		{
+			std::vector<native_call_stats> ret;
+			native_calls_.for_each(
+				[&](const void*, const native_call_stats& stats)
+				{
+					ret.push_back(stats);
+				});
+			std::sort(ret.begin(), ret.end(),
+				[](const native_call_stats& a, const native_call_stats& b)
+				{
+					return a.total > b.total;
+				});
+			return ret;
+		}
+		
+		/**
+		 * Records the JS stack about every interval while scripts run. Samples
+		 * are taken from the interrupt handler, which QuickJS only calls every
+		 * so many instructions, so short intervals are approximate.
+		 */
+		void start_sampling(std::chrono::microseconds interval)
+		{
+			enable_interrupt_handler();
+			sample_interval_ = interval;
+			next_sample_ = std::chrono::steady_clock::now() + interval;
+			sampling_ = true;
+		}
+		
+		void stop_sampling()
+		{
+			sampling_ = false;
+		}
+		
+		uint64_t sample_count() const
+		{
+			uint64_t ret = 0;
+			for (auto const& it : samples_)
+				ret += it.second;
+			return ret;
+		}
+		
+		// The samples as folded stacks ("outer;inner count" per line), e.g. for flamegraph.pl
+		std::string folded_stacks() const
+		{
+			std::vector<std::pair<std::string, uint64_t>> sorted(samples_.begin(), samples_.end());
+			std::sort(sorted.begin(), sorted.end());
+			std::string ret;
+			for (auto const& it : sorted)
+			{
+				ret += it.first;
+				ret += ' ';
+				ret += std::to_string(it.second);
+				ret += '\n';
+			}
+			return ret;
+		}
+		
+		void reset_profile()
+		{
+			native_calls_.clear();
+			samples_.clear();
+		}
+#endif
+		
+		template <typename ClassType, typename... Args>
+		static class_def<ClassType> create_class_def(const char* name, int ctor_argc = 0, Args&&... args)
+		{
+			class_def<ClassType> cdef(sizeof...(args));
+			detail::members::create_class_def<ClassType>(cdef,name, ctor_argc, std::forward<Args>(args)...);
+			return cdef;
+		}
+		
+		template <typename ClassType, typename... Args>
+		static class_def_shared<ClassType> create_class_def_shared(const char* name, int ctor_argc = 0, Args&&... args)
+		{
+			class_def_shared<ClassType> cdef(sizeof...(args));
+			detail::members::create_class_def<ClassType>(cdef,name, ctor_argc, std::forward<Args>(args)...);
+			return cdef;
+		}
+		
+		// Fields are created in the order given, so all objects made from
+		// the same definition share one shape
+		template <typename StructType, typename... Fields>
+		static struct_def<StructType> create_struct_def(Fields&&... fields)
+		{
+			return detail::structs::make_struct_def<StructType>(std::forward<Fields>(fields)...);
+		}
+	};
+	
+	// Hands out contexts that were initialized up front (classes registered,
+	// globals installed, preludes evaluated), and recycles them when released.
+	// The pool must not outlive its runtime.
+	class context_pool
+	{
+	public:
+		typedef std::function<void(context&)> init_func;
+		typedef std::function<bool(context&)> reset_func;
+		
+		// clear_globals only resets the global object itself: objects reachable
+		// from it, e.g. mutated builtin prototypes, carry over to the next user.
+		// Use discard (or a reset_func) when that matters. Global code can leave
+		// state behind that can't be reset: let, const and class declarations
+		// live in the global lexical scope (and would be redeclarations for the
+		// next user), var and function declarations can't be deleted. So only
+		// contexts that ran no global code since initialization are recycled,
+		// requests should be evaluated as modules or call functions set up by
+		// the init function. Global code run through JS' own (indirect) eval
+		// isn't noticed. Contexts are also discarded while the runtime has
+		// pending jobs, which may belong to them. Timers started with
+		// context::install_timers() are not cancelled.
+		enum class reset_policy
+		{
+			keep,          // recycle as-is
+			clear_globals, // delete global properties added since initialization, restore overwritten ones
+			discard        // never recycle, always initialize a new context
+		};
+	
+	private:
+		struct global_property
+		{
+			JSAtom atom;
+			JSPropertyDescriptor desc;
+		};
+		
+		struct entry
+		{
+			context ctx_;
+			std::vector<global_property> globals_; // sorted by atom
+			size_t global_scripts_{0}; // of ctx_, after initialization
+			
+			entry(context&& ctx):
+				ctx_(std::move(ctx))
+			{
+			}
+			
+			~entry()
+			{
+				if (ctx_.valid())
+				{
+					for (auto& g : globals_)
+					{
+						free_descriptor(ctx_, g.desc);
+						JS_FreeAtom(ctx_, g.atom);
+					}
+				}
+			}
+			
+			bool is_initial(JSAtom atom) const
+			{
+				auto it = std::lower_bound(globals_.begin(), globals_.end(), atom,
+					[](const global_property& g, JSAtom a)
+					{
+						return g.atom < a;
+					});
+				return it != globals_.end() && it->atom == atom;
+			}
+		};
+		
+		runtime& rt_;
+		init_func init_;
+		reset_policy policy_;
+		reset_func reset_;
+		size_t max_idle_;
+		std::vector<std::unique_ptr<entry>> idle_;
+		
+		static void free_descriptor(JSContext* c, JSPropertyDescriptor& desc)
+		{
+			JS_FreeValue(c, desc.value);
+			JS_FreeValue(c, desc.getter);
+			JS_FreeValue(c, desc.setter);
+		}
+		
+		static bool same_value(JSValueConst a, JSValueConst b)
+		{
+			if (JS_VALUE_GET_TAG(a) != JS_VALUE_GET_TAG(b))
+				return false;
+			if (JS_VALUE_HAS_REF_COUNT(a))
+				return JS_VALUE_GET_PTR(a) == JS_VALUE_GET_PTR(b);
+			if (JS_TAG_IS_FLOAT64(JS_VALUE_GET_TAG(a)))
+			{
+				double da = JS_VALUE_GET_FLOAT64(a), db = JS_VALUE_GET_FLOAT64(b);
+				return std::memcmp(&da, &db, sizeof(da)) == 0;
+			}
+			return JS_VALUE_GET_INT(a) == JS_VALUE_GET_INT(b);
+		}
+		
+		static std::vector<JSAtom> global_names(context& ctx)
+		{
+			JSContext* c = ctx;
+			value global = ctx.get_global_object();
+			JSPropertyEnum* tab = nullptr;
+			uint32_t len = 0;
+			if (JS_GetOwnPropertyNames(c, &tab, &len, global.val_, JS_GPN_STRING_MASK | JS_GPN_SYMBOL_MASK) < 0)
+				value(c, JS_EXCEPTION).check_throw(true);
+			
+			std::vector<JSAtom> names(len);
+			for (uint32_t i = 0; i < len; i++)
+				names[i] = tab[i].atom; // takes over the reference
+			js_free(c, tab);
+			std::sort(names.begin(), names.end());
+			return names;
+		}
+		
+		static void record_globals(entry& e)
+		{
+			JSContext* c = e.ctx_;
+			value global = e.ctx_.get_global_object();
+			auto names = global_names(e.ctx_);
+			e.globals_.reserve(names.size());
+			for (size_t i = 0; i < names.size(); i++)
+			{
+				global_property g{names[i], JSPropertyDescriptor()};
+				int found = JS_GetOwnProperty(c, &g.desc, global.val_, g.atom);
+				if (found < 0)
+				{
+					for (size_t j = i; j < names.size(); j++)
+						JS_FreeAtom(c, names[j]);
+					value(c, JS_EXCEPTION).check_throw(true);
+				}
+				if (found)
+					e.globals_.push_back(g);
+				else
+					JS_FreeAtom(c, g.atom);
+			}
+		}
+		
+		std::unique_ptr<entry> create()
+		{
+			std::unique_ptr<entry> e(new entry(rt_.new_context()));
+			if (init_)
+				init_(e->ctx_);
+			if (policy_ == reset_policy::clear_globals)
+			{
+				record_globals(*e);
+				e->global_scripts_ = e->ctx_.global_scripts_;
+			}
+			return e;
+		}
+		
+		// Puts a global property back the way it was after initialization
+		static bool restore_global(JSContext* c, JSValueConst global, const global_property& g)
+		{
+			JSPropertyDescriptor desc;
+			int found = JS_GetOwnProperty(c, &desc, global, g.atom);
+			if (found < 0)
+				return false;
+			if (found)
+			{
+				bool same = desc.flags == g.desc.flags && same_value(desc.value, g.desc.value) &&
+					same_value(desc.getter, g.desc.getter) && same_value(desc.setter, g.desc.setter);
+				free_descriptor(c, desc);
+				if (same)
+					return true;
+			}
+			
+			int flags = g.desc.flags & (JS_PROP_CONFIGURABLE | JS_PROP_WRITABLE | JS_PROP_ENUMERABLE);
+			if (g.desc.flags & JS_PROP_GETSET)
+				return JS_DefinePropertyGetSet(c, global, g.atom, JS_DupValue(c, g.desc.getter), JS_DupValue(c, g.desc.setter), flags) > 0;
+			return JS_DefinePropertyValue(c, global, g.atom, JS_DupValue(c, g.desc.value), flags) > 0;
+		}
+		
+		bool clear_globals(entry& e)
+		{
+			if (e.ctx_.global_scripts_ != e.global_scripts_ || rt_.has_pending_jobs())
+				return false;
+			
+			JSContext* c = e.ctx_;
+			value global = e.ctx_.get_global_object();
+			auto current = global_names(e.ctx_);
+			bool ret = true;
+			for (auto atom : current)
+			{
+				// Non-configurable properties can't be deleted
+				if (ret && !e.is_initial(atom) && JS_DeleteProperty(c, global.val_, atom, 0) <= 0)
+					ret = false;
+				JS_FreeAtom(c, atom);
+			}
+			for (auto it = e.globals_.begin(); ret && it != e.globals_.end(); ++it)
+				ret = restore_global(c, global.val_, *it);
+			if (!ret)
+				JS_FreeValue(c, JS_GetException(c));
+			return ret;
+		}
+		
+		void release(std::unique_ptr<entry> e)
+		{
+			if (!e->ctx_.valid() || policy_ == reset_policy::discard || idle_.size() >= max_idle_)
+				return;
+			
+			try
+			{
+				if (policy_ == reset_policy::clear_globals && !clear_globals(*e))
+					return;
+				e->ctx_.clear_time_budget();
+				if (reset_ && !reset_(e->ctx_))
+					return;
+			}
+			catch (...)
+			{
+				// Can't be recycled, but we don't want to throw from handle destructors
+				return;
+			}
+			idle_.push_back(std::move(e));
+		}
+	
+	public:
+		class handle
+		{
+			friend class context_pool;
+			
+			context_pool* pool_{nullptr};
+			std::unique_ptr<entry> entry_;
+			
+			handle(context_pool* pool, std::unique_ptr<entry> e):
+				pool_(pool),
+				entry_(std::move(e))
+			{
+			}
+		
+		public:
+			handle() = default;
+			handle(const handle&) = delete;
+			handle& operator=(const handle&) = delete;
+			handle(handle&&) = default;
+			
+			handle& operator=(handle&& from)
+			{
+				if (&from != this)
+				{
+					release();
+					pool_ = from.pool_;
+					entry_ = std::move(from.entry_);
+				}
+				return *this;
+			}
+			
+			~handle()
+			{
+				release();
+			}
+			
+			void release()
+			{
+				if (entry_)
+					pool_->release(std::move(entry_));
+			}
+			
+			bool valid() const
+			{
+				return entry_ && entry_->ctx_.valid();
+			}
+			
+			context& get() const
+			{
+				if (!entry_)
+					throw invalid_context();
+				return entry_->ctx_;
+			}
+			
+			context& operator*() const
+			{
+				return get();
+			}
+			
+			context* operator->() const
+			{
+				return &get();
+			}
+		};
+		
+		context_pool(const context_pool&) = delete;
+		context_pool& operator=(const context_pool&) = delete;
+		
+		explicit context_pool(runtime& rt, init_func init = nullptr, reset_policy policy = reset_policy::clear_globals, size_t max_idle = 16):
+			rt_(rt),
+			init_(std::move(init)),
+			policy_(policy),
+			max_idle_(max_idle)
+		{
+		}
+		
+		// Called on release, after the reset policy was applied. Returning false discards the context.
+		void set_reset_func(reset_func reset)
+		{
+			reset_ = std::move(reset);
+		}
+		
+		// Initializes contexts until at least cnt are idle
+		void reserve(size_t cnt)
+		{
+			if (cnt > max_idle_)
+				cnt = max_idle_;
+			while (idle_.size() < cnt)
+				idle_.push_back(create());
+		}
+		
+		handle acquire()
+		{
+			if (idle_.empty())
+				return handle(this, create());
+			
+			auto e = std::move(idle_.back());
+			idle_.pop_back();
+			return handle(this, std::move(e));
+		}
+		
+		size_t idle() const
+		{
+			return idle_.size();
+		}
+		
+		void clear()
+		{
+			idle_.clear();
+		}
+	};
+	
+	/**
+	 * Records how a context is initialized, so new contexts can be set up the
+	 * same way without parsing or recomputing anything. Scripts are compiled
+	 * once and their bytecode is run in each new context. Globals captured
+	 * with copy() are serialized, and each context restores its own copy of
+	 * them. Globals captured with share() are deep-frozen along with their
+	 * prototypes, and all contexts get the very same object. C++ bindings (classes, closures) can't be
+	 * serialized, they are set up by the init function. The steps are
+	 * replayed in the order they were added. The snapshot must not outlive
+	 * its runtime.
+	 */
+	class context_snapshot
+	{
+	public:
+		typedef std::function<void(context&)> init_func;
+	
+	private:
+		enum class step_kind
+		{
+			script,
+			copy,
+			share
+		};
+		
+		struct step
+		{
+			step_kind kind;
+			std::string name;
+			compiled_script script;
+			std::vector<uint8_t> data; // copy: the serialized value
+			value shared;
+		};
+		
+		runtime& rt_;
+		init_func init_;
+		context ctx_; // the context the snapshot is taken from
+		std::vector<step> steps_;
+		value freeze_; // Object.freeze and Object.getPrototypeOf, taken before any script ran
+		value get_prototype_;
+		
+		// Walks the properties natively, so scripts can't defeat it by replacing
+		// the builtins it would use
+		void deep_freeze(const value& root)
+		{
+			JSContext* c = ctx_;
+			std::unordered_set<void*> seen;
+			std::vector<value> todo{root};
+			while (!todo.empty())
+			{
+				value o = std::move(todo.back());
+				todo.pop_back();
+				if (!JS_IsObject(o.val_) || !seen.insert(JS_VALUE_GET_PTR(o.val_)).second)
+					continue;
+				freeze_(o);
+				todo.push_back(get_prototype_(o));
+				
+				JSPropertyEnum* tab = nullptr;
+				uint32_t len = 0;
+				if (JS_GetOwnPropertyNames(c, &tab, &len, o.val_, JS_GPN_STRING_MASK | JS_GPN_SYMBOL_MASK) < 0)
+					value(c, JS_EXCEPTION).check_throw(true);
+				int found = 0;
+				for (uint32_t i = 0; i < len; i++)
+				{
+					JSPropertyDescriptor desc;
+					if (found >= 0)
+						found = JS_GetOwnProperty(c, &desc, o.val_, tab[i].atom);
+					JS_FreeAtom(c, tab[i].atom);
+					if (found > 0)
+					{
+						todo.push_back(value(c, desc.value));
+						todo.push_back(value(c, desc.getter));
+						todo.push_back(value(c, desc.setter));
+					}
+				}
+				js_free(c, tab);
+				if (found < 0)
+					value(c, JS_EXCEPTION).check_throw(true);
+			}
+		}
+		
+		void add_step(step_kind kind, const char* name, compiled_script script, std::vector<uint8_t> data, value shared)
+		{
+			step s;
+			s.kind = kind;
+			s.name = name ? name : "";
+			s.script = std::move(script);
+			s.data = std::move(data);
+			s.shared = std::move(shared);
+			steps_.push_back(std::move(s));
+		}
+	
+	public:
+		context_snapshot(const context_snapshot&) = delete;
+		context_snapshot& operator=(const context_snapshot&) = delete;
+		
+		explicit context_snapshot(runtime& rt, init_func init = nullptr):
+			rt_(rt),
+			init_(std::move(init)),
+			ctx_(rt.new_context())
+		{
+			value object = ctx_.get_global_object().get_property("Object");
+			freeze_ = object.get_property("freeze");
+			get_prototype_ = object.get_property("getPrototypeOf");
+			if (init_)
+				init_(ctx_);
+		}
+		
+		// The context the snapshot is taken from, e.g. for computing globals to capture
+		context& get_context()
+		{
+			return ctx_;
+		}
+		
+		// Compiles and runs the script, and runs its bytecode in every new context
+		void add_script(const char* buf, size_t len, const char* filename = nullptr)
+		{
+			add_script(ctx_.compile(buf, len, context::eval_flags::global, filename));
+		}
+		
+		void add_script(const std::string& str, const char* filename = nullptr)
+		{
+			add_script(str.c_str(), str.size(), filename);
+		}
+		
+		void add_script(const compiled_script& script)
+		{
+			ctx_.eval(script);
+			add_step(step_kind::script, nullptr, script, {}, {});
+		}
+		
+		// Serializes the global property, which may only contain data (no functions)
+		void copy(const char* name)
+		{
+			JSContext* c = ctx_;
+			value val = ctx_.get_global_object().get_property(name);
+			
+			size_t size = 0;
+			uint8_t* buf = JS_WriteObject(c, &size, val.val_, JS_WRITE_OBJ_REFERENCE);
+			if (!buf)
+				value(c, JS_EXCEPTION).check_throw(true);
+			
+			std::vector<uint8_t> data;
+			try
+			{
+				data.assign(buf, buf + size);
+			}
+			catch (...)
+			{
+				js_free(c, buf);
+				throw;
+			}
+			js_free(c, buf);
+			add_step(step_kind::copy, name, {}, std::move(data), {});
+		}
+		
+		// Freezes the global property and everything reachable from it, including
+		// accessors and prototypes, so no context can change what the others see.
+		// That freezes the intrinsics of the snapshot context the value reaches
+		// (e.g. Object.prototype), assignments that would shadow their properties
+		// fail in later scripts of the snapshot context. Shared objects keep
+		// those prototypes, so in other contexts e.g. instanceof Array is false
+		// for them (Array.isArray() works). Note that typed arrays can't be frozen.
+		void share(const char* name)
+		{
+			value val = ctx_.get_global_object().get_property(name);
+			deep_freeze(val);
+			add_step(step_kind::share, name, {}, {}, std::move(val));
+		}
+		
+		// Initializes a new context of the same runtime like the snapshot
+		void apply(context& ctx) const
+		{
+			if (init_)
+				init_(ctx);
+			
+			JSContext* c = ctx;
+			value global = ctx.get_global_object();
+			for (auto const& s : steps_)
+			{
+				switch (s.kind)
+				{
+					case step_kind::script:
+						ctx.eval(s.script);
+						break;
+					case step_kind::copy:
+					{
+						value val(c, JS_ReadObject(c, s.data.data(), s.data.size(), JS_READ_OBJ_REFERENCE));
+						val.check_throw(true);
+						global.set_property(s.name, std::move(val));
+						break;
+					}
+					case step_kind::share:
+						// Objects belong to the runtime, so all of its contexts can use them
+						global.set_property(s.name, s.shared);
+						break;
+				}
+			}
+		}
+		
+		context new_context() const
+		{
+			context ret = rt_.new_context();
+			apply(ret);
+			return ret;
+		}
+	};
+	
+	// Owns one runtime and context per worker thread. Jobs are invoked with the
+	// worker's context, and their results are returned through a std::future.
+	// quickjs::value objects are bound to the worker's thread and can't be
+	// returned from a job.
+	class runtime_pool
+	{
+	public:
+		typedef std::function<void(context&)> init_func;
+	
+	private:
+		typedef std::function<void(context&)> job_func;
+		
+		struct worker
+		{
+			std::thread thread_;
+			std::deque<job_func> jobs_;
+		};
+		
+		std::mutex lock_;
+		std::condition_variable cond_;
+		std::deque<job_func> jobs_;
+		std::vector<std::unique_ptr<worker>> workers_;
+		bool stop_{false};
+		
+		void run_worker(worker& w, const init_func& init, bool enableMemoryHooks, std::promise<void>& ready)
+		{
+			std::unique_ptr<runtime> rt;
+			context ctx;
+			try
+			{
+				rt.reset(new runtime(enableMemoryHooks));
+				ctx = rt->new_context();
+				if (init)
+					init(ctx);
+			}
+			catch (...)
+			{
+				ready.set_exception(std::current_exception());
+				return;
+			}
+			ready.set_value();
+			
+			for (;;)
+			{
+				job_func job;
+				{
+					std::unique_lock<std::mutex> l(lock_);
+					cond_.wait(l,
+						[&]()
+						{
+							return stop_ || !w.jobs_.empty() || !jobs_.empty();
+						});
+					
+					// Jobs submitted to this worker take precedence, remaining jobs are drained before stopping
+					auto& queue = !w.jobs_.empty() ? w.jobs_ : jobs_;
+					if (queue.empty())
+						break;
+					job = std::move(queue.front());
+					queue.pop_front();
+				}
+				job(ctx);
+			}
+		}
+		
+		void stop()
+		{
+			{
+				std::lock_guard<std::mutex> l(lock_);
+				stop_ = true;
+			}
+			cond_.notify_all();
+			for (auto& w : workers_)
+			{
+				if (w->thread_.joinable())
+					w->thread_.join();
+			}
+		}
+		
+		template <typename Func>
+		static auto invoke_detached(Func& f, context& ctx) -> decltype(f(ctx))
+		{
+			try
+			{
+				return f(ctx);
+			}
+			catch (const value_exception& e)
+			{
+				// The value belongs to this worker's context, only pass on its string
+				std::string str;
+				if (!e.val().valid() || !e.val().as_string(str))
+					str = e.what();
+				throw value_exception(str);
+			}
+			catch (const throw_exception& e)
+			{
+				std::string str;
+				if (!e.val().valid() || !e.val().as_string(str))
+					str = e.what();
+				throw value_exception(str);
+			}
+		}
+		
+		template <typename Func>
+		auto enqueue(worker* w, Func f) -> std::future<decltype(f(std::declval<context&>()))>
+		{
+			typedef decltype(f(std::declval<context&>())) result_type;
+			static_assert(!std::is_same<typename std::decay<result_type>::type, value>::value, "quickjs::value can't be returned from a runtime_pool job");
+			
+			auto task = std::make_shared<std::packaged_task<result_type(context&)>>(
+				[f](context& ctx) mutable -> result_type
+				{
+					return invoke_detached(f, ctx);
+				});
+			auto ret = task->get_future();
+			{
+				std::lock_guard<std::mutex> l(lock_);
+				if (stop_)
+					throw exception("runtime_pool stopped");
+				(w ? w->jobs_ : jobs_).push_back(
+					[task](context& ctx)
+					{
+						(*task)(ctx);
+					});
+			}
+			if (w)
+				cond_.notify_all();
+			else
+				cond_.notify_one();
+			return ret;
+		}
+	
+	public:
+		runtime_pool(const runtime_pool&) = delete;
+		runtime_pool(runtime_pool&&) = delete;
+		runtime_pool& operator=(const runtime_pool&) = delete;
+		runtime_pool& operator=(runtime_pool&&) = delete;
+		
+		explicit runtime_pool(size_t threads = std::thread::hardware_concurrency(), init_func init = nullptr, bool enableMemoryHooks = false)
+		{
+			if (threads == 0)
+				threads = 1;
+			
+			std::vector<std::promise<void>> ready(threads);
+			std::vector<std::future<void>> started;
+			for (auto& r : ready)
+				started.push_back(r.get_future());
+			try
+			{
+				for (size_t i = 0; i < threads; i++)
+				{
+					workers_.emplace_back(new worker());
+					auto w = workers_.back().get();
+					auto r = &ready[i];
+					w->thread_ = std::thread(
+						[this, w, r, init, enableMemoryHooks]()
+						{
+							run_worker(*w, init, enableMemoryHooks, *r);
+						});
+				}
+				
+				for (auto& f : started)
+					f.get();
+			}
+			catch (...)
+			{
+				stop();
+				throw;
+			}
+		}
+		
+		~runtime_pool()
+		{
+			stop();
+		}
+		
+		size_t size() const
+		{
+			return workers_.size();
+		}
+		
+		// Runs f(context&) on the next available worker
+		template <typename Func>
+		auto submit(Func f) -> std::future<decltype(f(std::declval<context&>()))>
+		{
+			return enqueue(nullptr, std::move(f));
+		}
+		
+		// Runs f(context&) on a specific worker
+		template <typename Func>
+		auto submit_to(size_t idx, Func f) -> std::future<decltype(f(std::declval<context&>()))>
+		{
+			if (idx >= workers_.size())
+				throw exception("invalid worker index");
+			return enqueue(workers_[idx].get(), std::move(f));
+		}
+		
+		// Runs f(context&) once on every worker, and waits for all of them to complete
+		template <typename Func>
+		void broadcast(Func f)
+		{
+			std::vector<std::future<void>> done;
+			done.reserve(workers_.size());
+			for (auto& w : workers_)
+			{
+				done.push_back(enqueue(w.get(),
+					[f](context& ctx) mutable
+					{
+						f(ctx);
+					}));
+			}
+			for (auto& d : done)
+				d.get();
+		}
+		
+		template <typename ClassType>
+		void register_class()
+		{
+			broadcast(
+				[](context& ctx)
+				{
+					ctx.register_class<ClassType>();
+				});
+		}
+	};
+	
+	/**
+	 * The outcome of one call of a batch, see function_handle::call_batch().
+	 */
+	struct batch_result
+	{
+		value result; // the returned value, if the call succeeded
+		value error; // the value thrown by JS, if it failed
+		std::exception_ptr exception; // a C++ exception thrown through JS, if any
+		
+		bool ok() const
+		{
+			return !error.valid() && !exception;
+		}
+	};
+	
+	/**
+	 * The outcome of a call that doesn't throw, like an std::expected holding
+	 * either the returned value or what was thrown. See value::try_call(),
+	 * function_handle::try_invoke() and context::try_eval().
+	 * 
+	 * Nothing is converted into a C++ exception unless get() or rethrow() is
+	 * called, and the stack of an error is only read by stack(). Both need the
+	 * context to be alive.
+	 */
+	class result
+	{
+		friend class context;
+		friend class function_handle;
+		friend class detail::functions;
+		
+		value value_;
+		value error_;
+		std::exception_ptr exception_;
+		
+		// Takes ownership of ret, which may be JS_EXCEPTION
+		result(JSContext* ctx, JSValue ret):
+			result(ctx, ret, reinterpret_cast<context*>(JS_GetContextOpaque(ctx))->pop_exception())
+		{
+		}
+		
+		// The values are constructed in place, so their context tracks them.
+		// A C++ exception that went through JS makes the error uncatchable,
+		// the C++ exception is reported instead.
+		result(JSContext* ctx, JSValue ret, std::exception_ptr excpt):
+			value_(keep(ctx, ret, !excpt && !JS_IsException(ret))),
+			error_(JS_IsException(ret) ? keep(ctx, JS_GetException(ctx), !excpt) : value()),
+			exception_(std::move(excpt))
+		{
+		}
+		
+		// Takes ownership of val, returns it if wanted
+		static value keep(JSContext* ctx, JSValue val, bool wanted)
+		{
+			value ret(ctx, val);
+			if (wanted)
+				return ret;
+			return value();
+		}
+		
+		bool is_error() const
+		{
+			return error_.valid() && JS_IsError(error_.ctx_, error_.val_);
+		}
+	
+	public:
+		result() = default;
+		
+		bool ok() const
+		{
+			return !error_.valid() && !exception_;
+		}
+		
+		explicit operator bool() const
+		{
+			return ok();
+		}
+		
+		// The returned value, what was thrown is rethrown if the call failed
+		const value& get() const
+		{
+			if (!ok())
+				rethrow();
+			return value_;
+		}
+		
+		value value_or(value def) const
+		{
+			return ok() ? value_ : def;
+		}
+		
+		// The value thrown by JS, if any
+		const value& error() const
+		{
+			return error_;
+		}
+		
+		// A C++ exception thrown through JS, if any
+		std::exception_ptr exception() const
+		{
+			return exception_;
+		}
+		
+		std::string message() const
+		{
+			if (error_.valid())
+				return error_.as_string();
+			if (exception_)
+			{
+				try
+				{
+					std::rethrow_exception(exception_);
+				}
+				catch (const std::exception& e)
+				{
+					return e.what();
+				}
+				catch (...)
+				{
+				}
+			}
+			return std::string();
+		}
+		
+		// The stack of the thrown error, empty if something else was thrown
+		std::string stack() const
+		{
+			if (!is_error())
+				return std::string();
+			value stack = error_.get_property("stack");
+			return !stack.is_undefined() ? stack.as_string() : std::string();
+		}
+		
+		// Throws what the throwing call would have thrown, does nothing if the call succeeded
+		void rethrow() const
+		{
+			if (exception_)
+				std::rethrow_exception(exception_);
+			if (!error_.valid())
+				return;
+			
+			// Calls throw errors like any other value: as value_exception, or
+			// when nested in another call as throw_exception, which JS can catch.
+			// The call is over, so its own level isn't counted anymore.
+			context& c = error_.get_context();
+			if (c.clevel_ > 0)
+				throw throw_exception(value(error_));
+			throw value_exception(value(error_));
+		}
+	};
+	
+	/**
+	 * A JavaScript function that has been resolved once, along with the
+	 * 'this' object it is called with.
+	 * 
+	 * The function is looked up and checked for being callable when the handle is
+	 * created, so calling it doesn't need to walk the global object again.
+	 * Calls with an iterator range reuse the handle's argument buffer.
+	 */
+	class function_handle
+	{
+		value func_;
+		value this_;
+		std::vector<JSValue> argbuf_;
+		
+		static value callable(value func)
+		{
+			if (!func.valid() || !func.is_function())
+				throw exception("not a function");
+			return func;
+		}
+	
+	public:
+		function_handle() = default;
+		
+		explicit function_handle(value func, value thisObj = value()):
+			func_(callable(std::move(func))),
+			this_(std::move(thisObj))
+		{
+		}
+		
+		function_handle(const context& ctx, const char* name):
+			func_(callable(ctx.get_global_object().get_property(name)))
+		{
+		}
+		
+		function_handle(const context& ctx, const std::string& name):
+			function_handle(ctx, name.c_str())
+		{
+		}
+		
+		function_handle(const context& ctx, const atom& name):
+			func_(callable(ctx.get_global_object().get_property(name)))
+		{
+		}
+		
+		bool valid() const
+		{
+			return func_.valid();
+		}
+		
+		const value& get() const
+		{
+			return func_;
+		}
+		
+		const value& get_this() const
+		{
+			return this_;
+		}
+		
+		template <typename... Args>
+		value operator()(Args&&... args) const
+		{
+			return invoke(std::forward<Args>(args)...);
+		}
+		
+		template <typename... Args>
+		value invoke(Args&&... args) const;
+		
+		template <typename Begin, typename End>
+		value invoke_range(Begin begin, End end);
+		
+		template <typename... Args>
+		result try_invoke(Args&&... args) const;
+		
+		/**
+		 * Calls the function once for each element in [begin, end), which is
+		 * a std::tuple or std::vector of arguments, or the single argument.
+		 * A batch_result is written to out for each call. Failing calls don't
+		 * stop the batch, the number of failed calls is returned.
+		 */
+		template <typename Begin, typename End, typename Out>
+		size_t call_batch(Begin begin, End end, Out out) const;
+	};
+	
+	inline void value::throw_value_exception(const char* msg) const
+	{
+		throw value_exception(msg);
+	}
+	
+	inline void value_ref::throw_value_exception(const char* msg) const
+	{
+		throw value_exception(msg);
+	}
+	
+	inline void value::do_throw(value exval) const
+	{
+			if (JS_IsError(ctx_, val_))
+			{
+				value stack = exval.get_property("stack");
+				throw value_error(exval.as_cstring(), !stack.is_undefined() ? stack.as_cstring() : cstring());
+			}
+			else
+			{
+				context& c = *reinterpret_cast<context*>(JS_GetContextOpaque(ctx_));
+				if (c.clevel_ > 1)
+				{
+					QJSCPP_DEBUG("do_throw: clevel: " << c.clevel_ << ": throwing internal throw_exception");
+					throw throw_exception(std::move(exval));
+				}
+				else
+				{
+					QJSCPP_DEBUG("do_throw: throwing value_exception");
+					throw value_exception(std::move(exval));
+				}
+			}
+	}
+	
+	inline void gc_marker::operator()(const value& val) const
+	{
+		if (val.valid())
+			JS_MarkValue(rt_, val.val_, mark_func_);
+	}
+	
+	inline void value::handle_pending_exception()
+	{
+		if (auto excpt = get_context().pop_exception())
+		{
+			QJSCPP_DEBUG("value @" << (void*)this << ": rethrow forwarded exception");
+			std::rethrow_exception(excpt);
+		}
+	}
+	
+	inline void value::track()
+	{
+		if (!owner_ && ctx_)
+		{
+			owner_ = &get_context();
+			QJSCPP_DEBUG("value track() @" << (void*)this << ": add");
+			owner_->values_.insert_head(*this);
+		}
+	}
+	
+	inline void value::track(value& from)
+	{
+		if (from.owner_)
+		{
+			QJSCPP_DEBUG("value track(value&) @" << (void*)this << ": abandon: @" << (void*)&from);
+			from.untrack();
+			from.owner_ = nullptr;
+		}
+		if (owner_)
+		{
+			QJSCPP_DEBUG("value track(value&) @" << (void*)this << ": remove");
+			unlink();
+			owner_ = nullptr;
+		}
+		if (ctx_)
+		{
+			QJSCPP_DEBUG("value track(value&) @" << (void*)this << ": add");
+			owner_ = &get_context();
+			owner_->values_.insert_head(*this);
+		}
+	}
+	
+	inline void value::untrack()
+	{
+		if (owner_)
+		{
+			QJSCPP_DEBUG("value untrack() @" << (void*)this << ": remove");
+			unlink();
+			owner_ = nullptr;
+		}
+	}
+	
+	inline void atom::track()
+	{
+		if (!owner_ && ctx_)
+		{
+			owner_ = reinterpret_cast<context*>(JS_GetContextOpaque(ctx_));
+			QJSCPP_DEBUG("atom track() @" << (void*)this << ": add");
+			owner_->atoms_.insert_head(*this);
+		}
+	}
+	
+	inline void atom::untrack()
+	{
+		if (owner_)
+		{
+			QJSCPP_DEBUG("atom untrack() @" << (void*)this << ": remove");
+			unlink();
+			owner_ = nullptr;
+		}
+	}
+	
+	template <typename... Args>
+	inline value value::operator()(Args&&... a) const
+	{
+		validate();
+		
+		return detail::functions::call(*this, ctx_, value::undefined(ctx_), std::forward<Args>(a)...);
+	}
+	
+	template <typename ... Args>
+	value value::call(const value& thisObj, Args&&... a) const
+	{
+		validate();
+		
+		return detail::functions::call(*this, ctx_, thisObj, std::forward<Args>(a)...);
+	}
+	
+	template <typename ... Args>
+	result value::try_call(const value& thisObj, Args&&... a) const
+	{
+		validate();
+		
+		return detail::functions::try_call(*this, ctx_, thisObj, std::forward<Args>(a)...);
+	}
+	
+	template <typename... Args>
+	result value::try_call_member(const char* name, Args&&... args)
+	{
+		validate();
+		
+		return get_property(name).try_call(*this, std::forward<Args>(args) ...);
+	}
+	
+	template <typename... Args>
+	result value::try_call_member(const std::string& name, Args&&... args)
+	{
+		return try_call_member(name.c_str(), std::forward<Args>(args)...);
+	}
+	
+	template <typename Begin, typename End, typename Out>
+	size_t value::call_batch(const value& thisObj, Begin begin, End end, Out out) const
+	{
+		validate();
+		
+		return detail::functions::call_batch(*this, ctx_, thisObj, begin, end, out);
+	}
+	
+	// f is called with the UTF-8 text owned by QuickJS, no copy is made
+	template <typename Func>
+	bool value::stringify(unsigned indent, Func f) const
+	{
+		validate();
+		
+		JSValue space = indent > 0 ? JS_NewInt32(ctx_, static_cast<int32_t>(indent)) : JS_UNDEFINED;
+		JSValue json;
+		{
+			auto c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx_));
+			context::call_level rl(c->running_);
+			json = JS_JSONStringify(ctx_, val_, JS_UNDEFINED, space);
+		}
+		value str(ctx_, json);
+		str.check_throw(true);
+		if (JS_IsUndefined(str.val_))
+			return false;
+		
+		size_t len = 0;
+		const char* text = JS_ToCStringLen(ctx_, &len, str.val_);
+		if (!text)
+			value(ctx_, JS_EXCEPTION).check_throw(true);
+		try
+		{
+			f(text, len);
+		}
+		catch (...)
+		{
+			JS_FreeCString(ctx_, text);
+			throw;
+		}
+		JS_FreeCString(ctx_, text);
+		return true;
+	}
+	
+	inline bool value::to_json(std::string& out, unsigned indent) const
+	{
+		return stringify(indent,
+			[&](const char* text, size_t len)
+			{
+				out.append(text, len);
+			});
+	}
+	
+	inline std::string value::to_json(unsigned indent) const
+	{
+		std::string ret;
+		if (!to_json(ret, indent))
+			throw_value_exception("value has no JSON representation");
+		return ret;
+	}
+	
+	inline size_t value::to_json(char* buf, size_t size, unsigned indent) const
+	{
+		size_t ret = (size_t)-1;
+		stringify(indent,
+			[&](const char* text, size_t len)
+			{
+				if (size > 0)
+				{
+					size_t n = std::min(len, size - 1);
+					::memcpy(buf, text, n);
+					buf[n] = '\0';
+				}
+				ret = len;
+			});
+		return ret;
+	}
+	
+	template <typename Sink>
+	bool value::to_json_stream(Sink sink, size_t chunk_size, unsigned indent) const
+	{
+		if (chunk_size == 0)
+			chunk_size = 1;
+		return stringify(indent,
+			[&](const char* text, size_t len)
+			{
+				for (size_t pos = 0; pos < len; pos += chunk_size)
+					sink(text + pos, std::min(chunk_size, len - pos));
+			});
+	}
+	
+	namespace detail
+	{
+		//
+		// conversion of C++ types to and from JS values
+		//
+		
+		// Drops the exception left behind by a failed conversion
+		inline bool conversion_failed(JSContext* ctx)
+		{
+			JS_FreeValue(ctx, JS_GetException(ctx));
+			return false;
+		}
+		
+		template <>
+		struct js_traits<bool>
+		{
+			static JSValue wrap(JSContext* ctx, bool val)
+			{
+				return JS_NewBool(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, bool& out)
+			{
+				int ret = JS_ToBool(ctx, val);
+				if (ret < 0)
+					return conversion_failed(ctx);
+				out = (ret != 0);
+				return true;
+			}
+		};
+		
+		template <>
+		struct js_traits<int32_t>
+		{
+			static JSValue wrap(JSContext* ctx, int32_t val)
+			{
+				return JS_NewInt32(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, int32_t& out)
+			{
+				return JS_ToInt32(ctx, &out, val) == 0 || conversion_failed(ctx);
+			}
+		};
+		
+		template <>
+		struct js_traits<uint32_t>
+		{
+			static JSValue wrap(JSContext* ctx, uint32_t val)
+			{
+				return val <= INT32_MAX ? JS_NewInt32(ctx, static_cast<int32_t>(val)) : JS_NewFloat64(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, uint32_t& out)
+			{
+				return JS_ToUint32(ctx, &out, val) == 0 || conversion_failed(ctx);
+			}
+		};
+		
+		template <>
+		struct js_traits<int64_t>
+		{
+			static JSValue wrap(JSContext* ctx, int64_t val)
+			{
+				return JS_NewInt64(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, int64_t& out)
+			{
+				return JS_ToInt64(ctx, &out, val) == 0 || conversion_failed(ctx);
+			}
+		};
+		
+		template <>
+		struct js_traits<double>
+		{
+			static JSValue wrap(JSContext* ctx, double val)
+			{
+				return JS_NewFloat64(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, double& out)
+			{
+				return JS_ToFloat64(ctx, &out, val) == 0 || conversion_failed(ctx);
+			}
+		};
+		
+		template <>
+		struct js_traits<float>
+		{
+			static JSValue wrap(JSContext* ctx, float val)
+			{
+				return JS_NewFloat64(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, float& out)
+			{
+				double d;
+				if (JS_ToFloat64(ctx, &d, val) != 0)
+					return conversion_failed(ctx);
+				out = static_cast<float>(d);
+				return true;
+			}
+		};
+		
+		template <>
+		struct js_traits<std::string>
+		{
+			static JSValue wrap(JSContext* ctx, const std::string& val)
+			{
+				return JS_NewStringLen(ctx, val.data(), val.length());
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, std::string& out)
+			{
+				size_t len = 0;
+				const char* str = JS_ToCStringLen(ctx, &len, val);
+				if (!str)
+					return conversion_failed(ctx);
+				out.assign(str, len);
+				JS_FreeCString(ctx, str);
+				return true;
+			}
+		};
+		
+		template <>
+		struct js_traits<value>
+		{
+			static JSValue wrap(JSContext* ctx, const value& val)
+			{
+				return val.valid() ? JS_DupValue(ctx, val.val_) : JS_UNDEFINED;
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, value& out)
+			{
+				out = value(ctx, val, true);
+				return true;
+			}
+		};
+		
+		// Arrays are read and written by index, which QuickJS handles without
+		// a property lookup for dense arrays
+		struct js_array
+		{
+			template <typename T>
+			static bool set(JSContext* ctx, JSValue arr, uint32_t idx, const T& val)
+			{
+				JSValue v = js_traits<T>::wrap(ctx, val);
+				return !JS_IsException(v) && JS_SetPropertyUint32(ctx, arr, idx, v) >= 0;
+			}
+			
+			template <typename T>
+			static bool get(JSContext* ctx, JSValueConst arr, uint32_t idx, T& out)
+			{
+				JSValue v = JS_GetPropertyUint32(ctx, arr, idx);
+				if (JS_IsException(v))
+					return conversion_failed(ctx);
+				bool ret = js_traits<T>::unwrap(ctx, v, out);
+				JS_FreeValue(ctx, v);
+				return ret;
+			}
+			
+			static bool length(JSContext* ctx, JSValueConst arr, uint32_t& len)
+			{
+				int is_array = JS_IsArray(ctx, arr);
+				if (is_array <= 0)
+					return is_array < 0 ? conversion_failed(ctx) : false;
+				JSValue v = JS_GetPropertyStr(ctx, arr, "length");
+				bool ret = !JS_IsException(v) && JS_ToUint32(ctx, &len, v) == 0;
+				JS_FreeValue(ctx, v);
+				return ret || conversion_failed(ctx);
+			}
+			
+			template <typename Begin, typename End>
+			static JSValue wrap(JSContext* ctx, Begin begin, End end)
+			{
+				JSValue arr = JS_NewArray(ctx);
+				if (JS_IsException(arr))
+					return arr;
+				uint32_t idx = 0;
+				for (auto it = begin; it != end; ++it)
+				{
+					if (!set(ctx, arr, idx++, *it))
+					{
+						JS_FreeValue(ctx, arr);
+						return JS_EXCEPTION;
+					}
+				}
+				return arr;
+			}
+		};
+		
+		template <typename T>
+		struct js_traits<std::vector<T>>
+		{
+			static JSValue wrap(JSContext* ctx, const std::vector<T>& val)
+			{
+				return js_array::wrap(ctx, val.begin(), val.end());
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, std::vector<T>& out)
+			{
+				uint32_t len = 0;
+				if (!js_array::length(ctx, val, len))
+					return false;
+				out.resize(len);
+				for (uint32_t i = 0; i < len; i++)
+				{
+					T elem;
+					if (!js_array::get(ctx, val, i, elem))
+						return false;
+					out[i] = std::move(elem);
+				}
+				return true;
+			}
+		};
+		
+		template <typename T, size_t N>
+		struct js_traits<std::array<T, N>>
+		{
+			static JSValue wrap(JSContext* ctx, const std::array<T, N>& val)
+			{
+				return js_array::wrap(ctx, val.begin(), val.end());
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, std::array<T, N>& out)
+			{
+				uint32_t len = 0;
+				if (!js_array::length(ctx, val, len) || len != N)
+					return false;
+				for (uint32_t i = 0; i < N; i++)
+				{
+					if (!js_array::get(ctx, val, i, out[i]))
+						return false;
+				}
+				return true;
+			}
+		};
+		
+		template <typename... T>
+		struct js_traits<std::tuple<T...>>
+		{
+			template <size_t... Is>
+			static bool set_all(JSContext* ctx, JSValue arr, const std::tuple<T...>& val, indices<Is...>)
+			{
+				bool ok = true;
+				QJSCPP_EXPAND((ok = ok && js_array::set(ctx, arr, Is, std::get<Is>(val))));
+				return ok;
+			}
+			
+			template <size_t... Is>
+			static bool get_all(JSContext* ctx, JSValueConst arr, std::tuple<T...>& out, indices<Is...>)
+			{
+				bool ok = true;
+				QJSCPP_EXPAND((ok = ok && js_array::get(ctx, arr, Is, std::get<Is>(out))));
+				return ok;
+			}
+			
+			static JSValue wrap(JSContext* ctx, const std::tuple<T...>& val)
+			{
+				JSValue arr = JS_NewArray(ctx);
+				if (JS_IsException(arr))
+					return arr;
+				if (!set_all(ctx, arr, val, typename make_indices<sizeof...(T)>::type()))
+				{
+					JS_FreeValue(ctx, arr);
+					return JS_EXCEPTION;
+				}
+				return arr;
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, std::tuple<T...>& out)
+			{
+				uint32_t len = 0;
+				if (!js_array::length(ctx, val, len) || len < sizeof...(T))
+					return false;
+				return get_all(ctx, val, out, typename make_indices<sizeof...(T)>::type());
+			}
+		};
+		
+		// Objects used as maps, only own enumerable string keys are read back
+		template <typename Map>
+		struct js_object_traits
+		{
+			typedef typename Map::mapped_type T;
+			
+			static JSValue wrap(JSContext* ctx, const Map& val)
+			{
+				JSValue obj = JS_NewObject(ctx);
+				if (JS_IsException(obj))
+					return obj;
+				for (auto const& it : val)
+				{
+					JSAtom key = JS_NewAtomLen(ctx, it.first.data(), it.first.length());
+					JSValue v = key != JS_ATOM_NULL ? js_traits<T>::wrap(ctx, it.second) : JS_EXCEPTION;
+					bool ok = !JS_IsException(v) && JS_SetProperty(ctx, obj, key, v) >= 0;
+					if (key != JS_ATOM_NULL)
+						JS_FreeAtom(ctx, key);
+					if (!ok)
+					{
+						JS_FreeValue(ctx, obj);
+						return JS_EXCEPTION;
+					}
+				}
+				return obj;
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, Map& out)
+			{
+				if (!JS_IsObject(val))
+					return false;
+				JSPropertyEnum* tab = nullptr;
+				uint32_t len = 0;
+				if (JS_GetOwnPropertyNames(ctx, &tab, &len, val, JS_GPN_STRING_MASK | JS_GPN_ENUM_ONLY) < 0)
+					return conversion_failed(ctx);
+				
+				bool ok = true;
+				out.clear();
+				for (uint32_t i = 0; i < len; i++)
+				{
+					if (ok)
+					{
+						std::string key;
+						JSValue k = JS_AtomToString(ctx, tab[i].atom);
+						JSValue v = JS_GetProperty(ctx, val, tab[i].atom);
+						T elem;
+						ok = !JS_IsException(k) && !JS_IsException(v) &&
+							js_traits<std::string>::unwrap(ctx, k, key) &&
+							js_traits<T>::unwrap(ctx, v, elem);
+						JS_FreeValue(ctx, k);
+						JS_FreeValue(ctx, v);
+						if (ok)
+							out[std::move(key)] = std::move(elem);
+						else
+							conversion_failed(ctx);
+					}
+					JS_FreeAtom(ctx, tab[i].atom);
+				}
+				js_free(ctx, tab);
+				return ok;
+			}
+		};
+		
+		template <typename T>
+		struct js_traits<std::map<std::string, T>>:
+			public js_object_traits<std::map<std::string, T>>
+		{
+		};
+		
+		template <typename T>
+		struct js_traits<std::unordered_map<std::string, T>>:
+			public js_object_traits<std::unordered_map<std::string, T>>
+		{
+		};
+		
+		inline uint32_t structs::next_id()
+		{
+			static std::atomic<uint32_t> next{0};
+			return next++;
+		}
+		
+		// The atoms of the field names are created once per context
+		template <typename StructType>
+		inline const JSAtom* structs::get_atoms(JSContext* ctx, const struct_def<StructType>& sdef)
+		{
+			auto c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+			if (!c)
+				return nullptr;
+			if (sdef.id >= c->struct_atoms_.size())
+				c->struct_atoms_.resize(sdef.id + 1);
+			
+			auto& atoms = c->struct_atoms_[sdef.id];
+			if (atoms.empty() && !sdef.names.empty())
+			{
+				atoms.reserve(sdef.names.size());
+				for (auto name : sdef.names)
+				{
+					JSAtom a = JS_NewAtom(ctx, name);
+					if (a == JS_ATOM_NULL)
+					{
+						for (auto prev : atoms)
+							JS_FreeAtom(ctx, prev);
+						atoms.clear();
+						return nullptr;
+					}
+					atoms.push_back(a);
+				}
+			}
+			return atoms.data();
+		}
+		
+		template <typename StructType>
+		inline JSValue structs::wrap(JSContext* ctx, const StructType& val)
+		{
+			auto const& sdef = StructType::struct_definition;
+			const JSAtom* atoms = get_atoms(ctx, sdef);
+			if (!atoms && !sdef.names.empty())
+				return JS_EXCEPTION;
+			JSValue obj = JS_NewObject(ctx);
+			if (JS_IsException(obj))
+				return obj;
+			if (!sdef.wrap_fields(ctx, sdef.fields.get(), atoms, obj, val))
+			{
+				JS_FreeValue(ctx, obj);
+				return JS_EXCEPTION;
+			}
+			return obj;
+		}
+		
+		template <typename StructType>
+		inline bool structs::unwrap(JSContext* ctx, JSValueConst val, StructType& out)
 		{
-			QJSCPP_DEBUG("value untrack() @" << (void*)this << ": remove");
-			unlink();
-			owner_ = nullptr;
+			if (!JS_IsObject(val))
+				return false;
+			auto const& sdef = StructType::struct_definition;
+			const JSAtom* atoms = get_atoms(ctx, sdef);
+			if (!atoms && !sdef.names.empty())
+				return conversion_failed(ctx);
+			return sdef.unwrap_fields(ctx, sdef.fields.get(), atoms, val, out);
 		}
-	}
-	
-	template <typename... Args>
-	inline value value::operator()(Args&&... a) const
-	{
-		validate();
 		
-		return detail::functions::call(*this, ctx_, value::undefined(ctx_), std::forward<Args>(a)...);
-	}
-	
-	template <typename ... Args>
-	value value::call(const value& thisObj, Args&&... a) const
-	{
-		validate();
+		template <typename T>
+		struct js_traits
+		{
+			static_assert(is_struct<T>::value, "no conversion for this type, structs need a struct_definition");
+			
+			static JSValue wrap(JSContext* ctx, const T& val)
+			{
+				return structs::wrap(ctx, val);
+			}
+			
+			static bool unwrap(JSContext* ctx, JSValueConst val, T& out)
+			{
+				return structs::unwrap(ctx, val, out);
+			}
+		};
 		
-		return detail::functions::call(*this, ctx_, thisObj, std::forward<Args>(a)...);
-	}
-	
-	namespace detail
-	{
 		struct jsvalue_list
 		{
 			JSContext* ctx_;
@@ -1979,6 +7684,13 @@ namespace quickjs
 				return JS_NewStringLen(ctx_, str.data(), str.length());
 			}
 			
+#ifdef QJSCPP_HAS_STRING_VIEW
+			inline JSValue new_jsvalue(std::string_view str) const
+			{
+				return JS_NewStringLen(ctx_, str.data(), str.length());
+			}
+#endif
+			
 			inline JSValue new_jsvalue(bool val) const
 			{
 				return val ? JS_TRUE : JS_FALSE;
@@ -2004,6 +7716,36 @@ namespace quickjs
 				return JS_NewFloat64(ctx_, val);
 			}
 			
+			template <typename T>
+			inline JSValue new_jsvalue(const std::vector<T>& val) const
+			{
+				return value(ctx_, val).steal();
+			}
+			
+			template <typename T, size_t N>
+			inline JSValue new_jsvalue(const std::array<T, N>& val) const
+			{
+				return value(ctx_, val).steal();
+			}
+			
+			template <typename... T>
+			inline JSValue new_jsvalue(const std::tuple<T...>& val) const
+			{
+				return value(ctx_, val).steal();
+			}
+			
+			template <typename T>
+			inline JSValue new_jsvalue(const std::map<std::string, T>& val) const
+			{
+				return value(ctx_, val).steal();
+			}
+			
+			template <typename T>
+			inline JSValue new_jsvalue(const std::unordered_map<std::string, T>& val) const
+			{
+				return value(ctx_, val).steal();
+			}
+			
 			template <typename Func>
 			inline JSValue new_jsvalue(Func func) const
 			{
@@ -2089,11 +7831,7 @@ namespace quickjs
 			if (auto raw = get_raw_inst<ClassType>(val))
 			{
 				QJSCPP_DEBUG("Mark class @ " << (void*)raw_to_inst_ptr(raw));
-				raw_to_inst(raw)->gc_mark(
-					[&](JSValue val)
-					{
-						JS_MarkValue(rt, val, mark_func);
-					});
+				raw_to_inst(raw)->gc_mark(gc_marker(rt, mark_func));
 			}
 		}
 		
@@ -2117,6 +7855,7 @@ namespace quickjs
 		template <typename ClassType, typename std::enable_if<std::is_base_of<class_def<ClassType>, decltype(ClassType::class_definition)>{}, int>::type = 0>
 		inline JSValue classes::class_make_inst(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst *argv)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "constructor", nullptr);
 			value target(ctx, new_target, true);
 			auto proto = target.get_property("prototype");
 			if (!proto.valid())
@@ -2138,6 +7877,7 @@ namespace quickjs
 		template <typename ClassType, typename std::enable_if<std::is_base_of<class_def_shared<ClassType>, decltype(ClassType::class_definition)>{}, int>::type = 0>
 		inline JSValue classes::class_make_inst(JSContext* ctx, JSValueConst new_target, int argc, JSValueConst *argv)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "constructor", nullptr);
 			value target(ctx, new_target, true);
 			auto proto = target.get_property("prototype");
 			if (!proto.valid())
@@ -2158,6 +7898,26 @@ namespace quickjs
 			return obj.steal();
 		}
 		
+		// Instances are constructed directly, without going through the JS
+		// constructor and args, and get the registered class prototype
+		template <typename ClassType, typename... Args>
+		inline typename std::enable_if<std::is_base_of<class_def<ClassType>, decltype(ClassType::class_definition)>::value, JSValue>::type classes::class_new_object(JSContext* ctx, Args&&... args)
+		{
+			context& c = *reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+			auto const& info = c.get_class_info(ClassType::class_definition.id);
+			std::unique_ptr<ClassType> raw(new ClassType(std::forward<Args>(args)...));
+			JSValue obj = JS_NewObjectProtoClass(ctx, info.proto, ClassType::class_definition.id);
+			if (!JS_IsException(obj))
+				JS_SetOpaque(obj, raw.release());
+			return obj;
+		}
+		
+		template <typename ClassType, typename... Args>
+		inline typename std::enable_if<std::is_base_of<class_def_shared<ClassType>, decltype(ClassType::class_definition)>::value, JSValue>::type classes::class_new_object(JSContext* ctx, Args&&... args)
+		{
+			return class_make_object_for_inst<ClassType>(ctx, std::make_shared<ClassType>(std::forward<Args>(args)...));
+		}
+		
 		template <typename ClassType>
 		inline JSValue classes::ctor(JSContext *ctx, JSValueConst new_target, int argc, JSValueConst *argv)
 		{
@@ -2183,6 +7943,7 @@ namespace quickjs
 		template <typename ClassType, value(ClassType::*Func)(const args&)>
 		inline JSValue classes::invoke_member(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "method", nullptr);
 			QJSCPP_DEBUG("invoke_member with arguments: " << argc);
 			if (auto raw = get_raw_inst<ClassType>(this_val))
 			{
@@ -2214,6 +7975,7 @@ namespace quickjs
 		template <typename ClassType, value(ClassType::*Getter)(const value&)>
 		inline JSValue classes::invoke_getter(JSContext *ctx, JSValueConst this_val)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "getter", nullptr);
 			if (auto raw = get_raw_inst<ClassType>(this_val))
 			{
 				auto inst = raw_to_inst_ptr(raw);
@@ -2242,6 +8004,7 @@ namespace quickjs
 		template <typename ClassType, void(ClassType::*Setter)(const value&, const value&)>
 		inline JSValue classes::invoke_setter(JSContext *ctx, JSValueConst this_val, JSValueConst val)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "setter", nullptr);
 			if (auto raw = get_raw_inst<ClassType>(this_val))
 			{
 				auto inst = raw_to_inst_ptr(raw);
@@ -2267,6 +8030,64 @@ namespace quickjs
 			return JS_EXCEPTION;
 		}
 		
+		template <typename ClassType, value(ClassType::*Getter)(value_ref)>
+		inline JSValue classes::invoke_getter_ref(JSContext *ctx, JSValueConst this_val)
+		{
+			QJSCPP_PROFILE_CALL(ctx, "getter", nullptr);
+			if (auto raw = get_raw_inst<ClassType>(this_val))
+			{
+				auto inst = raw_to_inst_ptr(raw);
+				QJSCPP_DEBUG("Call object getter @ " << (void*)inst);
+				try
+				{
+					auto ret = (inst->*Getter)(value_ref(ctx, this_val));
+					return ret.valid() ? ret.steal() : JS_UNDEFINED;
+				}
+				catch (const throw_exception& e)
+				{
+					QJSCPP_DEBUG("object getter @ " << (void*)raw_to_inst_ptr(raw) << ": throw js exception");
+					return JS_Throw(ctx, e.val().steal());
+				}
+				catch (...)
+				{
+					QJSCPP_DEBUG("object getter @ " << (void*)raw_to_inst_ptr(raw) << ": forward exception");
+					context& c = *reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+					c.store_exception(std::current_exception());
+					return JS_Throw(ctx, JS_NewUncatchableError(ctx));
+				}
+			}
+			return JS_EXCEPTION;
+		}
+		
+		template <typename ClassType, void(ClassType::*Setter)(value_ref, value_ref)>
+		inline JSValue classes::invoke_setter_ref(JSContext *ctx, JSValueConst this_val, JSValueConst val)
+		{
+			QJSCPP_PROFILE_CALL(ctx, "setter", nullptr);
+			if (auto raw = get_raw_inst<ClassType>(this_val))
+			{
+				auto inst = raw_to_inst_ptr(raw);
+				QJSCPP_DEBUG("Call object setter @ " << (void*)inst);
+				try
+				{
+					(inst->*Setter)(value_ref(ctx, this_val), value_ref(ctx, val));
+					return JS_UNDEFINED;
+				}
+				catch (const throw_exception& e)
+				{
+					QJSCPP_DEBUG("object setter @ " << (void*)raw_to_inst_ptr(raw) << ": throw js exception");
+					return JS_Throw(ctx, e.val().steal());
+				}
+				catch (...)
+				{
+					QJSCPP_DEBUG("object setter @ " << (void*)raw_to_inst_ptr(raw) << ": forward exception");
+					context& c = *reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+					c.store_exception(std::current_exception());
+					return JS_Throw(ctx, JS_NewUncatchableError(ctx));
+				}
+			}
+			return JS_EXCEPTION;
+		}
+		
 		//
 		// functions
 		//
@@ -2298,6 +8119,7 @@ namespace quickjs
 		{
 			context* c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
 			context::call_level cl(c->clevel_);
+			context::call_level rl(c->running_);
 			value ret(ctx, JS_Call(ctx, func.val_, thisObj.valid() ? thisObj.val_ : JS_UNDEFINED, acnt, avals));
 			ret.check_throw(true);
 			return ret;
@@ -2311,13 +8133,29 @@ namespace quickjs
 			
 			jsvalue_list alist(ctx, avals, acnt);
 			
-			// C++17 has fold expressions...
-			__attribute__((unused)) int dummy[] = {{0}, ((void)alist.add_value(std::forward<Args>(a)), 0)... };
-			assert(acnt == sizeof...(a));
+			QJSCPP_EXPAND(alist.add_value(std::forward<Args>(a)));
+			QJSCPP_ASSERT(acnt == sizeof...(a));
 			
 			return call_common_args(func, ctx, thisObj, acnt, avals);
 		}
 		
+		template <typename... Args>
+		inline result functions::try_call(const value& func, JSContext* ctx, const value& thisObj, Args&&... a)
+		{
+			context* c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+			size_t acnt = 0;
+			JSValue avals[sizeof...(a) + 1]; // no zero sized array without arguments
+			
+			jsvalue_list alist(ctx, avals, acnt);
+			
+			QJSCPP_EXPAND(alist.add_value(std::forward<Args>(a)));
+			QJSCPP_ASSERT(acnt == sizeof...(a));
+			
+			context::call_level cl(c->clevel_);
+			context::call_level rl(c->running_);
+			return result(ctx, JS_Call(ctx, func.val_, thisObj.valid() ? thisObj.val_ : JS_UNDEFINED, acnt, avals));
+		}
+		
 		template <typename Begin, typename End>
 		inline value functions::call_common_it(const value& func, JSContext* ctx, const value& thisObj, Begin&& begin, End&& end)
 		{
@@ -2326,11 +8164,99 @@ namespace quickjs
 			
 			jsvalue_list alist(ctx, &avals[0], acnt);
 			alist.add_values(begin, end);
-			assert(acnt == avals.size());
+			QJSCPP_ASSERT(acnt == avals.size());
 			
 			return call_common_args(func, ctx, thisObj, acnt, acnt > 0 ? &avals[0] : nullptr);
 		}
 		
+		// The arguments of one call in a batch: a tuple, a vector or a single value
+		template <typename T>
+		inline size_t batch_args_count(const T&)
+		{
+			return 1;
+		}
+		
+		template <typename... T>
+		inline size_t batch_args_count(const std::tuple<T...>&)
+		{
+			return sizeof...(T);
+		}
+		
+		template <typename T>
+		inline size_t batch_args_count(const std::vector<T>& a)
+		{
+			return a.size();
+		}
+		
+		template <typename T>
+		inline void add_batch_args(jsvalue_list& alist, const T& a)
+		{
+			alist.add_value<const T&>(a);
+		}
+		
+		template <typename Tuple, size_t... Is>
+		inline void add_batch_args_tuple(jsvalue_list& alist, const Tuple& a, indices<Is...>)
+		{
+			QJSCPP_EXPAND(alist.add_value<const typename std::tuple_element<Is, Tuple>::type&>(std::get<Is>(a)));
+		}
+		
+		template <typename... T>
+		inline void add_batch_args(jsvalue_list& alist, const std::tuple<T...>& a)
+		{
+			add_batch_args_tuple(alist, a, typename make_indices<sizeof...(T)>::type());
+		}
+		
+		template <typename T>
+		inline void add_batch_args(jsvalue_list& alist, const std::vector<T>& a)
+		{
+			alist.add_values(a.begin(), a.end());
+		}
+		
+		// The values are constructed in place, so their context tracks them
+		inline batch_result functions::make_batch_result(context* c, JSContext* ctx, JSValue ret)
+		{
+			if (!JS_IsException(ret))
+				return batch_result{value(ctx, ret), value(), nullptr};
+			
+			// A C++ exception that went through JS makes the error uncatchable,
+			// report the C++ exception instead
+			std::exception_ptr excpt = c->pop_exception();
+			value exval(ctx, JS_GetException(ctx));
+			if (excpt)
+				return batch_result{value(), value(), excpt};
+			return batch_result{value(), std::move(exval), nullptr};
+		}
+		
+		template <typename Begin, typename End, typename Out>
+		inline size_t functions::call_batch(const value& func, JSContext* ctx, const value& thisObj, Begin begin, End end, Out out)
+		{
+			context* c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+			context::call_level cl(c->clevel_);
+			context::call_level rl(c->running_);
+			JSValueConst this_val = thisObj.valid() ? thisObj.val_ : JS_UNDEFINED;
+			
+			size_t failed = 0;
+			std::vector<JSValue> avals;
+			for (auto it = begin; it != end; ++it)
+			{
+				size_t acnt = 0;
+				size_t n = batch_args_count(*it);
+				if (avals.size() < n)
+					avals.resize(n);
+				
+				JSValue ret;
+				{
+					jsvalue_list alist(ctx, avals.data(), acnt);
+					add_batch_args(alist, *it);
+					ret = JS_Call(ctx, func.val_, this_val, acnt, acnt > 0 ? avals.data() : nullptr);
+				}
+				if (JS_IsException(ret))
+					failed++;
+				*out++ = make_batch_result(c, ctx, ret);
+			}
+			return failed;
+		}
+		
 		//
 		// values
 		//
@@ -2338,59 +8264,146 @@ namespace quickjs
 		{
 			struct convert
 			{
-				const value& val_;
+				value_ref ref_;
+				const value* val_{nullptr};
+				mutable value tmp_;
+#ifdef QJSCPP_HAS_STRING_VIEW
+				mutable cstring str_;
+#endif
 				
 				convert(const value& val):
-					val_(val)
+					ref_(val),
+					val_(&val)
+				{
+				}
+				
+				convert(JSContext* ctx, JSValueConst val):
+					ref_(ctx, val)
 				{
 				}
 				
 				operator const value&() const
 				{
-					QJSCPP_DEBUG("passing through value @ " << (void*)&val_ << ": " << (val_.valid() ? val_.as_string() : ""));
-					return val_;
+					QJSCPP_DEBUG("passing through value @ " << (void*)val_ << ": " << (ref_.valid() ? ref_.as_string() : ""));
+					if (val_)
+						return *val_;
+					// Only materialize a tracked value if the callee asks for one
+					if (!tmp_.valid())
+						tmp_ = value(ref_);
+					return tmp_;
+				}
+				
+				operator value_ref() const
+				{
+					return ref_;
 				}
 				
 				operator std::string() const
 				{
-					QJSCPP_DEBUG("converting value @ " << (void*)&val_ << " to std::string" << ": " << ((val_.is_string() && val_.valid()) ? val_.as_string() : ""));
+					QJSCPP_DEBUG("converting value to std::string" << ": " << ((ref_.valid() && ref_.is_string()) ? ref_.as_string() : ""));
 					std::string ret;
-					return (val_.is_string() && val_.as_string(ret)) ? ret : std::string();
+					return (ref_.is_string() && ref_.as_string(ret)) ? ret : std::string();
 				}
+
+#ifdef QJSCPP_HAS_STRING_VIEW
+				// The view refers to a string owned by this converter, which lives
+				// until the closure returns
+				operator std::string_view() const
+				{
+					if (!ref_.is_string())
+						return std::string_view();
+					str_ = ref_.as_cstring();
+					return str_.view();
+				}
+#endif
 				
 				operator int32_t() const
 				{
-					QJSCPP_DEBUG("converting value @ " << (void*)&val_ << " to int32_t" << ": " << (val_.valid() ? val_.as_string() : ""));
+					QJSCPP_DEBUG("converting value to int32_t" << ": " << (ref_.valid() ? ref_.as_string() : ""));
 					int32_t ret;
-					return val_.as_int32(ret) ? ret : 0;
+					return ref_.as_int32(ret) ? ret : 0;
 				}
 				
 				operator uint32_t() const
 				{
-					QJSCPP_DEBUG("converting value @ " << (void*)&val_ << " to uint32_t" << ": " << (val_.valid() ? val_.as_string() : ""));
+					QJSCPP_DEBUG("converting value to uint32_t" << ": " << (ref_.valid() ? ref_.as_string() : ""));
 					uint32_t ret;
-					return val_.as_uint32(ret) ? ret : 0;
+					return ref_.as_uint32(ret) ? ret : 0;
 				}
 				
 				operator int64_t() const
 				{
-					QJSCPP_DEBUG("converting value @ " << (void*)&val_ << " to int64_t" << ": " << (val_.valid() ? val_.as_string() : ""));
+					QJSCPP_DEBUG("converting value to int64_t" << ": " << (ref_.valid() ? ref_.as_string() : ""));
 					int64_t ret;
-					return val_.as_int64(ret) ? ret : 0;
+					return ref_.as_int64(ret) ? ret : 0;
 				}
 				
 				operator double() const
 				{
-					QJSCPP_DEBUG("converting value @ " << (void*)&val_ << " to double" << ": " << (val_.valid() ? val_.as_string() : ""));
+					QJSCPP_DEBUG("converting value to double" << ": " << (ref_.valid() ? ref_.as_string() : ""));
 					double ret;
-					return val_.as_double(ret) ? ret : 0;
+					return ref_.as_double(ret) ? ret : 0;
 				}
 				
 				operator bool() const
 				{
-					QJSCPP_DEBUG("converting value @ " << (void*)&val_ << " to bool" << ": " << (val_.valid() ? val_.as_string() : ""));
+					QJSCPP_DEBUG("converting value to bool" << ": " << (ref_.valid() ? ref_.as_string() : ""));
 					bool ret;
-					return val_.as_bool(ret) ? ret : false;
+					return ref_.as_bool(ret) ? ret : false;
+				}
+				
+				template <typename T>
+				T unwrap() const
+				{
+					T ret;
+					if (!ref_.as(ret))
+						ret = T();
+					return ret;
+				}
+				
+				template <typename T>
+				operator std::vector<T>() const
+				{
+					return unwrap<std::vector<T>>();
+				}
+				
+				template <typename T, size_t N>
+				operator std::array<T, N>() const
+				{
+					return unwrap<std::array<T, N>>();
+				}
+				
+				template <typename... T>
+				operator std::tuple<T...>() const
+				{
+					return unwrap<std::tuple<T...>>();
+				}
+				
+				template <typename T>
+				operator std::map<std::string, T>() const
+				{
+					return unwrap<std::map<std::string, T>>();
+				}
+				
+				template <typename T>
+				operator std::unordered_map<std::string, T>() const
+				{
+					return unwrap<std::unordered_map<std::string, T>>();
+				}
+				
+				template <typename T, typename std::enable_if<is_struct<T>::value, int>::type = 0>
+				operator T() const
+				{
+					return unwrap<T>();
+				}
+				
+				template <typename T>
+				operator span<T>() const
+				{
+					QJSCPP_DEBUG("converting value to span");
+					span<T> ret;
+					ref_.as_span(ret);
+					return ret;
 				}
 			};
 		};
@@ -2399,71 +8412,147 @@ namespace quickjs
 		// closures
 		//
 		
+		// Typed closures convert straight from argv, so no tracked value is
+		// created unless a parameter actually is a value
 		template<typename Func, size_t... Is, typename std::enable_if<!std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
-		inline auto handle_closure_expand_helper(Func f, const args& a, indices<Is...>)
-			-> typename func_traits<decltype(f)>::result_type
+		inline value handle_closure_expand_helper(Func& f, JSContext* ctx, int argc, JSValueConst* argv, indices<Is...>)
 		{
-			return f((values::convert(a[Is]))...);
+			// Convert the result while the converted arguments are still alive,
+			// it may refer to them (e.g. a std::string_view)
+			return value(ctx, f((values::convert(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED))...));
 		}
 		
 		template<typename Func, size_t... Is, typename std::enable_if<std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
-		inline value handle_closure_expand_helper(Func f, const args& a, indices<Is...>)
+		inline value handle_closure_expand_helper(Func& f, JSContext* ctx, int argc, JSValueConst* argv, indices<Is...>)
 		{
-			f((values::convert(a[Is]))...);
+			f((values::convert(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED))...);
 			return {};
 		}
 		
 		template <typename Func, size_t N>
-		inline JSValue closures_common::handle_closure_expand(Func f, JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+		inline JSValue closures_common::handle_closure_expand(Func& f, JSContext *ctx, JSValueConst /*this_val*/, int argc, JSValueConst *argv)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "closure", f);
 			context* c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
 			try
 			{
-				args a(ctx, N, this_val, argc, argv);
-
-				QJSCPP_DEBUG("closure: got " << argc << " argument(s), expanding: " << N);
-				value ret(ctx, handle_closure_expand_helper(f, a, typename make_indices<N>::type()));
-				QJSCPP_DEBUG("closure: returned: " << (ret.valid() ? ret.as_cstring() : "[nothing]"));
+				QJSCPP_DEBUG("closure: got " << argc << " argument(s), expanding: " << N);
+				value ret = handle_closure_expand_helper(f, ctx, argc, argv, typename make_indices<N>::type());
+				QJSCPP_DEBUG("closure: returned: " << (ret.valid() ? ret.as_cstring() : "[nothing]"));
+				ret.check_throw(true);
+				return ret.valid() ? ret.steal() : JS_UNDEFINED;
+			}
+			catch (const throw_exception& e)
+			{
+				QJSCPP_DEBUG("closure: throw js exception");
+				return JS_Throw(ctx, e.val().steal());
+			}
+			catch (...)
+			{
+				QJSCPP_DEBUG("closure: forward exception");
+				c->store_exception(std::current_exception());
+				return JS_Throw(ctx, JS_NewUncatchableError(ctx));
+			}
+		}
+		
+		template<typename Func, size_t... Is, typename std::enable_if<!std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
+		inline value handle_closure_expand_with_args_helper(Func& f, JSContext* ctx, const args& a, indices<Is...>)
+		{
+			return value(ctx, f(a, (values::convert(a[Is]))...));
+		}
+		
+		template<typename Func, size_t... Is, typename std::enable_if<std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
+		inline value handle_closure_expand_with_args_helper(Func& f, JSContext* /*ctx*/, const args& a, indices<Is...>)
+		{
+			f(a, (values::convert(a[Is]))...);
+			return {};
+		}
+		
+		//
+		// typed class members
+		//
+		
+		template<typename ClassType, typename Func, Func F, size_t... Is, typename std::enable_if<!std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
+		inline value invoke_method_helper(ClassType* inst, JSContext* ctx, int argc, JSValueConst* argv, indices<Is...>)
+		{
+			return value(ctx, (inst->*F)((values::convert(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED))...));
+		}
+		
+		template<typename ClassType, typename Func, Func F, size_t... Is, typename std::enable_if<std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
+		inline value invoke_method_helper(ClassType* inst, JSContext* ctx, int argc, JSValueConst* argv, indices<Is...>)
+		{
+			(inst->*F)((values::convert(ctx, (int)Is < argc ? argv[Is] : JS_UNDEFINED))...);
+			return {};
+		}
+		
+		template <typename ClassType, typename Func, Func F>
+		inline JSValue classes::invoke_method(JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+		{
+			QJSCPP_PROFILE_CALL(ctx, "method", nullptr);
+			QJSCPP_DEBUG("invoke_method with arguments: " << argc);
+			auto raw = get_raw_inst<ClassType>(this_val);
+			if (!raw)
+				return JS_ThrowTypeError(ctx, "not an instance of %s", ClassType::class_definition.name);
+			
+			auto inst = raw_to_inst_ptr(raw);
+			QJSCPP_DEBUG("Call object method @ " << (void*)inst);
+			try
+			{
+				value ret = invoke_method_helper<ClassType, Func, F>(inst, ctx, argc, argv, typename make_indices<func_traits<Func>::arity>::type());
 				ret.check_throw(true);
 				return ret.valid() ? ret.steal() : JS_UNDEFINED;
 			}
 			catch (const throw_exception& e)
 			{
-				QJSCPP_DEBUG("closure: throw js exception");
+				QJSCPP_DEBUG("object method @ " << (void*)inst << ": throw js exception");
 				return JS_Throw(ctx, e.val().steal());
 			}
 			catch (...)
 			{
-				QJSCPP_DEBUG("closure: forward exception");
-				c->store_exception(std::current_exception());
+				QJSCPP_DEBUG("object method @ " << (void*)inst << ": forward exception");
+				context& c = *reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
+				c.store_exception(std::current_exception());
 				return JS_Throw(ctx, JS_NewUncatchableError(ctx));
 			}
 		}
 		
-		template<typename Func, size_t... Is, typename std::enable_if<!std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
-		inline auto handle_closure_expand_with_args_helper(Func f, const args& a, indices<Is...>)
-			-> typename func_traits<decltype(f)>::result_type
+		// Conversions of fields don't throw C++ exceptions, they fail with a JS exception
+		template <typename ClassType, typename MemberType, MemberType ClassType::*Member>
+		inline JSValue classes::get_field(JSContext *ctx, JSValueConst this_val)
 		{
-			return f(a, (values::convert(a[Is]))...);
+			QJSCPP_PROFILE_CALL(ctx, "getter", nullptr);
+			auto raw = get_raw_inst<ClassType>(this_val);
+			if (!raw)
+				return JS_ThrowTypeError(ctx, "not an instance of %s", ClassType::class_definition.name);
+			return js_traits<typename std::remove_const<MemberType>::type>::wrap(ctx, raw_to_inst_ptr(raw)->*Member);
 		}
 		
-		template<typename Func, size_t... Is, typename std::enable_if<std::is_void<typename func_traits<Func>::result_type>::value>::type* = nullptr>
-		inline value handle_closure_expand_with_args_helper(Func f, const args& a, indices<Is...>)
+		template <typename ClassType, typename MemberType, MemberType ClassType::*Member>
+		inline JSValue classes::set_field(JSContext *ctx, JSValueConst this_val, JSValueConst val)
 		{
-			f(a, (values::convert(a[Is]))...);
-			return {};
+			QJSCPP_PROFILE_CALL(ctx, "setter", nullptr);
+			auto raw = get_raw_inst<ClassType>(this_val);
+			if (!raw)
+				return JS_ThrowTypeError(ctx, "not an instance of %s", ClassType::class_definition.name);
+			auto& member = raw_to_inst_ptr(raw)->*Member;
+			MemberType tmp(unwrap_init(member));
+			if (!js_traits<MemberType>::unwrap(ctx, val, tmp))
+				return JS_ThrowTypeError(ctx, "invalid value for property");
+			member = std::move(tmp);
+			return JS_UNDEFINED;
 		}
 		
 		template <typename Func, size_t N>
-		inline JSValue closures_common::handle_closure_expand_with_args(Func f, JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
+		inline JSValue closures_common::handle_closure_expand_with_args(Func& f, JSContext *ctx, JSValueConst this_val, int argc, JSValueConst *argv)
 		{
+			QJSCPP_PROFILE_CALL(ctx, "closure", f);
 			context* c = reinterpret_cast<context*>(JS_GetContextOpaque(ctx));
 			try
 			{
 				args a(ctx, N, this_val, argc, argv);
 
 				QJSCPP_DEBUG("closure(args): got " << argc << " argument(s), expanding: " << N);
-				value ret(ctx, handle_closure_expand_with_args_helper(f, a, typename make_indices<N>::type()));
+				value ret = handle_closure_expand_with_args_helper(f, ctx, a, typename make_indices<N>::type());
 				QJSCPP_DEBUG("closure(args): returned: " << (ret.valid() ? ret.as_cstring() : "[nothing]"));
 				ret.check_throw(true);
 				return ret.valid() ? ret.steal() : JS_UNDEFINED;
@@ -2493,6 +8582,8 @@ namespace quickjs
 			owner_ = &get_runtime();
 			QJSCPP_DEBUG("context track() @" << (void*)this << ": add");
 			owner_->contexts_.insert_head(*this);
+			if (has_time_budget())
+				owner_->time_budgets_++;
 		}
 	}
 	
@@ -2507,14 +8598,15 @@ namespace quickjs
 		if (owner_)
 		{
 			QJSCPP_DEBUG("context track(value&) @" << (void*)this << ": remove");
-			unlink();
-			owner_ = nullptr;
+			untrack();
 		}
 		if (ctx_)
 		{
 			QJSCPP_DEBUG("context track(value&) @" << (void*)this << ": add");
 			owner_ = &get_runtime();
 			owner_->contexts_.insert_head(*this);
+			if (has_time_budget())
+				owner_->time_budgets_++;
 		}
 	}
 	
@@ -2523,10 +8615,670 @@ namespace quickjs
 		if (owner_)
 		{
 			QJSCPP_DEBUG("context untrack() @" << (void*)this << ": remove");
+			if (has_time_budget())
+				owner_->time_budgets_--;
 			unlink();
 			owner_ = nullptr;
 		}
 	}
+	
+	inline value context::eval(const char* buf, size_t len, eval_flags flags, const char* filename)
+	{
+		validate();
+		
+		if (owner_->use_script_cache_)
+		{
+			compiled_script script;
+			if (!owner_->scripts_.find(filename, static_cast<int>(flags), buf, len, script))
+			{
+				script = compile(buf, len, flags, filename);
+				owner_->scripts_.insert(filename, static_cast<int>(flags), buf, len, script);
+			}
+			return eval(script);
+		}
+		
+		auto ctx = ctx_.get();
+		int type = to_eval_flags(flags, buf, len);
+		if (type == JS_EVAL_TYPE_GLOBAL)
+			global_scripts_++;
+		call_level rl(running_);
+		value ret(ctx, JS_Eval(ctx, buf, len, (filename && filename[0]) ? filename : "(none)", type));
+		ret.check_throw(true);
+		return ret;
+	}
+	
+	inline serialized_value value::serialize() const
+	{
+		validate();
+		
+		// Without SharedArrayBuffer functions nothing keeps their memory alive,
+		// and JS_WriteObject2 throws on them
+		serialized_value ret;
+		auto r = reinterpret_cast<runtime*>(JS_GetRuntimeOpaque(JS_GetRuntime(ctx_)));
+		if (r)
+			ret.sab_funcs_ = r->sab_funcs_;
+		int flags = JS_WRITE_OBJ_REFERENCE;
+		if (ret.sab_funcs_.sab_dup && ret.sab_funcs_.sab_free)
+			flags |= JS_WRITE_OBJ_SAB;
+		
+		size_t size = 0;
+		uint8_t** sab_tab = nullptr;
+		size_t sab_count = 0;
+		uint8_t* buf = JS_WriteObject2(ctx_, &size, val_, flags, &sab_tab, &sab_count);
+		if (!buf)
+			value(ctx_, JS_EXCEPTION).check_throw(true);
+		
+		try
+		{
+			ret.data_.assign(buf, buf + size);
+			ret.sabs_.reserve(sab_count);
+			for (size_t i = 0; i < sab_count; i++)
+			{
+				ret.sab_funcs_.sab_dup(ret.sab_funcs_.sab_opaque, sab_tab[i]);
+				ret.sabs_.push_back(sab_tab[i]);
+			}
+		}
+		catch (...)
+		{
+			::js_free(ctx_, buf);
+			::js_free(ctx_, sab_tab);
+			throw;
+		}
+		::js_free(ctx_, buf);
+		::js_free(ctx_, sab_tab);
+		return ret;
+	}
+	
+	inline value context::deserialize(const serialized_value& val)
+	{
+		validate();
+		
+		if (!val.valid())
+			throw exception("invalid serialized value");
+		
+		// Shared memory is freed by the functions of the runtime it's read into
+		if (!val.sabs_.empty())
+		{
+			auto const& sf = get_runtime().sab_funcs_;
+			if (sf.sab_dup != val.sab_funcs_.sab_dup || sf.sab_free != val.sab_funcs_.sab_free)
+				throw exception("SharedArrayBuffers are not shared with this runtime");
+		}
+		
+		auto ctx = ctx_.get();
+		value ret(ctx, JS_ReadObject(ctx, val.data(), val.size(), JS_READ_OBJ_REFERENCE | JS_READ_OBJ_SAB));
+		ret.check_throw(true);
+		return ret;
+	}
+	
+	inline result context::try_eval(const char* str, eval_flags flags)
+	{
+		return try_eval(str, ::strlen(str), flags);
+	}
+	
+	inline result context::try_eval(const char* buf, size_t len, eval_flags flags, const char* filename)
+	{
+		validate();
+		
+		if (owner_->use_script_cache_)
+		{
+			compiled_script script;
+			if (!owner_->scripts_.find(filename, static_cast<int>(flags), buf, len, script))
+			{
+				script = compile(buf, len, flags, filename);
+				owner_->scripts_.insert(filename, static_cast<int>(flags), buf, len, script);
+			}
+			return try_eval(script);
+		}
+		
+		auto ctx = ctx_.get();
+		int type = to_eval_flags(flags, buf, len);
+		if (type == JS_EVAL_TYPE_GLOBAL)
+			global_scripts_++;
+		call_level rl(running_);
+		return result(ctx, JS_Eval(ctx, buf, len, (filename && filename[0]) ? filename : "(none)", type));
+	}
+	
+	inline result context::try_eval(const compiled_script& script)
+	{
+		validate();
+		
+		if (!script.valid())
+			throw exception("invalid compiled script");
+		
+		auto ctx = ctx_.get();
+		JSValue obj = JS_ReadObject(ctx, script.data(), script.size(), JS_READ_OBJ_BYTECODE);
+		if (JS_IsException(obj))
+			return result(ctx, obj);
+		if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE)
+			global_scripts_++;
+		else if (JS_ResolveModule(ctx, obj) < 0)
+		{
+			JS_FreeValue(ctx, obj);
+			return result(ctx, JS_EXCEPTION);
+		}
+		
+		// JS_EvalFunction takes ownership of the function object
+		call_level rl(running_);
+		return result(ctx, JS_EvalFunction(ctx, obj));
+	}
+	
+	inline std::exception_ptr value::rejection_exception(const value& reason)
+	{
+		if (reason.valid() && JS_IsError(reason.ctx_, reason.val_))
+		{
+			value stack = reason.get_property("stack");
+			return std::make_exception_ptr(value_error(reason.as_cstring(), !stack.is_undefined() ? stack.as_cstring() : cstring()));
+		}
+		return std::make_exception_ptr(value_exception(value(reason)));
+	}
+	
+	template <typename OnFulfilled, typename OnRejected>
+	void value::then(OnFulfilled on_fulfilled, OnRejected on_rejected) const
+	{
+		validate();
+		
+		value promise_ctor = value(ctx_, JS_GetGlobalObject(ctx_)).get_property("Promise");
+		value promise = promise_ctor.get_property("resolve").call(promise_ctor, *this);
+		promise.get_property("then").call(promise,
+			value(ctx_,
+				[on_fulfilled](const value& result) mutable -> void
+				{
+					on_fulfilled(result);
+				}),
+			value(ctx_,
+				[on_rejected](const value& reason) mutable -> void
+				{
+					on_rejected(reason);
+				}));
+	}
+	
+	namespace detail
+	{
+		template <typename T>
+		inline void set_promise_value(std::promise<T>& p, const value& result)
+		{
+			p.set_value(result.as<T>());
+		}
+		
+		inline void set_promise_value(std::promise<value>& p, const value& result)
+		{
+			p.set_value(result);
+		}
+		
+		inline void set_promise_value(std::promise<void>& p, const value& /*result*/)
+		{
+			p.set_value();
+		}
+	}
+	
+	template <typename T>
+	std::future<T> value::to_future() const
+	{
+		auto p = std::make_shared<std::promise<T>>();
+		then(
+			[p](const value& result)
+			{
+				try
+				{
+					detail::set_promise_value(*p, result);
+				}
+				catch (...)
+				{
+					p->set_exception(std::current_exception());
+				}
+			},
+			[p](const value& reason)
+			{
+				p->set_exception(rejection_exception(reason));
+			});
+		return p->get_future();
+	}
+	
+	// Failures are reported as JS exceptions, which fail the import
+	inline JSModuleDef* runtime::load_module(JSContext* ctx, const char* name)
+	{
+		try
+		{
+			QJSCPP_DEBUG("load module " << name);
+			const uint8_t* data = nullptr;
+			size_t size = 0;
+			JSValue obj = JS_UNDEFINED;
+			
+			auto it = modules_.find(name);
+			if (it != modules_.end())
+			{
+				data = it->second.data();
+				size = it->second.size();
+			}
+			else
+			{
+				for (auto const& bundle : module_bundles_)
+				{
+					if (bundle.find(name, data, size))
+						break;
+				}
+			}
+			
+			if (data)
+				obj = JS_ReadObject(ctx, data, size, JS_READ_OBJ_BYTECODE);
+			else
+			{
+				std::string source;
+				if (!module_loader_ || !module_loader_(name, source))
+				{
+					JS_ThrowReferenceError(ctx, "could not load module '%s'", name);
+					return nullptr;
+				}
+				
+				obj = JS_Eval(ctx, source.c_str(), source.size(), name, JS_EVAL_TYPE_MODULE | JS_EVAL_FLAG_COMPILE_ONLY);
+				if (!JS_IsException(obj))
+				{
+					size_t len = 0;
+					uint8_t* bytecode = JS_WriteObject(ctx, &len, obj, JS_WRITE_OBJ_BYTECODE);
+					if (bytecode)
+					{
+						try
+						{
+							modules_[name] = compiled_script(bytecode, len);
+						}
+						catch (...)
+						{
+							::js_free(ctx, bytecode);
+							JS_FreeValue(ctx, obj);
+							throw;
+						}
+						::js_free(ctx, bytecode);
+					}
+					else
+						JS_FreeValue(ctx, JS_GetException(ctx)); // still usable, just not cached
+				}
+			}
+			if (JS_IsException(obj))
+				return nullptr;
+			if (JS_VALUE_GET_TAG(obj) != JS_TAG_MODULE)
+			{
+				JS_FreeValue(ctx, obj);
+				JS_ThrowTypeError(ctx, "'%s' is not a module", name);
+				return nullptr;
+			}
+			
+			// The context holds on to the module, like to all loaded ones
+			auto m = reinterpret_cast<JSModuleDef*>(JS_VALUE_GET_PTR(obj));
+			JS_FreeValue(ctx, obj);
+			
+			JSValue meta = JS_GetImportMeta(ctx, m);
+			if (JS_IsException(meta))
+				return nullptr;
+			int ret = JS_DefinePropertyValueStr(ctx, meta, "url", JS_NewString(ctx, name), JS_PROP_C_W_E);
+			JS_FreeValue(ctx, meta);
+			return ret < 0 ? nullptr : m;
+		}
+		catch (...)
+		{
+			QJSCPP_DEBUG("load module " << name << ": forward exception");
+			reinterpret_cast<context*>(JS_GetContextOpaque(ctx))->store_exception(std::current_exception());
+			JS_Throw(ctx, JS_NewUncatchableError(ctx));
+			return nullptr;
+		}
+	}
+	
+	inline char* runtime::normalize_module(JSContext* ctx, const char* base, const char* name)
+	{
+		try
+		{
+			std::string ret = module_normalizer_(base, name);
+			return js_strdup(ctx, ret.c_str());
+		}
+		catch (...)
+		{
+			reinterpret_cast<context*>(JS_GetContextOpaque(ctx))->store_exception(std::current_exception());
+			JS_Throw(ctx, JS_NewUncatchableError(ctx));
+			return nullptr;
+		}
+	}
+	
+	inline size_t runtime::run_pending_jobs(size_t max_jobs)
+	{
+		return run_pending_jobs_until(std::chrono::steady_clock::time_point::max(), max_jobs);
+	}
+	
+	inline size_t runtime::run_pending_jobs_until(std::chrono::steady_clock::time_point deadline, size_t max_jobs)
+	{
+		bool check_deadline = deadline != std::chrono::steady_clock::time_point::max();
+		size_t cnt = 0;
+		while (cnt < max_jobs)
+		{
+			if (check_deadline && std::chrono::steady_clock::now() >= deadline)
+				break;
+			
+			JSContext* ctx = nullptr;
+			bool draining = draining_;
+			draining_ = true;
+			int ret = JS_ExecutePendingJob(rt_.get(), &ctx);
+			draining_ = draining;
+			if (ret == 0)
+				break;
+			cnt++;
+			if (ret < 0)
+			{
+				if (drain_interrupted_)
+				{
+					drain_interrupted_ = false;
+					JS_FreeValue(ctx, JS_GetException(ctx));
+					throw time_budget_exceeded();
+				}
+				if (!JS_GetContextOpaque(ctx))
+				{
+					// The context is gone, there is nobody to report to
+					JS_FreeValue(ctx, JS_GetException(ctx));
+					continue;
+				}
+				value(ctx, JS_EXCEPTION).check_throw(true);
+			}
+		}
+		return cnt;
+	}
+	
+	inline void runtime::post_pending_jobs(event_loop& loop, size_t max_jobs)
+	{
+		if (jobs_posted_ || !has_pending_jobs())
+			return;
+		jobs_posted_ = true;
+		
+		auto alive = alive_;
+		auto lp = &loop;
+		loop.post(
+			[alive, lp, max_jobs]()
+			{
+				runtime* r = *alive;
+				if (!r)
+					return;
+				r->jobs_posted_ = false;
+				r->run_pending_jobs(max_jobs);
+				if (r->has_pending_jobs())
+					r->post_pending_jobs(*lp, max_jobs);
+				else if (r->idle_gc_ && !r->gc_posted_)
+				{
+					// Posted separately, so whatever the loop has queued in the meantime runs first
+					r->gc_posted_ = true;
+					lp->post(
+						[alive]()
+						{
+							runtime* r = *alive;
+							if (!r)
+								return;
+							r->gc_posted_ = false;
+							r->run_gc_if_idle(r->idle_gc_growth_);
+						});
+				}
+			});
+	}
+	
+	inline void context::install_timers(event_loop& loop, error_func on_error)
+	{
+		validate();
+		
+		struct timer_call
+		{
+			value func;
+			std::vector<value> args;
+		};
+		
+		auto lp = &loop;
+		auto alive = owner_->alive_;
+		auto report = std::make_shared<error_func>(std::move(on_error));
+		auto start =
+			[lp, alive, report](const args& a, bool repeat) -> value
+			{
+				context& c = a.get_context();
+				if (a.size() == 0 || !a[0].is_function())
+					throw throw_exception(value::type_error(c, "not a function"));
+				int64_t delay = 0;
+				if (a.size() > 1 && !a[1].is_undefined() && !a[1].as_int64(delay))
+					throw throw_exception(value::type_error(c, "invalid delay"));
+				
+				auto call = std::make_shared<timer_call>();
+				call->func = a[0];
+				for (size_t i = 2; i < a.size(); i++)
+					call->args.push_back(a[i]);
+				auto id = lp->start_timer(std::chrono::milliseconds(std::max<int64_t>(delay, 0)),
+					[call, lp, alive, report]()
+					{
+						// The context or runtime may be gone by now
+						runtime* r = *alive;
+						if (!r || !call->func.valid())
+							return;
+						try
+						{
+							call->func.call(value(), call->args.begin(), call->args.end());
+						}
+						catch (...)
+						{
+							if (*report)
+								(*report)(std::current_exception());
+						}
+						r->post_pending_jobs(*lp);
+					}, repeat);
+				return value(c, static_cast<int64_t>(id));
+			};
+		auto clear =
+			[lp](const args& a) -> void
+			{
+				int64_t id = 0;
+				if (a.size() > 0 && a[0].as_int64(id) && id > 0)
+					lp->cancel_timer(static_cast<event_loop::timer_id>(id));
+			};
+		
+		value global = get_global_object();
+		global.set_property("setTimeout",
+			[start](const args& a) -> value
+			{
+				return start(a, false);
+			});
+		global.set_property("setInterval",
+			[start](const args& a) -> value
+			{
+				return start(a, true);
+			});
+		global.set_property("clearTimeout", clear);
+		global.set_property("clearInterval", clear);
+	}
+	
+	inline void context::set_time_budget(std::chrono::microseconds budget)
+	{
+		validate();
+		
+		owner_->enable_interrupt_handler();
+		if (!has_time_budget())
+			owner_->time_budgets_++;
+		deadline_ = std::chrono::steady_clock::now() + budget;
+	}
+	
+	inline void context::clear_time_budget()
+	{
+		if (owner_ && has_time_budget())
+			owner_->time_budgets_--;
+		deadline_ = std::chrono::steady_clock::time_point::max();
+	}
+	
+	inline bool runtime::handle_interrupt()
+	{
+#ifdef QJSCPP_PROFILE
+		if (sampling_)
+			sample();
+#endif
+		if (time_budgets_ == 0)
+			return false;
+		
+		bool interrupt = false;
+		bool have_now = false;
+		std::chrono::steady_clock::time_point now;
+		contexts_.for_each(
+			[&](context* ctx)
+			{
+				if (interrupt || (ctx->running_ == 0 && !draining_) || !ctx->has_time_budget())
+					return;
+				if (!have_now)
+				{
+					now = std::chrono::steady_clock::now();
+					have_now = true;
+				}
+				if (now >= ctx->deadline_)
+				{
+					QJSCPP_DEBUG("context @" << (void*)ctx << ": time budget exceeded");
+					if (ctx->running_ == 0)
+						drain_interrupted_ = true; // reported by run_pending_jobs_until()
+					else if (!ctx->excpt_)
+						ctx->store_exception(std::make_exception_ptr(time_budget_exceeded()));
+					interrupt = true;
+				}
+			});
+		return interrupt;
+	}
+
+	// For allocations that fail without an exception, e.g. SharedArrayBuffers
+	inline void runtime::throw_out_of_memory()
+	{
+		context* running = nullptr;
+		contexts_.for_each(
+			[&](context* ctx)
+			{
+				if (!running && ctx->running_ > 0)
+					running = ctx;
+			});
+		if (running)
+			JS_ThrowOutOfMemory(running->ctx_.get());
+	}
+
+#ifdef QJSCPP_PROFILE
+	inline void runtime::record_native_call(const void* key, bool by_address, const char* kind, const char* signature, std::chrono::nanoseconds duration)
+	{
+		native_call_stats* stats = native_calls_.find(key);
+		if (!stats)
+		{
+			native_call_stats init;
+			init.name = detail::profile_site_name(kind, signature, key, by_address);
+			stats = native_calls_.insert(key, std::move(init)).first;
+		}
+		stats->calls++;
+		stats->total += duration;
+		if (duration > stats->max)
+			stats->max = duration;
+		stats->histogram[native_call_stats::histogram_bucket((uint64_t)duration.count())]++;
+	}
+	
+	// Takes the stack trace of a thrown error, that's the only way to walk the
+	// stack with the public API. The error is made natively, a script may have
+	// replaced the global Error and must not run from the interrupt handler.
+	inline void runtime::sample()
+	{
+		auto now = std::chrono::steady_clock::now();
+		if (in_sample_ || now < next_sample_)
+			return;
+		next_sample_ = now + sample_interval_;
+		
+		context* running = nullptr;
+		contexts_.for_each(
+			[&](context* ctx)
+			{
+				if (!running && ctx->running_ > 0)
+					running = ctx;
+			});
+		if (!running)
+			return;
+		
+		in_sample_ = true;
+		JSContext* c = running->ctx_.get();
+		JS_FreeValue(c, JS_ThrowInternalError(c, "sample"));
+		JSValue err = JS_GetException(c);
+		JSValue stack = JS_IsObject(err) ? JS_GetPropertyStr(c, err, "stack") : JS_UNDEFINED;
+		if (JS_IsException(stack))
+			JS_FreeValue(c, JS_GetException(c));
+		else if (JS_IsString(stack))
+		{
+			if (const char* str = JS_ToCString(c, stack))
+			{
+				try
+				{
+					samples_[detail::fold_stack(str)]++;
+				}
+				catch (...)
+				{
+					// Losing a sample is better than failing the script
+				}
+				JS_FreeCString(c, str);
+			}
+		}
+		JS_FreeValue(c, stack);
+		JS_FreeValue(c, err);
+		in_sample_ = false;
+	}
+	
+	namespace detail
+	{
+		inline profile_scope::~profile_scope()
+		{
+			auto duration = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start_);
+			if (auto r = reinterpret_cast<runtime*>(JS_GetRuntimeOpaque(JS_GetRuntime(ctx_))))
+			{
+				try
+				{
+					r->record_native_call(key_, by_address_, kind_, signature_, duration);
+				}
+				catch (...)
+				{
+				}
+			}
+		}
+	}
+#endif
+	
+	//
+	// function_handle
+	//
+	
+	template <typename... Args>
+	inline value function_handle::invoke(Args&&... args) const
+	{
+		if (!func_.valid())
+			throw exception("not a function");
+		
+		return detail::functions::call_common(func_, func_.ctx_, this_, std::forward<Args>(args)...);
+	}
+	
+	template <typename Begin, typename End>
+	inline value function_handle::invoke_range(Begin begin, End end)
+	{
+		if (!func_.valid())
+			throw exception("not a function");
+		
+		size_t acnt = 0;
+		argbuf_.resize(std::distance(begin, end));
+		
+		detail::jsvalue_list alist(func_.ctx_, argbuf_.data(), acnt);
+		alist.add_values(begin, end);
+		QJSCPP_ASSERT(acnt == argbuf_.size());
+		
+		return detail::functions::call_common_args(func_, func_.ctx_, this_, acnt, acnt > 0 ? argbuf_.data() : nullptr);
+	}
+	
+	template <typename... Args>
+	inline result function_handle::try_invoke(Args&&... args) const
+	{
+		if (!func_.valid())
+			throw exception("not a function");
+		
+		return detail::functions::try_call(func_, func_.ctx_, this_, std::forward<Args>(args)...);
+	}
+	
+	template <typename Begin, typename End, typename Out>
+	inline size_t function_handle::call_batch(Begin begin, End end, Out out) const
+	{
+		if (!func_.valid())
+			throw exception("not a function");
+		
+		return detail::functions::call_batch(func_, func_.ctx_, this_, begin, end, out);
+	}
 
 } // namespace quickjs
 
@@ -0,0 +1,119 @@
+/*
+ * quickjs-cpp
+ *
+ * Copyright (c) 2020 Thomas Bluemel <thomas@reactsoft.com>
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in
+ * all copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL
+ * THE AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN
+ * THE SOFTWARE.
+ */
+#ifndef __QUICKJS_ASIO__HPP
+#define __QUICKJS_ASIO__HPP
+
+#include "quickjs.hpp"
+#include <boost/asio.hpp>
+
+namespace quickjs
+{
+	// An event_loop running on a boost::asio::io_context, which must outlive it
+	class asio_event_loop:
+		public event_loop
+	{
+		typedef boost::asio::steady_timer timer;
+		
+		boost::asio::io_context& io_;
+		std::map<timer_id, std::shared_ptr<timer>> timers_;
+		timer_id next_id_{1};
+		std::shared_ptr<asio_event_loop*> alive_; // handlers may run after destruction
+		
+		void arm(timer_id id, std::shared_ptr<timer> t, std::chrono::milliseconds interval, std::shared_ptr<task> fn, bool repeat)
+		{
+			auto alive = alive_;
+			t->async_wait(
+				[alive, id, t, interval, fn, repeat](const boost::system::error_code& err)
+				{
+					asio_event_loop* self = *alive;
+					if (err || !self)
+						return;
+					auto it = self->timers_.find(id);
+					if (it == self->timers_.end() || it->second != t)
+						return;
+					
+					if (repeat)
+					{
+						t->expires_at(t->expiry() + interval);
+						self->arm(id, t, interval, fn, true);
+					}
+					else
+						self->timers_.erase(it);
+					(*fn)();
+				});
+		}
+	
+	public:
+		asio_event_loop(const asio_event_loop&) = delete;
+		asio_event_loop& operator=(const asio_event_loop&) = delete;
+		
+		explicit asio_event_loop(boost::asio::io_context& io):
+			io_(io),
+			alive_(std::make_shared<asio_event_loop*>(this))
+		{
+		}
+		
+		~asio_event_loop()
+		{
+			*alive_ = nullptr;
+			for (auto const& it : timers_)
+				it.second->cancel();
+		}
+		
+		boost::asio::io_context& get_io_context() const
+		{
+			return io_;
+		}
+		
+		void post(task t) override
+		{
+			boost::asio::post(io_, std::move(t));
+		}
+		
+		timer_id start_timer(std::chrono::milliseconds delay, task t, bool repeat = false) override
+		{
+			if (delay.count() < 0)
+				delay = std::chrono::milliseconds(0);
+			auto id = next_id_++;
+			auto tm = std::make_shared<timer>(io_);
+			tm->expires_after(delay);
+			timers_.insert(std::make_pair(id, tm));
+			// A repeating timer with an interval of 0 would starve everything else
+			arm(id, tm, (repeat && delay.count() == 0) ? std::chrono::milliseconds(1) : delay, std::make_shared<task>(std::move(t)), repeat);
+			return id;
+		}
+		
+		bool cancel_timer(timer_id id) override
+		{
+			auto it = timers_.find(id);
+			if (it == timers_.end())
+				return false;
+			it->second->cancel();
+			timers_.erase(it);
+			return true;
+		}
+	};
+} // namespace quickjs
+
+#endif